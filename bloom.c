@@ -10,57 +10,232 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bloom.h"
+#include "bloom_internal.h"
 #include "murmurhash2.h"
 
+#ifdef BLOOM_AVX2
+#include <immintrin.h>
+#endif
+
 #define MAKESTRING(n) STRING(n)
 #define STRING(n) #n
 #define BLOOM_MAGIC "libbloom2"
 
-inline static int test_bit_set_bit(unsigned char * buf,
-                                   unsigned long int bit, int set_bit)
+// bloom_build_parallel() processes elements in batches of about this many
+// bit positions, which bounds the memory used for them.
+#define BUILD_BATCH_BITS (1ul << 24)
+
+// Largest range of bits (as a shift) one bloom_build_parallel() thread sets
+// at a time, 256KB so it stays in cache while being updated.
+#define BUILD_RANGE_SHIFT 21
+
+// bloom_reset() returns the pages of bit fields at least this large to the
+// kernel instead of clearing them (where that is known to zero them).
+#define RESET_MADVISE_MIN (16ul << 20)
+
+// bloom_merge_files() reads and writes the bit fields in chunks of this
+// size.
+#define MERGE_CHUNK (4ul << 20)
+
+// bloom_save_background() writes the bit field in chunks of this size,
+// aligned to it in the file.
+#define SAVE_CHUNK (4ul << 20)
+
+
+void bloom_hash_buffer(const struct bloom * bloom,
+                       const void * buffer, int len, struct bloom_hash * hash)
+{
+  if (bloom->flags & BLOOM_HASH64) {
+    bloom_hash_fp(bloom, murmurhash64a(buffer, len, BLOOM_SEED), hash);
+    return;
+  }
+
+  hash->a = murmurhash2(buffer, len, BLOOM_SEED);
+  hash->b = murmurhash2(buffer, len, (unsigned int)hash->a);
+}
+
+
+void bloom_hash_iov(const struct bloom * bloom,
+                    const struct iovec * iov, int iovcnt,
+                    struct bloom_hash * hash)
 {
-  unsigned long int byte = bit >> 3;
-  unsigned char c = buf[byte];        // expensive memory access
-  unsigned char mask = 1 << (bit % 8ul);
+  size_t len = 0;
+  int n;
 
-  if (c & mask) {
-    return 1;
-  } else {
-    if (set_bit) {
-      buf[byte] = c | mask;
+  for (n = 0; n < iovcnt; n++) {
+    len += iov[n].iov_len;
+  }
+
+  if (bloom->flags & BLOOM_HASH64) {
+    struct murmurhash64a_state state;
+    murmurhash64a_init(&state, BLOOM_SEED, len);
+    for (n = 0; n < iovcnt; n++) {
+      murmurhash64a_update(&state, iov[n].iov_base, iov[n].iov_len);
     }
+    bloom_hash_fp(bloom, murmurhash64a_final(&state), hash);
+    return;
+  }
+
+  struct murmurhash2_state state;
+
+  murmurhash2_init(&state, BLOOM_SEED, len);
+  for (n = 0; n < iovcnt; n++) {
+    murmurhash2_update(&state, iov[n].iov_base, iov[n].iov_len);
+  }
+  hash->a = murmurhash2_final(&state);
+
+  murmurhash2_init(&state, (unsigned int)hash->a, len);
+  for (n = 0; n < iovcnt; n++) {
+    murmurhash2_update(&state, iov[n].iov_base, iov[n].iov_len);
+  }
+  hash->b = murmurhash2_final(&state);
+}
+
+
+#ifdef BLOOM_AVX2
+/*
+ * Whether check_gather_avx2() handles 'bloom': the positions must be
+ * computable as (first + i * step) mod bits, which holds for the default
+ * hashes (a and b under 32 bits, so a + b * i never wraps) and for
+ * BLOOM_POW2 (where the wrap is a multiple of bits).
+ *
+ */
+static int can_gather(const struct bloom * bloom)
+{
+  if (bloom->flags & (BLOOM_ENHANCED | BLOOM_PAGED)) { return 0; }
+  if ((bloom->flags & BLOOM_HASH64) && !(bloom->flags & BLOOM_POW2)) {
     return 0;
   }
+
+  return bloom->bits <= (1ul << 32) && bloom->bytes >= 8 &&
+    bloom_have_avx2();
 }
 
 
-static int bloom_check_add(struct bloom * bloom,
-                           const void * buffer, int len, int add)
+/*
+ * bloom_check_add_hash() without adding, probing four bits at a time.
+ *
+ * The positions of a group are computed in 64 bit lanes. The 64 bit words
+ * starting at the bytes containing them are gathered in one instruction
+ * and each shifted right to bring the probed bit to the bottom. Near the
+ * end of the bit field the word is read from bytes - 8 instead, with the
+ * shift adjusted, so nothing past the bit field is ever read. Since x86 is
+ * little-endian, bit n of the word is bit n % 8 of byte n / 8, exactly the
+ * bit test_bit_set_bit() tests.
+ *
+ */
+__attribute__((target("avx2")))
+static int check_gather_avx2(const struct bloom * bloom,
+                             const struct bloom_hash * hash)
 {
-  if (bloom->ready == 0) {
-    printf("bloom at %p not initialized!\n", (void *)bloom);
-    return -1;
+  uint64_t bits = bloom->bits;
+  uint64_t first, step;
+
+  if (bloom->flags & BLOOM_POW2) {
+    first = hash->a & (bits - 1);
+    step = (hash->b | 1) & (bits - 1);
+  } else {
+    first = hash->a % bits;
+    step = hash->b % bits;
+  }
+
+  // Lanes i = 0..3 start at first + i * step (all under 2^34) and move
+  // on by 4 * step for each group.
+  const __m256i vbits = _mm256_set1_epi64x(bits);
+  const __m256i vbits1 = _mm256_set1_epi64x(bits - 1);
+  const __m256i vbits2 = _mm256_set1_epi64x(2 * bits - 1);
+  const __m256i vmask = _mm256_set1_epi64x(bits - 1);
+  const __m256i vlast = _mm256_set1_epi64x(bloom->bytes - 8);
+  const __m256i seven = _mm256_set1_epi64x(7);
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i vstep4 = _mm256_set1_epi64x((4 * step) % bits);
+  const int pow2 = bloom->flags & BLOOM_POW2;
+
+  __m256i x = _mm256_add_epi64(_mm256_set1_epi64x(first),
+                               _mm256_mul_epu32(_mm256_set1_epi64x(step),
+                                                _mm256_set_epi64x(3, 2, 1, 0)));
+  if (pow2) {
+    x = _mm256_and_si256(x, vmask);
+  } else {
+    // x < 4 * bits
+    x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, vbits2),
+                                             _mm256_add_epi64(vbits, vbits)));
+    x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, vbits1),
+                                             vbits));
+  }
+
+  unsigned int left = bloom->hashes;
+
+  while (1) {
+    __m256i byte = _mm256_srli_epi64(x, 3);
+    __m256i over = _mm256_cmpgt_epi64(byte, vlast);
+    __m256i at = _mm256_blendv_epi8(byte, vlast, over);
+    __m256i shift = _mm256_add_epi64(
+      _mm256_slli_epi64(_mm256_sub_epi64(byte, at), 3),
+      _mm256_and_si256(x, seven));
+
+    __m256i word = _mm256_i64gather_epi64((const long long *)bloom->bf,
+                                          at, 1);
+    __m256i bit = _mm256_and_si256(_mm256_srlv_epi64(word, shift), one);
+    int set = _mm256_movemask_pd(
+      _mm256_castsi256_pd(_mm256_cmpeq_epi64(bit, one)));
+
+    if (left <= 4) {
+      int want = (1 << left) - 1;
+      return (set & want) == want;
+    }
+
+    if (set != 0xf) {
+      return 0;
+    }
+    left -= 4;
+
+    x = _mm256_add_epi64(x, vstep4);
+    if (pow2) {
+      x = _mm256_and_si256(x, vmask);
+    } else {
+      x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, vbits1),
+                                               vbits));
+    }
+  }
+}
+#endif
+
+
+int bloom_check_add_hash(struct bloom * bloom,
+                         const struct bloom_hash * hash, int add)
+{
+#ifdef BLOOM_AVX2
+  if (!add && can_gather(bloom)) {
+    return check_gather_avx2(bloom, hash);
   }
+#endif
 
   unsigned char hits = 0;
-  unsigned int a = murmurhash2(buffer, len, 0x9747b28c);
-  unsigned int b = murmurhash2(buffer, len, a);
   unsigned long int x;
   unsigned long int i;
 
   for (i = 0; i < bloom->hashes; i++) {
-    x = (a + b*i) % bloom->bits;
+    x = bloom_nth_bit(bloom, hash, i);
     if (test_bit_set_bit(bloom->bf, x, add)) {
       hits++;
     } else if (!add) {
@@ -77,6 +252,49 @@ static int bloom_check_add(struct bloom * bloom,
 }
 
 
+static int bloom_check_add(struct bloom * bloom,
+                           const void * buffer, int len, int add)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  bloom_hash_buffer(bloom, buffer, len, &hash);
+
+  int rv = bloom_check_add_hash(bloom, &hash, add);
+
+  if (bloom_tracing()) {
+    struct iovec iov = { (void *)buffer, (size_t)len };
+    bloom_trace_record(&iov, 1, add, rv);
+  }
+
+  return rv;
+}
+
+
+static int bloom_check_add_iov(struct bloom * bloom,
+                               const struct iovec * iov, int iovcnt, int add)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  bloom_hash_iov(bloom, iov, iovcnt, &hash);
+
+  int rv = bloom_check_add_hash(bloom, &hash, add);
+
+  if (bloom_tracing()) {
+    bloom_trace_record(iov, iovcnt, add, rv);
+  }
+
+  return rv;
+}
+
+
 // DEPRECATED - Please migrate to bloom_init2.
 int bloom_init(struct bloom * bloom, int entries, double error)
 {
@@ -86,12 +304,12 @@ int bloom_init(struct bloom * bloom, int entries, double error)
 
 int bloom_init2(struct bloom * bloom, unsigned int entries, double error)
 {
-  if (sizeof(unsigned long int) < 8) {
-    printf("error: libbloom will not function correctly because\n");
-    printf("sizeof(unsigned long int) == %ld\n", sizeof(unsigned long int));
-    exit(1);
-  }
+  return bloom_init3(bloom, entries, error, 0);
+}
+
 
+int bloom_shape(struct bloom * bloom, unsigned long int entries, double error)
+{
   memset(bloom, 0, sizeof(struct bloom));
 
   if (entries < 1000 || error <= 0 || error >= 1) {
@@ -117,13 +335,6 @@ int bloom_init2(struct bloom * bloom, unsigned int entries, double error)
 
   bloom->hashes = (unsigned char)ceil(0.693147180559945 * bloom->bpe); // ln(2)
 
-  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
-  if (bloom->bf == NULL) {                                   // LCOV_EXCL_START
-    return 1;
-  }                                                          // LCOV_EXCL_STOP
-
-  bloom->ready = 1;
-
   bloom->major = BLOOM_VERSION_MAJOR;
   bloom->minor = BLOOM_VERSION_MINOR;
 
@@ -131,191 +342,1310 @@ int bloom_init2(struct bloom * bloom, unsigned int entries, double error)
 }
 
 
-int bloom_check(struct bloom * bloom, const void * buffer, int len)
+int bloom_shape3(struct bloom * bloom, unsigned long int entries,
+                 double error, unsigned int flags)
 {
-  return bloom_check_add(bloom, buffer, len, 0);
-}
+  if (bloom_shape(bloom, entries, error)) {
+    return 1;
+  }
 
+  if (flags & ~BLOOM_FLAGS_KNOWN) {
+    return 1;
+  }
+  if ((flags & BLOOM_PAGED) && (flags & (BLOOM_POW2 | BLOOM_ENHANCED))) {
+    return 1;
+  }
+  if (flags & BLOOM_ENHANCED) {
+    flags |= BLOOM_HASH64;
+  }
+  bloom->flags = flags;
 
-int bloom_add(struct bloom * bloom, const void * buffer, int len)
-{
-  return bloom_check_add(bloom, buffer, len, 1);
-}
+  if (flags & BLOOM_POW2) {
+    unsigned long int bits = 8;
+    while (bits < bloom->bits) {
+      bits <<= 1;
+    }
+    bloom->bits = bits;
+    bloom->bytes = bits / 8;
+    bloom->bpe = (double)bits / entries;
+  }
 
+  if (flags & BLOOM_PAGED) {
+    unsigned long int pages = (bloom->bits - 1) / BLOOM_PAGE_BITS + 1;
+    bloom->bits = pages * BLOOM_PAGE_BITS;
+    bloom->bytes = pages * BLOOM_PAGE_BYTES;
+    bloom->bpe = (double)bloom->bits / entries;
+  }
 
-void bloom_print(struct bloom * bloom)
-{
-  printf("bloom at %p\n", (void *)bloom);
-  if (!bloom->ready) { printf(" *** NOT READY ***\n"); }
-  printf(" ->version = %d.%d\n", bloom->major, bloom->minor);
-  printf(" ->entries = %u\n", bloom->entries);
-  printf(" ->error = %f\n", bloom->error);
-  printf(" ->bits = %lu\n", bloom->bits);
-  printf(" ->bits per elem = %f\n", bloom->bpe);
-  printf(" ->bytes = %lu", bloom->bytes);
-  unsigned int KB = bloom->bytes / 1024;
-  unsigned int MB = KB / 1024;
-  printf(" (%u KB, %u MB)\n", KB, MB);
-  printf(" ->hash functions = %d\n", bloom->hashes);
+  return 0;
 }
 
 
-void bloom_free(struct bloom * bloom)
+int bloom_init3(struct bloom * bloom, unsigned long int entries, double error,
+                unsigned int flags)
 {
-  if (bloom->ready) {
-    free(bloom->bf);
+  if (sizeof(unsigned long int) < 8) {
+    printf("error: libbloom will not function correctly because\n");
+    printf("sizeof(unsigned long int) == %ld\n", sizeof(unsigned long int));
+    exit(1);
   }
-  bloom->ready = 0;
+
+  if (bloom_shape3(bloom, entries, error, flags)) {
+    return 1;
+  }
+
+  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
+  if (bloom->bf == NULL) {                                   // LCOV_EXCL_START
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  bloom->ready = 1;
+
+  return 0;
 }
 
 
-int bloom_reset(struct bloom * bloom)
+/*
+ * Cost model used by bloom_init_budget(). The defaults are typical of
+ * current x86-64 servers, bloom_calibrate() replaces them with values
+ * measured on this host.
+ *
+ */
+#define COST_POINTS 4
+#define CALIBRATE_ROUNDS (1ul << 20)
+
+static struct cost_model
 {
-  if (!bloom->ready) return 1;
-  memset(bloom->bf, 0, bloom->bytes);
-  return 0;
+  double hash_ns[2];                    // hashing a 16 byte element, without
+                                        // and with BLOOM_HASH64
+  double mod_ns;                        // a modulo, which BLOOM_POW2 avoids
+  unsigned long int bytes[COST_POINTS]; // bit field sizes and the cost of
+  double probe_ns[COST_POINTS];         // one random probe into them (of a
+                                        // position computed by masking)
+} cost_model = {
+  { 20.0, 12.0 },
+  2.0,
+  { 1ul << 14, 1ul << 18, 1ul << 22, 1ul << 26 },
+  { 2.0, 4.0, 12.0, 60.0 },
+};
+
+static volatile uint64_t calibrate_sink;
+
+
+static double elapsed_ns(const struct timespec * start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
 }
 
 
-int bloom_save(struct bloom * bloom, char * filename)
+int bloom_calibrate()
 {
-  if (filename == NULL || filename[0] == 0) {
-    return 1;
+  struct cost_model model = cost_model;
+  struct bloom shape;
+  struct bloom_hash hash;
+  struct timespec start;
+  unsigned char key[16];
+  uint64_t sink = 0;
+  unsigned long int i;
+  int n;
+
+  memset(&shape, 0, sizeof(struct bloom));
+  memset(key, 0, sizeof(key));
+
+  for (n = 0; n < 2; n++) {
+    shape.flags = n ? BLOOM_HASH64 : 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+      memcpy(key, &i, sizeof(i));
+      bloom_hash_buffer(&shape, key, sizeof(key), &hash);
+      sink += hash.a ^ hash.b;
+    }
+    model.hash_ns[n] = elapsed_ns(&start) / CALIBRATE_ROUNDS;
   }
 
-  int fd = open(filename, O_WRONLY | O_CREAT, 0644);
-  if (fd < 0) {
+  unsigned long int size = model.bytes[COST_POINTS - 1];
+  unsigned char * buf = (unsigned char *)malloc(size);
+  if (buf == NULL) {                                         // LCOV_EXCL_START
     return 1;
+  }                                                          // LCOV_EXCL_STOP
+  memset(buf, 0x55, size);
+
+  // Probes are independent of each other, as they are in bloom_check(),
+  // so this measures throughput rather than raw memory latency. The sizes
+  // are powers of two, so positions are masked.
+  for (n = 0; n < COST_POINTS; n++) {
+    unsigned long int bits = model.bytes[n] * 8;
+    uint64_t x = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+      x = x * 6364136223846793005ull + 1442695040888963407ull;
+      sink += test_bit_set_bit(buf, (x >> 11) & (bits - 1), 0);
+    }
+    model.probe_ns[n] = elapsed_ns(&start) / CALIBRATE_ROUNDS;
+    if (n > 0 && model.probe_ns[n] < model.probe_ns[n - 1]) {
+      model.probe_ns[n] = model.probe_ns[n - 1];
+    }
   }
 
-  ssize_t out = write(fd, BLOOM_MAGIC, strlen(BLOOM_MAGIC));
-  if (out != strlen(BLOOM_MAGIC)) { goto save_error; }       // LCOV_EXCL_LINE
-
-  uint16_t size = sizeof(struct bloom);
-  out = write(fd, &size, sizeof(uint16_t));
-  if (out != sizeof(uint16_t)) { goto save_error; }          // LCOV_EXCL_LINE
-
-  out = write(fd, bloom, sizeof(struct bloom));
-  if (out != sizeof(struct bloom)) { goto save_error; }      // LCOV_EXCL_LINE
+  // The same probes into the smallest size, by modulo of a size which is
+  // not a power of two.
+  unsigned long int bits = model.bytes[0] * 8 - 1;
+  uint64_t x = 1;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < CALIBRATE_ROUNDS; i++) {
+    x = x * 6364136223846793005ull + 1442695040888963407ull;
+    sink += test_bit_set_bit(buf, (x >> 11) % bits, 0);
+  }
+  model.mod_ns = elapsed_ns(&start) / CALIBRATE_ROUNDS - model.probe_ns[0];
+  if (model.mod_ns < 0) {
+    model.mod_ns = 0;
+  }
 
-  out = write(fd, bloom->bf, bloom->bytes);
-  if (out != bloom->bytes) { goto save_error; }              // LCOV_EXCL_LINE
+  free(buf);
+  calibrate_sink = sink;
+  cost_model = model;
 
-  close(fd);
   return 0;
-                                                             // LCOV_EXCL_START
- save_error:
-  close(fd);
-  return 1;
-                                                             // LCOV_EXCL_STOP
 }
 
 
-int bloom_load(struct bloom * bloom, char * filename)
+/*
+ * Cost of one probe into a bit field of 'bytes', interpolated (on a log
+ * scale of the size) between the points of the cost model.
+ *
+ */
+static double cost_probe_ns(unsigned long int bytes)
 {
-  int rv = 0;
+  int n;
 
-  if (filename == NULL || filename[0] == 0) { return 1; }
-  if (bloom == NULL) { return 2; }
+  if (bytes <= cost_model.bytes[0]) {
+    return cost_model.probe_ns[0];
+  }
 
-  memset(bloom, 0, sizeof(struct bloom));
+  for (n = 1; n < COST_POINTS; n++) {
+    if (bytes <= cost_model.bytes[n]) {
+      double f = log2((double)bytes / cost_model.bytes[n - 1]) /
+        log2((double)cost_model.bytes[n] / cost_model.bytes[n - 1]);
+      return cost_model.probe_ns[n - 1] +
+        f * (cost_model.probe_ns[n] - cost_model.probe_ns[n - 1]);
+    }
+  }
 
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0) { return 3; }
+  return cost_model.probe_ns[COST_POINTS - 1];
+}
 
-  char line[30];
-  memset(line, 0, 30);
-  ssize_t in = read(fd, line, strlen(BLOOM_MAGIC));
 
-  if (in != strlen(BLOOM_MAGIC)) {
-    rv = 4;
-    goto load_error;
+/*
+ * Expected false positive rate of a BLOOM_PAGED filter: the load of each
+ * page is Poisson distributed around entries / pages, and a page holding
+ * j elements has j * hashes random bits set. Large loads are summed in
+ * steps, which the smooth distribution allows.
+ *
+ */
+static double paged_error(unsigned long int entries, unsigned long int pages,
+                          unsigned int hashes)
+{
+  double lambda = (double)entries / pages;
+  double spread = 12 * sqrt(lambda) + 50;
+  double lo = lambda > spread ? floor(lambda - spread) : 0;
+  double step = ceil(2 * spread / 400);
+  double unset = log1p(-1.0 / BLOOM_PAGE_BITS);
+  double p = 0;
+  double j;
+
+  for (j = lo; j <= lambda + spread; j += step) {
+    double load = exp(j * log(lambda) - lambda - lgamma(j + 1));
+    p += load * step * pow(-expm1(j * hashes * unset), hashes);
   }
 
-  if (strncmp(line, BLOOM_MAGIC, strlen(BLOOM_MAGIC))) {
-    rv = 5;
-    goto load_error;
-  }
+  return p;
+}
 
-  uint16_t size;
-  in = read(fd, &size, sizeof(uint16_t));
-  if (in != sizeof(uint16_t)) {
-    rv = 6;
-    goto load_error;
-  }
 
-  if (size != sizeof(struct bloom)) {
-    rv = 7;
-    goto load_error;
+/*
+ * Fill in the expected error and lookup costs of 'budget' for a filter
+ * of 'bits' with 'hashes' hashes and the given flags.
+ *
+ * Plain double hashing (without BLOOM_ENHANCED) sets the same bits for
+ * two elements whose hashes agree modulo the filter size, and shifted
+ * runs of them for hashes which differ by a multiple of the step; that
+ * is what the extra error term counts. BLOOM_POW2 halves the steps (they
+ * are odd) but saves the modulo of every probe. BLOOM_PAGED takes one
+ * modulo and one probe to find the page, then probes within it.
+ *
+ */
+static void budget_estimate(struct bloom_budget * budget,
+                            unsigned long int bits, unsigned int hashes,
+                            unsigned int flags)
+{
+  double fill = 1.0 - exp(-(double)hashes * budget->entries / bits);
+  double probe = cost_probe_ns(bits / 8);
+  double hash = cost_model.hash_ns[(flags & BLOOM_HASH64) ? 1 : 0];
+  double first = probe;
+  double shifts = 1;
+  double probes = 0;
+  double p = 1;
+  unsigned int i;
+
+  // An absent element gets past probe i only if bits 0..i-1 were all set.
+  for (i = 0; i < hashes; i++) {
+    probes += p;
+    if (i > 0) {
+      shifts += 2 * p;
+    }
+    p *= fill;
   }
 
-  in = read(fd, bloom, sizeof(struct bloom));
-  if (in != sizeof(struct bloom)) {
-    rv = 8;
-    goto load_error;
+  if (flags & BLOOM_PAGED) {
+    p = paged_error(budget->entries, bits / BLOOM_PAGE_BITS, hashes);
+    first = probe + cost_model.mod_ns;
+    probe = cost_probe_ns(BLOOM_PAGE_BYTES);
+  } else {
+    if (!(flags & BLOOM_ENHANCED)) {
+      double steps = (flags & BLOOM_POW2) ? bits / 2.0 : (double)bits;
+      p += budget->entries / (steps * bits) * shifts;
+    }
+    if (!(flags & BLOOM_POW2)) {
+      probe += cost_model.mod_ns;
+      first = probe;
+    }
   }
 
-  bloom->bf = NULL;
-  if (bloom->major != BLOOM_VERSION_MAJOR) {
-    rv = 9;
-    goto load_error;
-  }
+  budget->error = p < 1 ? p : 1;
+  budget->ns_hit = hash + first + (hashes - 1) * probe;
+  budget->ns_miss = hash + first + (probes - 1) * probe;
+}
 
-  bloom->bf = (unsigned char *)malloc(bloom->bytes);
-  if (bloom->bf == NULL) { rv = 10; goto load_error; }       // LCOV_EXCL_LINE
 
-  in = read(fd, bloom->bf, bloom->bytes);
-  if (in != bloom->bytes) {
-    rv = 11;
-    free(bloom->bf);
-    bloom->bf = NULL;
-    goto load_error;
+/*
+ * Round 'bits' to a size the layout of 'flags' allows, up or down:
+ * whole bytes, a power of two with BLOOM_POW2, whole pages with
+ * BLOOM_PAGED. Returns 0 if rounding down leaves nothing.
+ *
+ */
+static unsigned long int budget_round(unsigned long int bits,
+                                      unsigned int flags, int up)
+{
+  unsigned long int r;
+
+  if (flags & BLOOM_PAGED) {
+    r = bits / BLOOM_PAGE_BITS;
+    if (up && r * BLOOM_PAGE_BITS < bits) {
+      r++;
+    }
+    return r * BLOOM_PAGE_BITS;
   }
 
-  close(fd);
-  return rv;
+  if (flags & BLOOM_POW2) {
+    for (r = 8; r < bits; r <<= 1) { }
+    if (!up && r > bits) {
+      r >>= 1;
+    }
+    return r >= 8 ? r : 0;
+  }
 
- load_error:
-  close(fd);
-  bloom->ready = 0;
-  return rv;
+  return up ? (bits + 7) & ~7ul : bits & ~7ul;
 }
 
 
-int bloom_merge(struct bloom * bloom_dest, struct bloom * bloom_src)
+/*
+ * Layouts bloom_init_budget() chooses from, in order of preference when
+ * they tie.
+ *
+ */
+static const unsigned int budget_layouts[] = {
+  BLOOM_ENHANCED | BLOOM_HASH64,
+  BLOOM_HASH64,
+  0,
+  BLOOM_POW2 | BLOOM_ENHANCED | BLOOM_HASH64,
+  BLOOM_POW2 | BLOOM_HASH64,
+  BLOOM_POW2,
+  BLOOM_PAGED | BLOOM_HASH64,
+  BLOOM_PAGED,
+};
+
+#define BUDGET_LAYOUTS (sizeof(budget_layouts) / sizeof(budget_layouts[0]))
+#define BUDGET_GROW_STEPS 256
+
+
+int bloom_init_budget(struct bloom * bloom, struct bloom_budget * budget)
 {
-  if (bloom_dest->ready == 0) {
-    printf("bloom at %p not initialized!\n", (void *)bloom_dest);
-    return -1;
+  struct bloom_budget best;
+  struct bloom_budget c;
+  unsigned long int bits;
+  unsigned long int best_bits = 0;
+  unsigned int flags;
+  unsigned int best_flags = 0;
+  unsigned int k;
+  unsigned int best_k = 0;
+  unsigned int n;
+  int grow;
+
+  memset(bloom, 0, sizeof(struct bloom));
+  memset(&best, 0, sizeof(struct bloom_budget));
+
+  unsigned long int entries = budget->entries;
+  double max_error = budget->max_error;
+  unsigned long int max_bytes = budget->max_bytes;
+  unsigned int max_k = budget->max_hashes;
+
+  if (entries < 1 || max_error < 0 || max_error >= 1) {
+    return 1;
   }
 
-  if (bloom_src->ready == 0) {
-    printf("bloom at %p not initialized!\n", (void *)bloom_src);
+  if (budget->goal == BLOOM_MIN_ERROR) {
+    if (max_bytes == 0) { return 1; }
+  } else if (budget->goal == BLOOM_MIN_COST) {
+    if (max_error == 0) { return 1; }
+  } else {
+    return 1;
+  }
+
+  if (max_bytes == 0 || max_bytes > ULONG_MAX / 16) {
+    max_bytes = ULONG_MAX / 16;
+  }
+
+  if (max_k == 0 || max_k > UCHAR_MAX) {
+    max_k = UCHAR_MAX;
+  }
+
+  for (n = 0; n < BUDGET_LAYOUTS; n++) {
+    flags = budget_layouts[n];
+    for (k = 1; k <= max_k; k++) {
+
+      if (budget->goal == BLOOM_MIN_ERROR) {
+        bits = budget_round(max_bytes * 8, flags, 0);
+      } else {
+        // Smallest filter with k hashes which could meet max_error; the
+        // layout may need more.
+        double b = -(double)k * entries / log1p(-pow(max_error, 1.0 / k));
+        if (b > (double)max_bytes * 8) {
+          continue;
+        }
+        bits = budget_round((unsigned long int)ceil(b), flags, 1);
+      }
+
+      for (grow = 0; grow < BUDGET_GROW_STEPS; grow++) {
+        if (bits == 0 || bits > max_bytes * 8) {
+          break;
+        }
+        c = *budget;
+        budget_estimate(&c, bits, k, flags);
+        if (budget->goal == BLOOM_MIN_ERROR || c.error <= max_error) {
+          break;
+        }
+        bits = budget_round(bits + bits / 64 + 1, flags, 1);
+      }
+
+      if (grow == BUDGET_GROW_STEPS || bits == 0 || bits > max_bytes * 8) {
+        continue;
+      }
+
+      // See BLOOM_HASH64.
+      if (!(flags & BLOOM_HASH64) && bits > (1ul << 32)) {
+        continue;
+      }
+
+      if (max_error > 0 && c.error > max_error) {
+        continue;
+      }
+
+      if (best_k != 0) {
+        if (budget->goal == BLOOM_MIN_ERROR) {
+          if (c.error > best.error ||
+              (c.error == best.error && c.ns_miss >= best.ns_miss)) {
+            continue;
+          }
+        } else {
+          if (c.ns_miss > best.ns_miss ||
+              (c.ns_miss == best.ns_miss && bits >= best_bits)) {
+            continue;
+          }
+        }
+      }
+
+      best = c;
+      best_bits = bits;
+      best_k = k;
+      best_flags = flags;
+    }
+  }
+
+  if (best_k == 0) {
+    return 1;
+  }
+
+  bloom->entries = entries;
+  bloom->error = best.error;
+  bloom->bits = best_bits;
+  bloom->bytes = best_bits / 8;
+  bloom->hashes = (unsigned char)best_k;
+  bloom->flags = best_flags;
+  bloom->bpe = (double)best_bits / entries;
+  bloom->major = BLOOM_VERSION_MAJOR;
+  bloom->minor = BLOOM_VERSION_MINOR;
+
+  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
+  if (bloom->bf == NULL) {                                   // LCOV_EXCL_START
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  bloom->ready = 1;
+
+  budget->error = best.error;
+  budget->ns_hit = best.ns_hit;
+  budget->ns_miss = best.ns_miss;
+
+  return 0;
+}
+
+
+int bloom_check(struct bloom * bloom, const void * buffer, int len)
+{
+  return bloom_check_add(bloom, buffer, len, 0);
+}
+
+
+int bloom_add(struct bloom * bloom, const void * buffer, int len)
+{
+  return bloom_check_add(bloom, buffer, len, 1);
+}
+
+
+int bloom_check_iov(struct bloom * bloom, const struct iovec * iov, int iovcnt)
+{
+  return bloom_check_add_iov(bloom, iov, iovcnt, 0);
+}
+
+
+int bloom_add_iov(struct bloom * bloom, const struct iovec * iov, int iovcnt)
+{
+  return bloom_check_add_iov(bloom, iov, iovcnt, 1);
+}
+
+
+/*
+ * The bit positions of a batch are sorted by range into one array: every
+ * thread counts its positions in each range, the counts are turned into
+ * the offset where each thread writes the positions of each range, and
+ * the threads write them there after hashing their elements again (from
+ * the kept hash material).
+ *
+ */
+struct build_state
+{
+  struct bloom * bloom;
+  const struct iovec * elements;
+  unsigned long int count;
+  int threads;
+  int shift;
+  unsigned long int ranges;
+  struct bloom_hash * hashes;           // [element of the batch]
+  unsigned long int * offsets;          // [thread * ranges + range]
+  unsigned long int * starts;           // [range], and the end of the last
+  uint32_t * pos;                       // bit offsets within their range
+};
+
+struct build_thread
+{
+  pthread_t thread;
+  struct build_state * state;
+  int id;
+};
+
+
+static void build_slice(const struct build_thread * t, unsigned long int * from,
+                        unsigned long int * to)
+{
+  *from = t->state->count * t->id / t->state->threads;
+  *to = t->state->count * (t->id + 1) / t->state->threads;
+}
+
+
+static void * build_count(void * arg)
+{
+  struct build_thread * t = (struct build_thread *)arg;
+  struct build_state * state = t->state;
+  struct bloom * bloom = state->bloom;
+  unsigned long int * counts = state->offsets + t->id * state->ranges;
+  unsigned long int from, to, n, i;
+
+  build_slice(t, &from, &to);
+  memset(counts, 0, state->ranges * sizeof(unsigned long int));
+
+  for (n = from; n < to; n++) {
+    const struct iovec * e = &state->elements[n];
+    struct bloom_hash * hash = &state->hashes[n];
+    if (e->iov_len <= INT_MAX) {
+      bloom_hash_buffer(bloom, e->iov_base, (int)e->iov_len, hash);
+    } else {
+      bloom_hash_iov(bloom, e, 1, hash);
+    }
+
+    for (i = 0; i < bloom->hashes; i++) {
+      counts[bloom_nth_bit(bloom, hash, i) >> state->shift]++;
+    }
+  }
+
+  return NULL;
+}
+
+
+static void * build_scatter(void * arg)
+{
+  struct build_thread * t = (struct build_thread *)arg;
+  struct build_state * state = t->state;
+  struct bloom * bloom = state->bloom;
+  unsigned long int * offsets = state->offsets + t->id * state->ranges;
+  unsigned long int mask = (1ul << state->shift) - 1;
+  unsigned long int from, to, n, i;
+
+  build_slice(t, &from, &to);
+
+  for (n = from; n < to; n++) {
+    for (i = 0; i < bloom->hashes; i++) {
+      unsigned long int x = bloom_nth_bit(bloom, &state->hashes[n], i);
+      state->pos[offsets[x >> state->shift]++] = (uint32_t)(x & mask);
+    }
+  }
+
+  return NULL;
+}
+
+
+static void * build_gather(void * arg)
+{
+  struct build_thread * t = (struct build_thread *)arg;
+  struct build_state * state = t->state;
+  unsigned long int r, x;
+
+  // Ranges are byte aligned, so no two threads ever touch the same byte.
+  for (r = t->id; r < state->ranges; r += state->threads) {
+    unsigned char * bf = state->bloom->bf + ((r << state->shift) >> 3);
+    for (x = state->starts[r]; x < state->starts[r + 1]; x++) {
+      uint32_t bit = state->pos[x];
+      bf[bit >> 3] |= 1 << (bit % 8);
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Turn the counts of each thread in each range into the offsets where it
+ * writes its positions in that range, ranges in order.
+ *
+ */
+static void build_offsets(struct build_state * state)
+{
+  unsigned long int at = 0;
+  unsigned long int r;
+  int t;
+
+  for (r = 0; r < state->ranges; r++) {
+    state->starts[r] = at;
+    for (t = 0; t < state->threads; t++) {
+      unsigned long int * o = &state->offsets[t * state->ranges + r];
+      unsigned long int count = *o;
+      *o = at;
+      at += count;
+    }
+  }
+  state->starts[state->ranges] = at;
+}
+
+
+static int build_run(struct build_state * state, struct build_thread * threads,
+                     void * (*fn)(void *))
+{
+  int n, created;
+
+  for (created = 0; created < state->threads; created++) {
+    if (pthread_create(&threads[created].thread, NULL, fn, &threads[created])) {
+      break;                                                 // LCOV_EXCL_LINE
+    }
+  }
+
+  for (n = 0; n < created; n++) {
+    pthread_join(threads[n].thread, NULL);
+  }
+
+  return created == state->threads ? 0 : 1;
+}
+
+
+int bloom_build_parallel(struct bloom * bloom, const struct iovec * elements,
+                         unsigned long int count, int threads)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
     return -1;
   }
 
-  if (bloom_dest->entries != bloom_src->entries) {
+  if (threads <= 0) {
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) { threads = 1; }                       // LCOV_EXCL_LINE
+  }
+
+  struct build_state state;
+  memset(&state, 0, sizeof(state));
+  state.bloom = bloom;
+  state.threads = threads;
+
+  // Use cache sized ranges but at least a few per thread, so the work of
+  // setting the bits is spread over all threads even for small filters.
+  state.shift = BUILD_RANGE_SHIFT;
+  while (state.shift > 3 &&
+         (bloom->bits >> state.shift) < 4 * (unsigned long int)threads) {
+    state.shift--;
+  }
+  state.ranges = ((bloom->bits - 1) >> state.shift) + 1;
+
+  unsigned long int batch = BUILD_BATCH_BITS / bloom->hashes;
+  if (batch > count) {
+    batch = count;
+  }
+
+  state.hashes = (struct bloom_hash *)
+    malloc((batch ? batch : 1) * sizeof(struct bloom_hash));
+  state.pos = (uint32_t *)
+    malloc((batch ? batch : 1) * bloom->hashes * sizeof(uint32_t));
+  state.offsets = (unsigned long int *)
+    malloc(threads * state.ranges * sizeof(unsigned long int));
+  state.starts = (unsigned long int *)
+    malloc((state.ranges + 1) * sizeof(unsigned long int));
+  struct build_thread * tds = (struct build_thread *)
+    calloc(threads, sizeof(struct build_thread));
+
+  int rv = 0;
+
+  if (state.hashes == NULL || state.pos == NULL || state.offsets == NULL ||
+      state.starts == NULL || tds == NULL) {                 // LCOV_EXCL_START
+    rv = 1;
+    goto done;
+  }                                                          // LCOV_EXCL_STOP
+
+  int n;
+  for (n = 0; n < threads; n++) {
+    tds[n].state = &state;
+    tds[n].id = n;
+  }
+
+  unsigned long int first;
+  for (first = 0; first < count && rv == 0; first += state.count) {
+    state.elements = elements + first;
+    state.count = count - first < batch ? count - first : batch;
+    rv = build_run(&state, tds, build_count);
+    if (rv == 0) {
+      build_offsets(&state);
+      rv = build_run(&state, tds, build_scatter);
+    }
+    if (rv == 0) {
+      rv = build_run(&state, tds, build_gather);
+    }
+  }
+
+ done:
+  free(state.hashes);
+  free(state.pos);
+  free(state.offsets);
+  free(state.starts);
+  free(tds);
+
+  return rv;
+}
+
+
+void bloom_print(struct bloom * bloom)
+{
+  printf("bloom at %p\n", (void *)bloom);
+  if (!bloom->ready) { printf(" *** NOT READY ***\n"); }
+  printf(" ->version = %d.%d\n", bloom->major, bloom->minor);
+  printf(" ->entries = %lu\n", bloom->entries);
+  printf(" ->error = %f\n", bloom->error);
+  printf(" ->bits = %lu\n", bloom->bits);
+  printf(" ->bits per elem = %f\n", bloom->bpe);
+  printf(" ->bytes = %lu", bloom->bytes);
+  unsigned int KB = bloom->bytes / 1024;
+  unsigned int MB = KB / 1024;
+  printf(" (%u KB, %u MB)\n", KB, MB);
+  printf(" ->hash functions = %d\n", bloom->hashes);
+  printf(" ->flags = 0x%02x\n", bloom->flags);
+}
+
+
+void bloom_free(struct bloom * bloom)
+{
+  if (bloom->ready) {
+    free(bloom->bf);
+  }
+  bloom->ready = 0;
+}
+
+
+int bloom_reset(struct bloom * bloom)
+{
+  if (!bloom->ready) return 1;
+
+#ifdef __linux__
+  // Private anonymous pages dropped with MADV_DONTNEED read back as zeros
+  // when next touched, so a large filter can be cleared without writing
+  // (or faulting in) all of it. Only whole pages can be dropped, the
+  // partial pages at either end are cleared normally.
+  if (bloom->bytes >= RESET_MADVISE_MIN) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t bf = (uintptr_t)bloom->bf;
+    uintptr_t start = (bf + page - 1) & ~(page - 1);
+    uintptr_t end = (bf + bloom->bytes) & ~(page - 1);
+    if (madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+      memset(bloom->bf, 0, start - bf);
+      memset((void *)end, 0, bf + bloom->bytes - end);
+      return 0;
+    }
+  }
+#endif
+
+  memset(bloom->bf, 0, bloom->bytes);
+  return 0;
+}
+
+
+int bloom_read_full(int fd, void * buf, size_t len)
+{
+  unsigned char * p = (unsigned char *)buf;
+
+  while (len > 0) {
+    ssize_t in = read(fd, p, len);
+    if (in <= 0) { return 1; }
+    p += in;
+    len -= in;
+  }
+
+  return 0;
+}
+
+
+int bloom_write_full(int fd, const void * buf, size_t len)
+{
+  const unsigned char * p = (const unsigned char *)buf;
+
+  while (len > 0) {
+    ssize_t out = write(fd, p, len);
+    if (out <= 0) { return 1; }                              // LCOV_EXCL_LINE
+    p += out;
+    len -= out;
+  }
+
+  return 0;
+}
+
+
+size_t bloom_bf_offset(const struct bloom * bloom)
+{
+  if (bloom->flags & BLOOM_PAGED) {
+    return BLOOM_PAGE_BYTES;
+  }
+
+  return strlen(BLOOM_MAGIC) + sizeof(uint16_t) + sizeof(struct bloom);
+}
+
+
+int bloom_write_header(int fd, const struct bloom * bloom)
+{
+  static const unsigned char zero[BLOOM_PAGE_BYTES];
+  uint16_t size = sizeof(struct bloom);
+  size_t header = strlen(BLOOM_MAGIC) + sizeof(uint16_t) + sizeof(struct bloom);
+  struct bloom saved;
+
+  // Version 2.0 readers check only the major version, so filters with
+  // flags (hashed or laid out differently) or more entries than 2.0's
+  // 32-bit field holds must not look like 2.0 files. Those which do keep
+  // 'entries' where 2.0 had it, in the first 4 bytes (followed by what was
+  // padding in 2.0), on hosts of either byte order.
+  memcpy(&saved, bloom, sizeof(struct bloom));
+  if (saved.flags || saved.entries > UINT32_MAX) {
+    saved.major = BLOOM_FLAGS_MAJOR;
+  } else {
+    uint32_t entries = (uint32_t)saved.entries;
+    memset(&saved.entries, 0, sizeof(saved.entries));
+    memcpy(&saved.entries, &entries, sizeof(uint32_t));
+  }
+
+  if (bloom_write_full(fd, BLOOM_MAGIC, strlen(BLOOM_MAGIC)) ||
+      bloom_write_full(fd, &size, sizeof(uint16_t)) ||
+      bloom_write_full(fd, &saved, sizeof(struct bloom)) ||
+      bloom_write_full(fd, zero, bloom_bf_offset(bloom) - header)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  return 0;
+}
+
+
+int bloom_read_header(int fd, struct bloom * bloom)
+{
+  char line[30];
+  memset(line, 0, 30);
+  ssize_t in = read(fd, line, strlen(BLOOM_MAGIC));
+
+  if (in != strlen(BLOOM_MAGIC)) {
+    return 4;
+  }
+
+  if (strncmp(line, BLOOM_MAGIC, strlen(BLOOM_MAGIC))) {
+    return 5;
+  }
+
+  uint16_t size;
+  in = read(fd, &size, sizeof(uint16_t));
+  if (in != sizeof(uint16_t)) {
+    return 6;
+  }
+
+  if (size != sizeof(struct bloom)) {
+    return 7;
+  }
+
+  in = read(fd, bloom, sizeof(struct bloom));
+  if (in != sizeof(struct bloom)) {
+    return 8;
+  }
+
+  bloom->bf = NULL;
+  if (bloom->major == BLOOM_VERSION_MAJOR && bloom->flags == 0) {
+    uint32_t entries;
+    memcpy(&entries, &bloom->entries, sizeof(uint32_t));
+    bloom->entries = entries;
+  } else if (bloom->major != BLOOM_FLAGS_MAJOR ||
+             (bloom->flags == 0 && bloom->entries <= UINT32_MAX)) {
+    return 9;
+  }
+  bloom->major = BLOOM_VERSION_MAJOR;
+
+  if (bloom->flags & ~BLOOM_FLAGS_KNOWN) {
+    return 12;
+  }
+
+  if (lseek(fd, bloom_bf_offset(bloom), SEEK_SET) < 0) {
+    return 8;                                                // LCOV_EXCL_LINE
+  }
+
+  return 0;
+}
+
+
+int bloom_write_blob_header(int fd, const char * magic, const void * blob,
+                            uint16_t size)
+{
+  if (bloom_write_full(fd, magic, strlen(magic)) ||
+      bloom_write_full(fd, &size, sizeof(uint16_t)) ||
+      bloom_write_full(fd, blob, size)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  return 0;
+}
+
+
+int bloom_read_blob_header(int fd, const char * magic, void * blob,
+                           uint16_t size)
+{
+  char line[30];
+  uint16_t saved;
+
+  memset(line, 0, 30);
+  if (bloom_read_full(fd, line, strlen(magic))) {
+    return 4;
+  }
+
+  if (strcmp(line, magic)) {
+    return 5;
+  }
+
+  if (bloom_read_full(fd, &saved, sizeof(uint16_t))) {
+    return 6;
+  }
+
+  if (saved != size) {
+    return 7;
+  }
+
+  if (bloom_read_full(fd, blob, size)) {
+    return 8;
+  }
+
+  return 0;
+}
+
+
+int bloom_struct_ready(const void * p, unsigned char ready, const char * name)
+{
+  if (ready == 0) {
+    printf("%s at %p not initialized!\n", name, p);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+int bloom_save(struct bloom * bloom, char * filename)
+{
+  if (filename == NULL || filename[0] == 0) {
+    return 1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) {
+    return 1;
+  }
+
+  if (bloom_write_header(fd, bloom) ||
+      bloom_write_full(fd, bloom->bf, bloom->bytes)) {
+    close(fd);                                               // LCOV_EXCL_LINE
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  close(fd);
+  return 0;
+}
+
+
+/*
+ * Body of the child process of bloom_save_background(). Never returns.
+ *
+ */
+static void save_child(const struct bloom * bloom, int fd, const char * tmp,
+                       const char * filename, const char * dir)
+{
+  size_t first = SAVE_CHUNK - bloom_bf_offset(bloom) % SAVE_CHUNK;
+  unsigned long int off = 0;
+  int rv = bloom_write_header(fd, bloom);
+
+  while (rv == 0 && off < bloom->bytes) {
+    size_t len = bloom->bytes - off;
+    size_t max = off ? SAVE_CHUNK : first;
+    if (len > max) {
+      len = max;
+    }
+    rv = bloom_write_full(fd, bloom->bf + off, len);
+    off += len;
+  }
+
+  if (rv || fsync(fd) || close(fd) || rename(tmp, filename)) {
+    _exit(1);                                                // LCOV_EXCL_LINE
+  }
+
+  // Make the rename itself durable.
+  int dfd = open(dir, O_RDONLY);
+  if (dfd >= 0) {
+    fsync(dfd);
+    close(dfd);
+  }
+
+  _exit(0);
+}
+
+
+int bloom_save_background(struct bloom * bloom, char * filename,
+                          struct bloom_snapshot * snapshot)
+{
+  memset(snapshot, 0, sizeof(struct bloom_snapshot));
+
+  if (filename == NULL || filename[0] == 0 || !bloom->ready) {
+    return 1;
+  }
+
+  // Everything the child needs is prepared here, the child only writes.
+  size_t len = strlen(filename);
+  char * tmp = (char *)malloc(len + 8);
+  char * dir = (char *)malloc(len + 2);
+  if (tmp == NULL || dir == NULL) {                          // LCOV_EXCL_START
+    free(tmp);
+    free(dir);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  char * slash = strrchr(filename, '/');
+  if (slash == NULL) {
+    strcpy(dir, ".");
+  } else if (slash == filename) {
+    strcpy(dir, "/");
+  } else {
+    memcpy(dir, filename, slash - filename);
+    dir[slash - filename] = 0;
+  }
+
+  sprintf(tmp, "%s.XXXXXX", filename);
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    free(tmp);
+    free(dir);
+    return 1;
+  }
+  fchmod(fd, 0644);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    save_child(bloom, fd, tmp, filename, dir);               // LCOV_EXCL_LINE
+  }
+
+  close(fd);
+  free(dir);
+
+  if (pid < 0) {                                             // LCOV_EXCL_START
+    unlink(tmp);
+    free(tmp);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  snapshot->pid = pid;
+  snapshot->tmp = tmp;
+
+  return 0;
+}
+
+
+int bloom_save_wait(struct bloom_snapshot * snapshot, int block)
+{
+  int status = 0;
+  pid_t pid;
+
+  if (snapshot->pid <= 0) {
+    return 1;
+  }
+
+  do {
+    pid = waitpid(snapshot->pid, &status, block ? 0 : WNOHANG);
+  } while (pid < 0 && errno == EINTR);
+
+  if (pid == 0) {
+    return 2;
+  }
+
+  int rv = pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  if (rv) {
+    unlink(snapshot->tmp);
+  }
+
+  free(snapshot->tmp);
+  snapshot->tmp = NULL;
+  snapshot->pid = 0;
+
+  return rv;
+}
+
+
+int bloom_load(struct bloom * bloom, char * filename)
+{
+  int rv = 0;
+
+  if (filename == NULL || filename[0] == 0) { return 1; }
+  if (bloom == NULL) { return 2; }
+
+  memset(bloom, 0, sizeof(struct bloom));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) { return 3; }
+
+  rv = bloom_read_header(fd, bloom);
+  if (rv) {
+    goto load_error;
+  }
+
+  bloom->bf = (unsigned char *)malloc(bloom->bytes);
+  if (bloom->bf == NULL) { rv = 10; goto load_error; }       // LCOV_EXCL_LINE
+
+  if (bloom_read_full(fd, bloom->bf, bloom->bytes)) {
+    rv = 11;
+    free(bloom->bf);
+    bloom->bf = NULL;
+    goto load_error;
+  }
+
+  close(fd);
+  return rv;
+
+ load_error:
+  close(fd);
+  bloom->ready = 0;
+  return rv;
+}
+
+
+int bloom_merge_files(char * output, char ** files, int count)
+{
+  struct bloom first;
+  struct bloom bloom;
+  struct stat st;
+  unsigned char * out = NULL;
+  unsigned char * in = NULL;
+  char * tmp = NULL;
+  int ofd = -1;
+  int rv = 0;
+  int n;
+
+  if (output == NULL || output[0] == 0 || files == NULL || count < 1) {
+    return 1;
+  }
+
+  int * fds = (int *)malloc(count * sizeof(int));
+  if (fds == NULL) {                                         // LCOV_EXCL_START
+    return 4;
+  }                                                          // LCOV_EXCL_STOP
+  for (n = 0; n < count; n++) {
+    fds[n] = -1;
+  }
+
+  // Validate all the inputs before writing anything.
+  for (n = 0; n < count; n++) {
+    struct bloom * b = n ? &bloom : &first;
+    fds[n] = open(files[n], O_RDONLY);
+    if (fds[n] < 0 || bloom_read_header(fds[n], b) || fstat(fds[n], &st) ||
+        st.st_size < bloom_bf_offset(b) + b->bytes) {
+      rv = 2;
+      goto merge_done;
+    }
+    if (n > 0 && bloom_compatible(&first, &bloom)) {
+      rv = 3;
+      goto merge_done;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fds[n], 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+
+  size_t chunk = first.bytes < MERGE_CHUNK ? first.bytes : MERGE_CHUNK;
+  out = (unsigned char *)malloc(chunk);
+  in = (unsigned char *)malloc(chunk);
+  tmp = (char *)malloc(strlen(output) + 8);
+  if (out == NULL || in == NULL || tmp == NULL) {            // LCOV_EXCL_START
+    rv = 4;
+    goto merge_done;
+  }                                                          // LCOV_EXCL_STOP
+
+  // Written next to 'output' and renamed over it when complete, so
+  // 'output' may also be one of the inputs.
+  sprintf(tmp, "%s.XXXXXX", output);
+  ofd = mkstemp(tmp);
+  if (ofd < 0) {
+    free(tmp);
+    tmp = NULL;
+    rv = 4;
+    goto merge_done;
+  }
+  fchmod(ofd, 0644);
+
+  if (bloom_write_header(ofd, &first)) {
+    rv = 4;                                                  // LCOV_EXCL_LINE
+    goto merge_done;                                         // LCOV_EXCL_LINE
+  }
+
+  unsigned long int off;
+  for (off = 0; off < first.bytes; off += chunk) {
+    size_t len = first.bytes - off < chunk ? first.bytes - off : chunk;
+    size_t p;
+
+    if (bloom_read_full(fds[0], out, len)) {
+      rv = 4;
+      goto merge_done;
+    }
+
+    for (n = 1; n < count; n++) {
+      if (bloom_read_full(fds[n], in, len)) {
+        rv = 4;
+        goto merge_done;
+      }
+      for (p = 0; p < len; p++) {
+        out[p] |= in[p];
+      }
+    }
+
+    if (bloom_write_full(ofd, out, len)) {
+      rv = 4;                                                // LCOV_EXCL_LINE
+      goto merge_done;                                       // LCOV_EXCL_LINE
+    }
+  }
+
+  if (close(ofd) || rename(tmp, output)) {
+    rv = 4;                                                  // LCOV_EXCL_LINE
+  }
+  ofd = -1;
+
+ merge_done:
+  if (ofd >= 0) {
+    close(ofd);
+  }
+  if (tmp != NULL) {
+    if (rv) { unlink(tmp); }
+    free(tmp);
+  }
+  for (n = 0; n < count; n++) {
+    if (fds[n] >= 0) { close(fds[n]); }
+  }
+  free(fds);
+  free(out);
+  free(in);
+  return rv;
+}
+
+
+int bloom_compatible(const struct bloom * a, const struct bloom * b)
+{
+  if (a->entries != b->entries) {
+    return 1;
+  }
+
+  if (a->error != b->error) {
     return 1;
   }
 
-  if (bloom_dest->error != bloom_src->error) {
+  if (a->major != b->major) {
     return 1;
   }
 
-  if (bloom_dest->major != bloom_src->major) {
+  if (a->minor != b->minor) {
     return 1;
   }
 
-  if (bloom_dest->minor != bloom_src->minor) {
+  if (a->flags != b->flags) {
+    return 1;
+  }
+
+  // Filters from bloom_init_budget() are not fully determined by the above.
+  if (a->hashes != b->hashes || a->bits != b->bits) {
     return 1;
   }
 
   // Not really possible if properly used but check anyway to avoid the
   // possibility of buffer overruns.
-  if (bloom_dest->bytes != bloom_src->bytes) {
+  if (a->bytes != b->bytes) {
     return 1;                                                // LCOV_EXCL_LINE
   }
 
+  return 0;
+}
+
+
+int bloom_merge(struct bloom * bloom_dest, struct bloom * bloom_src)
+{
+  if (bloom_dest->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom_dest);
+    return -1;
+  }
+
+  if (bloom_src->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom_src);
+    return -1;
+  }
+
+  if (bloom_compatible(bloom_dest, bloom_src)) {
+    return 1;
+  }
+
   unsigned long int p;
   for (p = 0; p < bloom_dest->bytes; p++) {
     bloom_dest->bf[p] |= bloom_src->bf[p];
@@ -325,6 +1655,45 @@ int bloom_merge(struct bloom * bloom_dest, struct bloom * bloom_src)
 }
 
 
+int bloom_fold(struct bloom * bloom, unsigned int times)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  if (!(bloom->flags & BLOOM_POW2) || times < 1 || times > 60 ||
+      (bloom->bits >> times) < 8) {
+    return 1;
+  }
+
+  unsigned long int bytes = bloom->bytes >> times;
+  unsigned long int from;
+  unsigned long int p;
+
+  for (from = bytes; from < bloom->bytes; from += bytes) {
+    for (p = 0; p < bytes; p++) {
+      bloom->bf[p] |= bloom->bf[from + p];
+    }
+  }
+
+  // If shrinking fails the larger buffer is simply kept.
+  unsigned char * bf = (unsigned char *)realloc(bloom->bf, bytes);
+  if (bf != NULL) {
+    bloom->bf = bf;
+  }
+
+  bloom->bits >>= times;
+  bloom->bytes = bytes;
+  bloom->bpe = (double)bloom->bits / bloom->entries;
+
+  double k = (double)bloom->hashes;
+  bloom->error = pow(1.0 - exp(-k * bloom->entries / bloom->bits), k);
+
+  return 0;
+}
+
+
 const char * bloom_version()
 {
   return MAKESTRING(BLOOM_VERSION);
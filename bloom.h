@@ -8,14 +8,18 @@
 #ifndef _BLOOM_H
 #define _BLOOM_H
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
-#define NULL_BLOOM_FILTER { 0, 0, 0, 0, 0.0, 0, 0, 0, 0.0, NULL }
+#define NULL_BLOOM_FILTER { 0, 0, 0, 0, 0.0, 0, 0, 0, 0, 0.0, NULL }
 
-#define ENTRIES_T unsigned int
+#define ENTRIES_T unsigned long int
 #define BYTES_T unsigned long int
 #define BITS_T unsigned long int
 
@@ -31,7 +35,7 @@ struct bloom
   // These fields are part of the public interface of this structure.
   // Client code may read these values if desired. Client code MUST NOT
   // modify any of these.
-  unsigned int entries;
+  unsigned long int entries;
   unsigned long int bits;
   unsigned long int bytes;
   unsigned char hashes;
@@ -43,6 +47,7 @@ struct bloom
   unsigned char ready;
   unsigned char major;
   unsigned char minor;
+  unsigned char flags;
   double bpe;
   unsigned char * bf;
 };
@@ -69,6 +74,8 @@ struct bloom
  *     error   - Probability of collision (as long as entries are not
  *               exceeded).
  *
+ * For very large filters, see bloom_init3() and BLOOM_HASH64 below.
+ *
  * Return:
  * -------
  *     0 - on success
@@ -78,6 +85,182 @@ struct bloom
 int bloom_init2(struct bloom * bloom, unsigned int entries, double error);
 
 
+/** ***************************************************************************
+ * Flags for bloom_init3().
+ *
+ * BLOOM_HASH64 - Derive the bit positions from 64-bit hash material
+ *                (MurmurHash64A) instead of two 32-bit murmurhash2 values.
+ *                The default positions can only spread evenly over filters
+ *                of up to about 2^32 bits, so filters larger than that
+ *                (a few hundred million entries at typical error rates)
+ *                need this flag to achieve their configured error rate.
+ *
+ * Filters created with different flags are not compatible with each other
+ * (see bloom_merge()). The flags are recorded by bloom_save(), in files
+ * which versions before 2.1 refuse to load.
+ *
+ */
+#define BLOOM_HASH64 0x01
+
+
+/** ***************************************************************************
+ * BLOOM_POW2   - Round the number of bits up to a power of two and map
+ *                hashes to bits by masking instead of modulo. The filter
+ *                uses somewhat more memory than requested (and has a lower
+ *                error rate accordingly) but can later be shrunk with
+ *                bloom_fold().
+ *
+ */
+#define BLOOM_POW2 0x02
+
+
+/** ***************************************************************************
+ * BLOOM_ENHANCED - Derive bit positions with enhanced double hashing,
+ *                hash i being a + b * i + (i^3 - i) / 6, instead of plain
+ *                double hashing (a + b * i). Plain double hashing makes
+ *                the positions of different elements coincide more often
+ *                than independent hashes would, which shows as a higher
+ *                error rate with many hashes (low error rates). Implies
+ *                BLOOM_HASH64.
+ *
+ */
+#define BLOOM_ENHANCED 0x04
+
+
+/** ***************************************************************************
+ * BLOOM_PAGED  - Divide the filter into 4KB pages and place all the bits
+ *                of an element within a single page, so adding or checking
+ *                an element touches exactly one page of memory (or of the
+ *                saved file, see bloom_disk.h). The filter is rounded up to
+ *                whole pages. Its error rate is somewhat higher than that
+ *                of a filter without this flag, as the elements are not
+ *                spread over the pages perfectly evenly. Cannot be combined
+ *                with BLOOM_POW2 or BLOOM_ENHANCED.
+ *
+ */
+#define BLOOM_PAGED 0x08
+
+
+/** ***************************************************************************
+ * Initialize the bloom filter for use, with options.
+ *
+ * Same as bloom_init2() but 'entries' may exceed 2^32 and 'flags' selects
+ * optional behavior (see the BLOOM_* flags above). With flags set to 0,
+ * the filter is identical to one created by bloom_init2().
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - Pointer to an allocated struct bloom (see above).
+ *     entries - The expected number of entries which will be inserted.
+ *               Must be at least 1000 (in practice, likely much larger).
+ *     error   - Probability of collision (as long as entries are not
+ *               exceeded).
+ *     flags   - Zero or more BLOOM_* flags OR'd together.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_init3(struct bloom * bloom, unsigned long int entries, double error,
+                unsigned int flags);
+
+
+/** ***************************************************************************
+ * Goals for bloom_init_budget().
+ *
+ * BLOOM_MIN_ERROR - Use as much of 'max_bytes' as the layout allows and
+ *                   pick the number of hashes and layout giving the lowest
+ *                   error rate. This is usually BLOOM_ENHANCED (with
+ *                   BLOOM_POW2 when 'max_bytes' is a power of two), which
+ *                   avoids the overlaps of plain double hashing.
+ * BLOOM_MIN_COST  - Pick the size, number of hashes and layout with the
+ *                   lowest expected cost of checking an absent element
+ *                   which still meet 'max_error'. Fewer hashes need more
+ *                   memory, and a larger filter makes each probe more
+ *                   expensive once it no longer fits in cache. BLOOM_POW2
+ *                   trades memory for no modulo per probe, BLOOM_PAGED a
+ *                   higher error per bit for probes within one page.
+ *
+ */
+#define BLOOM_MIN_ERROR 1
+#define BLOOM_MIN_COST  2
+
+
+/** ***************************************************************************
+ * Parameters and results of bloom_init_budget().
+ *
+ * The costs are for a 16 byte element, from a model of this host which
+ * bloom_calibrate() can measure. They are estimates for comparing choices
+ * and do not include the overhead of the caller.
+ *
+ */
+struct bloom_budget
+{
+  // Set by the caller. Zero means no limit.
+  unsigned long int entries;        // expected number of entries (required)
+  unsigned long int max_bytes;      // largest acceptable bit field size
+  unsigned int max_hashes;          // most hashes (memory probes) per element
+  double max_error;                 // highest acceptable error rate
+  int goal;                         // BLOOM_MIN_ERROR or BLOOM_MIN_COST
+
+  // Set by bloom_init_budget() on success.
+  double error;                     // expected error rate at 'entries'
+  double ns_hit;                    // expected ns per check of an element
+                                    // which is in the filter
+  double ns_miss;                   // expected ns per check of an element
+                                    // which is not
+};
+
+
+/** ***************************************************************************
+ * Initialize the bloom filter for use, choosing its size, number of hashes
+ * and flags from the limits in 'budget' instead of from a target error.
+ *
+ * Unlike bloom_init2(), the number of hashes is the one which actually
+ * minimizes the error for the chosen size (the exact error formula is used
+ * rather than rounding up the ideal value) and 'entries' may be below 1000.
+ *
+ * The layouts considered are the flags BLOOM_HASH64, BLOOM_ENHANCED,
+ * BLOOM_POW2 and BLOOM_PAGED in their valid combinations, so the filter may
+ * not be loadable by versions before 2.1 (see the flags above).
+ *
+ * BLOOM_MIN_ERROR requires 'max_bytes', BLOOM_MIN_COST requires 'max_error'.
+ * The resulting filter is used like any other. Its 'error' field is the
+ * expected error rate reported in 'budget'.
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - Pointer to an allocated struct bloom (see above).
+ *     budget  - Limits and goal, also receives the expected error and costs.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (invalid parameters or no filter fits the limits)
+ *
+ */
+int bloom_init_budget(struct bloom * bloom, struct bloom_budget * budget);
+
+
+/** ***************************************************************************
+ * Measure the cost of hashing, of a modulo and of memory probes into filters
+ * of various sizes on this host, for use by subsequent bloom_init_budget()
+ * calls. Until called, a built-in model of a typical server is used.
+ *
+ * Takes a fraction of a second and briefly allocates 64MB. Not thread safe
+ * with respect to concurrent bloom_init_budget() calls.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (out of memory)
+ *
+ */
+int bloom_calibrate();
+
+
 /**
  * DEPRECATED.
  * Kept for compatibility with libbloom v.1. To be removed in v3.0.
@@ -127,6 +310,230 @@ int bloom_check(struct bloom * bloom, const void * buffer, int len);
 int bloom_add(struct bloom * bloom, const void * buffer, int len);
 
 
+/** ***************************************************************************
+ * Check if the element made up of the given buffers is in the bloom filter.
+ *
+ * The element is the concatenation of the 'iovcnt' buffers in 'iov', so
+ * keys assembled from several parts don't need to be copied into one
+ * buffer first. Checks exactly the same bits as bloom_check() would for
+ * the concatenated buffer, so elements may be added with one call and
+ * checked with the other.
+ *
+ * Since iov_len is a size_t, this can also be used for elements larger
+ * than the 'int len' of bloom_check() permits.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     iov    - Array of buffers making up the element.
+ *     iovcnt - Number of entries in 'iov'.
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_check_iov(struct bloom * bloom, const struct iovec * iov, int iovcnt);
+
+
+/** ***************************************************************************
+ * Add the element made up of the given buffers to the bloom filter.
+ *
+ * See bloom_check_iov() above. Sets exactly the same bits as bloom_add()
+ * would for the concatenated buffer.
+ *
+ * Parameters:
+ * -----------
+ *     bloom  - Pointer to an allocated struct bloom (see above).
+ *     iov    - Array of buffers making up the element.
+ *     iovcnt - Number of entries in 'iov'.
+ *
+ * Return:
+ * -------
+ *     0 - element was not present and was added
+ *     1 - element (or a collision) had already been added previously
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_add_iov(struct bloom * bloom, const struct iovec * iov, int iovcnt);
+
+
+/** ***************************************************************************
+ * Check if the given 64 bit integer is in the bloom filter.
+ *
+ * Same as bloom_check(bloom, &key, sizeof(uint64_t)) (so integers may be
+ * added with either function and checked with the other) but faster, as
+ * the hashing is specialized for 8 byte elements.
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_check_u64(struct bloom * bloom, uint64_t key);
+
+
+/** ***************************************************************************
+ * Add the given 64 bit integer to the bloom filter.
+ *
+ * Same as bloom_add(bloom, &key, sizeof(uint64_t)), see bloom_check_u64().
+ *
+ * Return:
+ * -------
+ *     0 - element was not present and was added
+ *     1 - element (or a collision) had already been added previously
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_add_u64(struct bloom * bloom, uint64_t key);
+
+
+/** ***************************************************************************
+ * Check an array of 64 bit integers, as bloom_check_u64() on each.
+ *
+ * Processing the integers in groups is considerably faster than one call
+ * per integer: the hashes of several integers are computed at once (with
+ * AVX2 where available) and their bit lookups overlap in memory.
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - Pointer to an allocated struct bloom (see above).
+ *     keys    - The integers to check.
+ *     count   - Number of integers in 'keys'.
+ *     results - Array of 'count' bytes. results[n] is set to what
+ *               bloom_check_u64() returns for keys[n] (0 or 1).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_check_u64_array(struct bloom * bloom, const uint64_t * keys,
+                          unsigned long int count, unsigned char * results);
+
+
+/** ***************************************************************************
+ * Add an array of 64 bit integers, as bloom_add_u64() on each in order.
+ * See bloom_check_u64_array(). 'results' may be NULL if the return values
+ * of the individual adds are not needed.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_add_u64_array(struct bloom * bloom, const uint64_t * keys,
+                        unsigned long int count, unsigned char * results);
+
+
+/** ***************************************************************************
+ * Flag for bloom_check_kmers() and bloom_add_kmers().
+ *
+ * BLOOM_KMER_CANONICAL - Treat a DNA sequence window and its reverse
+ *                complement (reversed, with A and T, C and G swapped) as
+ *                the same k-mer, so a read matches the filter whichever
+ *                strand it came from. Bytes other than ACGT (upper or
+ *                lower case) are their own complement.
+ *
+ */
+#define BLOOM_KMER_CANONICAL 0x01
+
+
+/** ***************************************************************************
+ * Check every k-mer (every window of 'k' consecutive bytes) of 'buffer'
+ * against the bloom filter.
+ *
+ * The hash of each window is rolled over from that of the previous window
+ * in constant time instead of hashing all 'k' bytes of every window, and
+ * the bit lookups of several windows overlap in memory.
+ *
+ * The k-mer hash is not that of bloom_add() for the same bytes: k-mers are
+ * added with bloom_add_kmers() and checked with this function (with the
+ * same 'flags'), a single k-mer being a 'buffer' of length 'k'.
+ *
+ * Parameters:
+ * -----------
+ *     bloom   - Pointer to an allocated struct bloom (see above).
+ *     buffer  - The sequence.
+ *     len     - Length of the sequence, in bytes.
+ *     k       - Length of the k-mers, at least 1.
+ *     flags   - Zero or BLOOM_KMER_CANONICAL.
+ *     results - Array of 'len' - 'k' + 1 bytes, or NULL. results[n] is
+ *               set to the result (0 or 1) for the window starting at
+ *               byte n.
+ *
+ * Return:
+ * -------
+ *     >= 0 - the number of k-mers which are present (or collisions)
+ *       -1 - bloom not initialized or 'k' is 0
+ *
+ */
+long int bloom_check_kmers(struct bloom * bloom, const void * buffer,
+                           unsigned long int len, unsigned int k,
+                           unsigned int flags, unsigned char * results);
+
+
+/** ***************************************************************************
+ * Add every k-mer of 'buffer' to the bloom filter, in order. See
+ * bloom_check_kmers(). results[n] is what bloom_add() would return for
+ * the window starting at byte n.
+ *
+ * Return:
+ * -------
+ *     >= 0 - the number of k-mers which had already been added (or
+ *            collisions)
+ *       -1 - bloom not initialized or 'k' is 0
+ *
+ */
+long int bloom_add_kmers(struct bloom * bloom, const void * buffer,
+                         unsigned long int len, unsigned int k,
+                         unsigned int flags, unsigned char * results);
+
+
+/** ***************************************************************************
+ * Add many elements to the bloom filter using multiple threads.
+ *
+ * The resulting filter is identical to the one produced by calling
+ * bloom_add() on each element in turn. This is meant for (re)building
+ * large filters from a large number of elements in bulk: the threads
+ * first hash the elements and sort their bit positions by the range of
+ * the filter they fall into, then each thread sets the bits of its own
+ * ranges, one cache sized range (of up to 2^21 bits) at a time.
+ *
+ * Elements are processed in batches of about 16 million bit positions
+ * (that is, 16 million / 'hashes' elements). Temporary memory is about
+ * 100MB for a batch, plus 8 bytes per thread for every range of the
+ * filter (about 10MB for a 10GB filter on 32 threads), and does not grow
+ * with 'count'.
+ *
+ * Not thread safe with respect to other operations on the same filter.
+ *
+ * Parameters:
+ * -----------
+ *     bloom    - Pointer to an allocated struct bloom (see above).
+ *     elements - Array of 'count' elements to add, each one contiguous
+ *                buffer described by an iovec.
+ *     count    - Number of elements.
+ *     threads  - Number of threads to use, or 0 for one per online CPU.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (out of memory or unable to create threads). Some
+ *         of the elements may have been added.
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_build_parallel(struct bloom * bloom, const struct iovec * elements,
+                         unsigned long int count, int threads);
+
+
 /** ***************************************************************************
  * Print (to stdout) info about this bloom filter. Debugging aid.
  *
@@ -156,6 +563,12 @@ void bloom_free(struct bloom * bloom);
  * Erases all elements. Upon return, the bloom struct returns to its initial
  * (initialized) state.
  *
+ * On Linux, the memory of large filters is handed back to the kernel,
+ * which supplies zeroed pages again as they are next used. This takes a
+ * fraction of the time of clearing the memory and doesn't pollute the
+ * caches. Checks running concurrently with the reset (on other threads)
+ * see each bit either set as before or cleared, and never fail.
+ *
  * Parameters:
  * -----------
  *     bloom  - Pointer to an allocated struct bloom (see above).
@@ -184,6 +597,76 @@ int bloom_reset(struct bloom * bloom);
 int bloom_save(struct bloom * bloom, char * filename);
 
 
+/** ***************************************************************************
+ * State of a save started by bloom_save_background(). Caller needs to
+ * allocate this and pass it to bloom_save_background(), and then to
+ * bloom_save_wait() until the save completes.
+ *
+ */
+struct bloom_snapshot
+{
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  pid_t pid;
+  char * tmp;
+};
+
+
+/** ***************************************************************************
+ * Save a bloom filter to a file in the background.
+ *
+ * The filter is copied as it is at the time of the call, cheaply: the
+ * process forks and the child process writes its (copy-on-write) view of
+ * the filter, so the caller can go on adding to the filter right away. Each
+ * page of the filter written to before the save completes is copied once,
+ * by the kernel, on the first write.
+ *
+ * The file is written next to 'filename' in large writes, flushed to disk
+ * and then renamed over 'filename', so 'filename' always holds either its
+ * previous contents or a complete snapshot, even after a crash.
+ *
+ * The caller must ensure no bloom_add() to the filter is in progress at
+ * the time of the call (as for bloom_save()), but not after it. The child
+ * process must be reaped with bloom_save_wait(), so the process must not
+ * ignore SIGCHLD or reap children it did not start itself.
+ *
+ * Parameters:
+ * -----------
+ *     bloom    - Pointer to an initialized struct bloom.
+ *     filename - Replace this file with the bloom data.
+ *     snapshot - Pointer to an allocated struct bloom_snapshot (see above).
+ *
+ * Return:
+ * -------
+ *     0 - the save was started
+ *     1 - on failure, no save was started
+ *
+ */
+int bloom_save_background(struct bloom * bloom, char * filename,
+                          struct bloom_snapshot * snapshot);
+
+
+/** ***************************************************************************
+ * Check for (or wait for) the completion of a bloom_save_background().
+ *
+ * Parameters:
+ * -----------
+ *     snapshot - The snapshot passed to bloom_save_background().
+ *     block    - If nonzero, wait until the save completes.
+ *
+ * Return:
+ * -------
+ *     0 - the save completed successfully
+ *     1 - the save failed, 'filename' was left unchanged
+ *     2 - the save is still in progress (only if not 'block')
+ *
+ * Once 0 or 1 is returned, 'snapshot' may be reused.
+ *
+ */
+int bloom_save_wait(struct bloom_snapshot * snapshot, int block);
+
+
 /** ***************************************************************************
  * Load a bloom filter from a file.
  *
@@ -197,6 +680,8 @@ int bloom_save(struct bloom * bloom, char * filename);
  * Return:
  *     0   - on success
  *     > 0 - on failure
+ *     12  - the file uses options (see bloom_init3()) not supported by
+ *           this version of the library
  *
  */
 int bloom_load(struct bloom * bloom, char * filename);
@@ -209,7 +694,7 @@ int bloom_load(struct bloom * bloom, char * filename);
  * to its own. The bloom_src bloom filter is never modified.
  *
  * Both bloom_dest and bloom_src must be initialized and both must have
- * identical parameters.
+ * identical parameters (including the bloom_init3() flags).
  *
  * Parameters:
  * -----------
@@ -226,6 +711,65 @@ int bloom_load(struct bloom * bloom, char * filename);
 int bloom_merge(struct bloom * bloom_dest, struct bloom * bloom_src);
 
 
+/** ***************************************************************************
+ * Merge saved bloom filters (see bloom_save()) into a new saved filter,
+ * without loading them into memory.
+ *
+ * All headers are read and checked first, with the same rules as
+ * bloom_merge(). Then the bit fields are read sequentially a few MB at a
+ * time and OR'd together, so memory use stays small and constant however
+ * large and however many the filters are.
+ *
+ * The result is written to a temporary file next to 'output' and renamed
+ * over it when complete, so 'output' is never left half written and may
+ * also be one of the inputs.
+ *
+ * Parameters:
+ * -----------
+ *     output - Write the merged filter to this file.
+ *     files  - Names of the saved filters to merge.
+ *     count  - Number of names in 'files', at least 1.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - invalid parameters
+ *     2 - an input can't be read or is not a valid saved filter
+ *     3 - incompatible bloom filters
+ *     4 - I/O error while merging
+ *
+ */
+int bloom_merge_files(char * output, char ** files, int count);
+
+
+/** ***************************************************************************
+ * Shrink a filter created with BLOOM_POW2 to 1/2^times of its size, without
+ * needing its elements. The halves of the bit field are OR'd together, so
+ * every element added before (or after) the fold is still found.
+ *
+ * The number of hashes and entries stay the same, so the error rate goes
+ * up. The filter's 'error' is updated to the expected error rate at
+ * 'entries' elements for the new size:
+ *     error = (1 - e^(-hashes * entries / bits)) ^ hashes
+ *
+ * Filters folded the same number of times from compatible filters are
+ * compatible with each other (see bloom_merge()).
+ *
+ * Parameters:
+ * -----------
+ *     bloom - Pointer to an initialized BLOOM_POW2 filter.
+ *     times - Number of times to halve the filter, at least 1.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (not a BLOOM_POW2 filter or would be under 8 bits)
+ *    -1 - bloom not initialized
+ *
+ */
+int bloom_fold(struct bloom * bloom, unsigned int times);
+
+
 /** ***************************************************************************
  * Returns version string compiled into library.
  *
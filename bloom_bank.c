@@ -0,0 +1,194 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_bank.h for documentation on the public interfaces.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "bloom_bank.h"
+#include "bloom_internal.h"
+
+// Rows are padded to this many 64 bit words (and aligned to a cache line)
+// so the row AND loop below can use full width vector loads.
+#define ROW_ALIGN_WORDS 8
+
+
+int bloom_bank_init(struct bloom_bank * bank,
+                    unsigned int entries, double error, unsigned int capacity)
+{
+  memset(bank, 0, sizeof(struct bloom_bank));
+
+  if (capacity == 0) {
+    return 1;
+  }
+
+  if (bloom_shape(&bank->shape, entries, error)) {
+    return 1;
+  }
+
+  unsigned long int used_words = (capacity + 63) / 64;
+  bank->words = (used_words + ROW_ALIGN_WORDS - 1) & ~(ROW_ALIGN_WORDS - 1ul);
+  bank->capacity = capacity;
+
+  bank->used = (uint64_t *)calloc(bank->words, sizeof(uint64_t));
+  if (bank->used == NULL) {                                  // LCOV_EXCL_START
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  size_t size = bank->shape.bits * bank->words * sizeof(uint64_t);
+  if (posix_memalign((void **)&bank->rows, 64, size)) {      // LCOV_EXCL_START
+    free(bank->used);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+  memset(bank->rows, 0, size);
+
+  bank->ready = 1;
+
+  return 0;
+}
+
+
+int bloom_bank_load(struct bloom_bank * bank, char * filename,
+                    unsigned int * slot)
+{
+  if (bank->ready == 0) {
+    printf("bank at %p not initialized!\n", (void *)bank);
+    return -1;
+  }
+
+  struct bloom bloom;
+  if (bloom_load(&bloom, filename)) {
+    return 1;
+  }
+
+  if (bloom_compatible(&bank->shape, &bloom)) {
+    bloom_free(&bloom);
+    return 2;
+  }
+
+  if (bank->count == bank->capacity) {
+    bloom_free(&bloom);
+    return 3;
+  }
+
+  unsigned int s;
+  for (s = 0; s < bank->capacity; s++) {
+    if (!(bank->used[s / 64] & (1ull << (s % 64)))) {
+      break;
+    }
+  }
+
+  unsigned long int word = s / 64;
+  uint64_t mask = 1ull << (s % 64);
+  unsigned long int byte;
+
+  // Transpose: bit x of the filter becomes bit 's' of row x.
+  for (byte = 0; byte < bloom.bytes; byte++) {
+    unsigned int c = bloom.bf[byte];
+    while (c) {
+      unsigned long int x = (byte << 3) + __builtin_ctz(c);
+      bank->rows[x * bank->words + word] |= mask;
+      c &= c - 1;
+    }
+  }
+
+  bloom_free(&bloom);
+
+  bank->used[word] |= mask;
+  bank->count++;
+  *slot = s;
+
+  return 0;
+}
+
+
+int bloom_bank_remove(struct bloom_bank * bank, unsigned int slot)
+{
+  if (bank->ready == 0) {
+    printf("bank at %p not initialized!\n", (void *)bank);
+    return -1;
+  }
+
+  unsigned long int word = slot / 64;
+  uint64_t mask = 1ull << (slot % 64);
+
+  if (slot >= bank->capacity || !(bank->used[word] & mask)) {
+    return 1;
+  }
+
+  uint64_t * p = bank->rows + word;
+  unsigned long int x;
+  for (x = 0; x < bank->shape.bits; x++) {
+    *p &= ~mask;
+    p += bank->words;
+  }
+
+  bank->used[word] &= ~mask;
+  bank->count--;
+
+  return 0;
+}
+
+
+int bloom_bank_check(struct bloom_bank * bank,
+                     const void * buffer, int len, uint64_t * result)
+{
+  if (bank->ready == 0) {
+    printf("bank at %p not initialized!\n", (void *)bank);
+    return -1;
+  }
+
+  unsigned long int words = (bank->capacity + 63) / 64;
+  unsigned long int rows[256];
+  struct bloom_hash hash;
+  unsigned long int i, w;
+
+  bloom_hash_buffer(&bank->shape, buffer, len, &hash);
+
+  // Issue all row loads up front, they are independent of each other.
+  for (i = 0; i < bank->shape.hashes; i++) {
+    rows[i] = bloom_nth_bit(&bank->shape, &hash, i) * bank->words;
+    __builtin_prefetch(bank->rows + rows[i]);
+  }
+
+  memcpy(result, bank->used, words * sizeof(uint64_t));
+
+  for (i = 0; i < bank->shape.hashes; i++) {
+    const uint64_t * row = bank->rows + rows[i];
+    uint64_t any = 0;
+    for (w = 0; w < words; w++) {
+      result[w] &= row[w];
+      any |= result[w];
+    }
+    if (!any) {
+      return 0;
+    }
+  }
+
+  int count = 0;
+  for (w = 0; w < words; w++) {
+    count += __builtin_popcountll(result[w]);
+  }
+
+  return count;
+}
+
+
+void bloom_bank_free(struct bloom_bank * bank)
+{
+  if (bank->ready) {
+    free(bank->used);
+    free(bank->rows);
+  }
+  bank->ready = 0;
+}
@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_BANK_H
+#define _BLOOM_BANK_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A bank of up to 'capacity' bloom filters which all share the same
+ * parameters (entries and error), queried together.
+ *
+ * The member filters are stored bit-sliced: for every bit position of
+ * the filter shape there is one row of 'capacity' bits, bit N of the row
+ * being that bit of member filter N. Checking an element reads only the
+ * rows of its own bit positions and ANDs them together, which yields the
+ * set of member filters which may contain the element in a single pass.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_bank_init().
+ *
+ */
+struct bloom_bank
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  unsigned int capacity;
+  unsigned int count;
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  struct bloom shape;
+  unsigned long int words;
+  uint64_t * used;
+  uint64_t * rows;
+};
+
+
+/** ***************************************************************************
+ * Initialize an empty filter bank.
+ *
+ * Parameters:
+ * -----------
+ *     bank     - Pointer to an allocated struct bloom_bank (see above).
+ *     entries  - The 'entries' value (see bloom_init2()) of the filters
+ *                which will be loaded into this bank.
+ *     error    - The 'error' value (see bloom_init2()) of the filters
+ *                which will be loaded into this bank.
+ *     capacity - Maximum number of filters held by the bank.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_bank_init(struct bloom_bank * bank,
+                    unsigned int entries, double error, unsigned int capacity);
+
+
+/** ***************************************************************************
+ * Load a filter saved with bloom_save() into a free slot of the bank.
+ *
+ * The filter must have been created with the same parameters as the bank.
+ *
+ * Parameters:
+ * -----------
+ *     bank     - Pointer to an initialized struct bloom_bank.
+ *     filename - Load bloom filter data from this file.
+ *     slot     - On success, set to the slot number which now holds the
+ *                filter. This is the bit number used for the filter in
+ *                the results of bloom_bank_check().
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - the file could not be loaded (see bloom_load())
+ *     2 - the filter in the file is not compatible with the bank
+ *     3 - the bank is full
+ *    -1 - bank not initialized
+ *
+ */
+int bloom_bank_load(struct bloom_bank * bank, char * filename,
+                    unsigned int * slot);
+
+
+/** ***************************************************************************
+ * Remove the filter in the given slot from the bank. The slot becomes
+ * available to future bloom_bank_load() calls.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - slot is not in use
+ *    -1 - bank not initialized
+ *
+ */
+int bloom_bank_remove(struct bloom_bank * bank, unsigned int slot);
+
+
+/** ***************************************************************************
+ * Check which filters in the bank may contain the given element.
+ *
+ * Parameters:
+ * -----------
+ *     bank   - Pointer to an initialized struct bloom_bank.
+ *     buffer - Pointer to buffer containing element to check.
+ *     len    - Size of 'buffer'.
+ *     result - Bitmap of (capacity + 63) / 64 words. On return, bit N
+ *              (word N / 64, bit N % 64) is set if the filter in slot N
+ *              may contain the element, exactly as bloom_check() on that
+ *              filter would report.
+ *
+ * Return:
+ * -------
+ *     number of filters which may contain the element
+ *    -1 - bank not initialized
+ *
+ */
+int bloom_bank_check(struct bloom_bank * bank,
+                     const void * buffer, int len, uint64_t * result);
+
+
+/** ***************************************************************************
+ * Deallocate internal storage. Upon return, the bank is no longer usable.
+ *
+ */
+void bloom_bank_free(struct bloom_bank * bank);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
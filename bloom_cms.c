@@ -0,0 +1,310 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_cms.h for documentation on the public interfaces.
+ *
+ * The counter positions are the bit positions of a bloom filter shaped
+ * 'width' bits by 'depth' hashes (kept in 'shape'), position r of an
+ * element selecting its counter in row r.
+ *
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_cms.h"
+#include "bloom_internal.h"
+
+#define CMS_MAGIC "libbloomcms1"
+
+#define CMS_FLAGS_KNOWN \
+  (BLOOM_HASH64 | BLOOM_POW2 | BLOOM_ENHANCED | BLOOM_CMS_CONSERVATIVE)
+
+
+static uint32_t add_sat(uint32_t a, uint32_t b)
+{
+  uint32_t sum = a + b;
+  return sum < a ? UINT32_MAX : sum;
+}
+
+
+static size_t counters_size(const struct bloom_cms * cms)
+{
+  return cms->width * cms->depth * sizeof(uint32_t);
+}
+
+
+static void cms_add_hash(struct bloom_cms * cms,
+                         const struct bloom_hash * hash, uint32_t count)
+{
+  uint32_t * c[256];
+  unsigned int r;
+
+  for (r = 0; r < cms->depth; r++) {
+    c[r] = cms->counters + r * cms->width +
+      bloom_nth_bit(&cms->shape, hash, r);
+  }
+
+  if (cms->flags & BLOOM_CMS_CONSERVATIVE) {
+    uint32_t min = UINT32_MAX;
+    for (r = 0; r < cms->depth; r++) {
+      if (*c[r] < min) { min = *c[r]; }
+    }
+    uint32_t target = add_sat(min, count);
+    for (r = 0; r < cms->depth; r++) {
+      if (*c[r] < target) { *c[r] = target; }
+    }
+  } else {
+    for (r = 0; r < cms->depth; r++) {
+      *c[r] = add_sat(*c[r], count);
+    }
+  }
+
+  cms->total += count;
+}
+
+
+int bloom_cms_init(struct bloom_cms * cms, double error, double delta,
+                   unsigned int flags)
+{
+  memset(cms, 0, sizeof(struct bloom_cms));
+
+  if (error <= 0 || error >= 1 || delta <= 0 || delta >= 1 ||
+      (flags & ~CMS_FLAGS_KNOWN)) {
+    return 1;
+  }
+
+  double width = ceil(M_E / error);
+  double depth = ceil(log(1 / delta));
+  if (width > (double)(1ul << 40) || depth > 255) {
+    return 1;
+  }
+
+  if (flags & BLOOM_ENHANCED) {
+    flags |= BLOOM_HASH64;
+  }
+
+  cms->error = error;
+  cms->delta = delta;
+  cms->width = (unsigned long int)width;
+  cms->depth = depth < 1 ? 1 : (unsigned int)depth;
+  cms->flags = flags;
+
+  if (flags & BLOOM_POW2) {
+    unsigned long int w = 1;
+    while (w < cms->width) {
+      w <<= 1;
+    }
+    cms->width = w;
+  }
+
+  cms->shape.major = BLOOM_VERSION_MAJOR;
+  cms->shape.minor = BLOOM_VERSION_MINOR;
+  cms->shape.bits = cms->width;
+  cms->shape.hashes = cms->depth;
+  cms->shape.flags = flags & ~BLOOM_CMS_CONSERVATIVE;
+
+  cms->counters = (uint32_t *)calloc(cms->width * cms->depth,
+                                     sizeof(uint32_t));
+  if (cms->counters == NULL) {                               // LCOV_EXCL_START
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  cms->ready = 1;
+
+  return 0;
+}
+
+
+int bloom_cms_add(struct bloom_cms * cms, const void * buffer, int len,
+                  uint32_t count)
+{
+  if (!bloom_struct_ready(cms, cms->ready, "bloom_cms")) {
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  bloom_hash_buffer(&cms->shape, buffer, len, &hash);
+  cms_add_hash(cms, &hash, count);
+
+  return 0;
+}
+
+
+int bloom_cms_add_bloom(struct bloom_cms * cms, struct bloom * bloom,
+                        const void * buffer, int len, uint32_t count)
+{
+  if (!bloom_struct_ready(cms, cms->ready, "bloom_cms")) {
+    return -1;
+  }
+
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  bloom_hash_buffer(&cms->shape, buffer, len, &hash);
+  cms_add_hash(cms, &hash, count);
+
+  if ((bloom->flags & BLOOM_HASH64) != (cms->flags & BLOOM_HASH64)) {
+    bloom_hash_buffer(bloom, buffer, len, &hash);
+  }
+
+  return bloom_check_add_hash(bloom, &hash, 1);
+}
+
+
+long int bloom_cms_estimate(struct bloom_cms * cms,
+                            const void * buffer, int len)
+{
+  if (!bloom_struct_ready(cms, cms->ready, "bloom_cms")) {
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  uint32_t min = UINT32_MAX;
+  unsigned int r;
+
+  bloom_hash_buffer(&cms->shape, buffer, len, &hash);
+
+  for (r = 0; r < cms->depth; r++) {
+    uint32_t c = cms->counters[r * cms->width +
+                               bloom_nth_bit(&cms->shape, &hash, r)];
+    if (c < min) { min = c; }
+  }
+
+  return min;
+}
+
+
+int bloom_cms_merge(struct bloom_cms * dest, const struct bloom_cms * src)
+{
+  if (!bloom_struct_ready(dest, dest->ready, "bloom_cms") ||
+      !bloom_struct_ready(src, src->ready, "bloom_cms")) {
+    return -1;
+  }
+
+  if (dest->width != src->width || dest->depth != src->depth ||
+      dest->flags != src->flags || dest->error != src->error ||
+      dest->delta != src->delta) {
+    return 1;
+  }
+
+  // Written so the compiler vectorizes it (saturating adds of 4 or 8
+  // counters at a time). 'dest' may be 'src'.
+  uint32_t * d = dest->counters;
+  const uint32_t * s = src->counters;
+  unsigned long int n;
+  unsigned long int count = dest->width * dest->depth;
+
+  for (n = 0; n < count; n++) {
+    uint32_t sum = d[n] + s[n];
+    d[n] = sum | -(uint32_t)(sum < s[n]);
+  }
+
+  dest->total += src->total;
+
+  return 0;
+}
+
+
+int bloom_cms_reset(struct bloom_cms * cms)
+{
+  if (!cms->ready) return 1;
+  memset(cms->counters, 0, counters_size(cms));
+  cms->total = 0;
+  return 0;
+}
+
+
+int bloom_cms_save(struct bloom_cms * cms, char * filename)
+{
+  if (filename == NULL || filename[0] == 0 || !cms->ready) {
+    return 1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return 1;
+  }
+
+  int rv = bloom_write_blob_header(fd, CMS_MAGIC, cms,
+                                   sizeof(struct bloom_cms)) ||
+    bloom_write_full(fd, cms->counters, counters_size(cms));
+
+  close(fd);
+  return rv;
+}
+
+
+int bloom_cms_load(struct bloom_cms * cms, char * filename)
+{
+  int rv = 0;
+
+  if (filename == NULL || filename[0] == 0) { return 1; }
+  if (cms == NULL) { return 2; }
+
+  memset(cms, 0, sizeof(struct bloom_cms));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) { return 3; }
+
+  rv = bloom_read_blob_header(fd, CMS_MAGIC, cms,
+                              sizeof(struct bloom_cms));
+  if (rv) { goto done; }
+
+  cms->ready = 0;
+  cms->counters = NULL;
+  if (cms->shape.major != BLOOM_VERSION_MAJOR) { rv = 9; goto done; }
+
+  // The counters are indexed by bit positions of 'shape', which must be
+  // exactly the shape bloom_cms_init() would have made.
+  if ((cms->flags & ~CMS_FLAGS_KNOWN) ||
+      cms->depth < 1 || cms->depth > 255 ||
+      cms->width < 1 || cms->width > (1ul << 40) ||
+      ((cms->flags & BLOOM_POW2) && (cms->width & (cms->width - 1))) ||
+      cms->shape.bits != cms->width || cms->shape.hashes != cms->depth ||
+      cms->shape.flags != (cms->flags & ~BLOOM_CMS_CONSERVATIVE)) {
+    rv = 12;
+    goto done;
+  }
+
+  cms->counters = (uint32_t *)malloc(counters_size(cms));
+  if (cms->counters == NULL) { rv = 10; goto done; }         // LCOV_EXCL_LINE
+
+  if (bloom_read_full(fd, cms->counters, counters_size(cms))) {
+    free(cms->counters);
+    cms->counters = NULL;
+    rv = 11;
+    goto done;
+  }
+
+  cms->ready = 1;
+
+ done:
+  close(fd);
+  return rv;
+}
+
+
+void bloom_cms_free(struct bloom_cms * cms)
+{
+  if (cms->ready) {
+    free(cms->counters);
+  }
+  cms->ready = 0;
+}
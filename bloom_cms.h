@@ -0,0 +1,198 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_CMS_H
+#define _BLOOM_CMS_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A Count-Min sketch: estimates how many times each element has been
+ * added, using the same hashes as the bloom filters.
+ *
+ * The sketch is 'depth' rows of 'width' counters. Adding an element
+ * increments one counter per row, at the positions a bloom filter of
+ * 'width' bits with 'depth' hashes would set; the estimate is the
+ * smallest of those counters. Estimates are never below the true count,
+ * and with probability 1 - delta not above it by more than
+ * error * total (the sum of all counts added).
+ *
+ * Sketches with identical parameters can be merged, so threads can each
+ * fill their own and combine them at the end.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_cms_init() or bloom_cms_load().
+ *
+ */
+struct bloom_cms
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  double error;
+  double delta;
+  unsigned long int width;
+  unsigned int depth;
+  unsigned int flags;
+  uint64_t total;
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  struct bloom shape;
+  uint32_t * counters;
+};
+
+
+/** ***************************************************************************
+ * Flag for bloom_cms_init(), in addition to the hashing flags of
+ * bloom_init3() (BLOOM_HASH64, BLOOM_POW2 and BLOOM_ENHANCED).
+ *
+ * BLOOM_CMS_CONSERVATIVE - Conservative update: adding raises only the
+ *                counters below the new estimate, and only up to it. The
+ *                estimates are never higher (and typically much closer to
+ *                the true counts, especially for infrequent elements) than
+ *                without this flag. Merged sketches remain valid upper
+ *                bounds but lose some of this advantage.
+ *
+ */
+#define BLOOM_CMS_CONSERVATIVE 0x100
+
+
+/** ***************************************************************************
+ * Initialize a sketch with all counts zero.
+ *
+ * Parameters:
+ * -----------
+ *     cms   - Pointer to an allocated struct bloom_cms (see above).
+ *     error - Overestimate, as a fraction of the total count, not to be
+ *             exceeded with probability 1 - delta. Determines the width:
+ *             e / error counters per row.
+ *     delta - Probability of exceeding the error bound. Determines the
+ *             depth: ln(1 / delta) rows.
+ *     flags - Zero or more of the bloom_init3() hashing flags and
+ *             BLOOM_CMS_CONSERVATIVE.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_cms_init(struct bloom_cms * cms, double error, double delta,
+                   unsigned int flags);
+
+
+/** ***************************************************************************
+ * Add 'count' occurrences of the given element. Counters saturate at
+ * UINT32_MAX instead of wrapping.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *    -1 - sketch not initialized
+ *
+ */
+int bloom_cms_add(struct bloom_cms * cms, const void * buffer, int len,
+                  uint32_t count);
+
+
+/** ***************************************************************************
+ * Add 'count' occurrences of the given element to the sketch and add the
+ * element to 'bloom' too, hashing it only once if both use the same hash
+ * (the same BLOOM_HASH64 flag).
+ *
+ * Return:
+ * -------
+ *     as bloom_add() on 'bloom'
+ *    -1 - sketch or bloom not initialized
+ *
+ */
+int bloom_cms_add_bloom(struct bloom_cms * cms, struct bloom * bloom,
+                        const void * buffer, int len, uint32_t count);
+
+
+/** ***************************************************************************
+ * Return the estimated number of occurrences of the given element, or -1
+ * if the sketch is not initialized.
+ *
+ */
+long int bloom_cms_estimate(struct bloom_cms * cms,
+                            const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Merge two sketches with identical parameters: on success, every count of
+ * 'dest' is the (saturating) sum of its own and that of 'src'. 'src' is not
+ * modified, unless it is 'dest' (which doubles every count).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - incompatible sketches
+ *    -1 - sketch not initialized
+ *
+ */
+int bloom_cms_merge(struct bloom_cms * dest, const struct bloom_cms * src);
+
+
+/** ***************************************************************************
+ * Set all counts to zero.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (not initialized)
+ *
+ */
+int bloom_cms_reset(struct bloom_cms * cms);
+
+
+/** ***************************************************************************
+ * Save a sketch to a file, created (or overwritten).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_cms_save(struct bloom_cms * cms, char * filename);
+
+
+/** ***************************************************************************
+ * Load a sketch saved with bloom_cms_save(). The struct is initialized by
+ * this call; it must not be initialized already.
+ *
+ * Return:
+ * -------
+ *     0   - on success
+ *     > 0 - on failure
+ *
+ */
+int bloom_cms_load(struct bloom_cms * cms, char * filename);
+
+
+/** ***************************************************************************
+ * Deallocate internal storage. Upon return, the sketch is no longer usable.
+ *
+ */
+void bloom_cms_free(struct bloom_cms * cms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,515 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_disk.h for documentation on the public interfaces.
+ *
+ * The pool is an array of page sized frames. A hash table (chained
+ * through the frames) maps page numbers to the frames holding them.
+ * Frames are handed out in order until all are used; after that the clock
+ * hand sweeps over them, clearing the reference bit of recently used
+ * frames and evicting the first one found already clear.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_disk.h"
+#include "bloom_internal.h"
+
+#define NO_FRAME 0xffffffffu
+#define NO_PAGE 0xfffffffffffffffful
+
+// Batches are sorted and processed this many elements at a time, which
+// bounds the memory used for sorting them.
+#define DISK_BATCH (1ul << 16)
+
+// While processing a batch, the kernel is asked to read ahead the pages of
+// this many of the next distinct pages not in the pool.
+#define DISK_READAHEAD 32
+
+struct bloom_disk_frame
+{
+  unsigned long int page;
+  unsigned int next;                  // Next frame in the same bucket
+  unsigned char ref;
+  unsigned char dirty;
+};
+
+struct disk_item
+{
+  unsigned long int page;
+  unsigned long int index;
+  struct bloom_hash hash;
+};
+
+
+static unsigned int bucket(const struct bloom_disk * disk,
+                           unsigned long int page)
+{
+  return (unsigned int)((page * 0x9e3779b97f4a7c15ull) >> 32) & disk->mask;
+}
+
+
+static off_t page_offset(const struct bloom_disk * disk,
+                         unsigned long int page)
+{
+  return bloom_bf_offset(&disk->bloom) + page * BLOOM_PAGE_BYTES;
+}
+
+
+static unsigned int lookup(const struct bloom_disk * disk,
+                           unsigned long int page)
+{
+  unsigned int f = disk->buckets[bucket(disk, page)];
+
+  while (f != NO_FRAME && disk->frame[f].page != page) {
+    f = disk->frame[f].next;
+  }
+
+  return f;
+}
+
+
+static int write_frame(struct bloom_disk * disk, unsigned int f)
+{
+  unsigned char * mem = disk->pool + f * BLOOM_PAGE_BYTES;
+  off_t offset = page_offset(disk, disk->frame[f].page);
+
+  if (pwrite(disk->fd, mem, BLOOM_PAGE_BYTES, offset) != BLOOM_PAGE_BYTES) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  disk->frame[f].dirty = 0;
+  disk->writes++;
+
+  return 0;
+}
+
+
+/*
+ * Return the frame holding 'page', reading it in (and evicting another
+ * page) if necessary. Returns NO_FRAME on I/O error.
+ *
+ */
+static unsigned int get_page(struct bloom_disk * disk, unsigned long int page)
+{
+  unsigned int f = lookup(disk, page);
+
+  if (f != NO_FRAME) {
+    disk->frame[f].ref = 1;
+    disk->hits++;
+    return f;
+  }
+
+  if (disk->used < disk->frames) {
+    f = disk->used++;
+  } else {
+    while (1) {
+      f = disk->hand;
+      disk->hand = (disk->hand + 1) % disk->frames;
+      if (!disk->frame[f].ref) {
+        break;
+      }
+      disk->frame[f].ref = 0;
+    }
+
+    if (disk->frame[f].dirty && write_frame(disk, f)) {
+      return NO_FRAME;                                       // LCOV_EXCL_LINE
+    }
+
+    unsigned int * p = &disk->buckets[bucket(disk, disk->frame[f].page)];
+    while (*p != f) {
+      p = &disk->frame[*p].next;
+    }
+    *p = disk->frame[f].next;
+  }
+
+  unsigned char * mem = disk->pool + f * BLOOM_PAGE_BYTES;
+  int ok = pread(disk->fd, mem, BLOOM_PAGE_BYTES, page_offset(disk, page)) ==
+    BLOOM_PAGE_BYTES;
+
+  // On failure the frame still goes into the table (every used frame is
+  // in it) but under a page number no lookup asks for.
+  unsigned long int held = ok ? page : NO_PAGE;
+  unsigned int b = bucket(disk, held);
+  disk->frame[f].page = held;
+  disk->frame[f].next = disk->buckets[b];
+  disk->frame[f].ref = ok;
+  disk->frame[f].dirty = 0;
+  disk->buckets[b] = f;
+
+  if (!ok) {
+    return NO_FRAME;
+  }
+  disk->reads++;
+
+  return f;
+}
+
+
+/*
+ * Check (and add, if 'add') the element with hash material 'hash', which
+ * falls in 'page'. Returns as bloom_disk_add() or bloom_disk_check().
+ *
+ */
+static int check_add_page(struct bloom_disk * disk, unsigned long int page,
+                          const struct bloom_hash * hash, int add)
+{
+  unsigned int f = get_page(disk, page);
+  if (f == NO_FRAME) {
+    return -2;
+  }
+
+  unsigned char * mem = disk->pool + f * BLOOM_PAGE_BYTES;
+  unsigned long int base = page * BLOOM_PAGE_BITS;
+  unsigned char hits = 0;
+  unsigned long int i;
+
+  for (i = 0; i < disk->bloom.hashes; i++) {
+    unsigned long int x = bloom_nth_bit(&disk->bloom, hash, i) - base;
+    if (test_bit_set_bit(mem, x, add)) {
+      hits++;
+    } else if (!add) {
+      return 0;
+    }
+  }
+
+  if (hits == disk->bloom.hashes) {
+    return 1;
+  }
+
+  disk->frame[f].dirty = 1;
+  return 0;
+}
+
+
+static unsigned long int page_of(const struct bloom_disk * disk,
+                                 const struct bloom_hash * hash)
+{
+  return bloom_nth_bit(&disk->bloom, hash, 0) / BLOOM_PAGE_BITS;
+}
+
+
+static int usable(const struct bloom_disk * disk, int add)
+{
+  if (disk->ready == 0) {
+    printf("bloom_disk at %p not initialized!\n", (void *)disk);
+    return 0;
+  }
+
+  if (add && !disk->writable) {
+    printf("bloom_disk at %p not writable!\n", (void *)disk);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Set up the pool for the filter in disk->bloom, open as disk->fd.
+ *
+ */
+static int setup(struct bloom_disk * disk, unsigned long int pool_bytes)
+{
+  unsigned int f;
+
+  disk->pages = disk->bloom.bytes / BLOOM_PAGE_BYTES;
+  if (pool_bytes < BLOOM_PAGE_BYTES || disk->pages == 0) {
+    return 1;
+  }
+
+  unsigned long int frames = pool_bytes / BLOOM_PAGE_BYTES;
+  if (frames > disk->pages) { frames = disk->pages; }
+  if (frames > (1ul << 30)) { frames = 1ul << 30; }
+  disk->frames = (unsigned int)frames;
+
+  unsigned int buckets = 1;
+  while (buckets < disk->frames) {
+    buckets <<= 1;
+  }
+  disk->mask = buckets - 1;
+
+  disk->frame = (struct bloom_disk_frame *)
+    calloc(disk->frames, sizeof(struct bloom_disk_frame));
+  disk->buckets = (unsigned int *)malloc(buckets * sizeof(unsigned int));
+  if (disk->frame == NULL || disk->buckets == NULL ||
+      posix_memalign((void **)&disk->pool, BLOOM_PAGE_BYTES,
+                     disk->frames * BLOOM_PAGE_BYTES)) {
+    free(disk->frame);                                       // LCOV_EXCL_START
+    free(disk->buckets);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  for (f = 0; f < buckets; f++) {
+    disk->buckets[f] = NO_FRAME;
+  }
+
+  disk->ready = 1;
+
+  return 0;
+}
+
+
+int bloom_disk_create(struct bloom_disk * disk, const char * filename,
+                      unsigned long int entries, double error,
+                      unsigned int flags, unsigned long int pool_bytes)
+{
+  memset(disk, 0, sizeof(struct bloom_disk));
+  disk->fd = -1;
+
+  if (filename == NULL || filename[0] == 0 ||
+      bloom_shape3(&disk->bloom, entries, error, flags | BLOOM_PAGED)) {
+    return 1;
+  }
+
+  disk->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (disk->fd < 0) {
+    return 1;
+  }
+
+  disk->bloom.ready = 1;
+  if (bloom_write_header(disk->fd, &disk->bloom) ||
+      ftruncate(disk->fd, page_offset(disk, 0) + disk->bloom.bytes) ||
+      setup(disk, pool_bytes)) {
+    close(disk->fd);
+    disk->fd = -1;
+    return 1;
+  }
+
+  disk->writable = 1;
+
+  return 0;
+}
+
+
+int bloom_disk_open(struct bloom_disk * disk, const char * filename,
+                    int writable, unsigned long int pool_bytes)
+{
+  struct stat st;
+
+  memset(disk, 0, sizeof(struct bloom_disk));
+
+  if (filename == NULL || filename[0] == 0) {
+    return 1;
+  }
+
+  disk->fd = open(filename, writable ? O_RDWR : O_RDONLY);
+  if (disk->fd < 0) {
+    return 1;
+  }
+
+  int rv = 1;
+  if (bloom_read_header(disk->fd, &disk->bloom) == 0) {
+    rv = (disk->bloom.flags & BLOOM_PAGED) ? 0 : 2;
+  }
+
+  if (rv == 0 && (fstat(disk->fd, &st) ||
+                  st.st_size < page_offset(disk, 0) + disk->bloom.bytes ||
+                  setup(disk, pool_bytes))) {
+    rv = 1;
+  }
+
+  if (rv) {
+    close(disk->fd);
+    disk->fd = -1;
+    return rv;
+  }
+
+  disk->writable = writable ? 1 : 0;
+
+  return 0;
+}
+
+
+int bloom_disk_check(struct bloom_disk * disk, const void * buffer, int len)
+{
+  if (!usable(disk, 0)) {
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  bloom_hash_buffer(&disk->bloom, buffer, len, &hash);
+
+  return check_add_page(disk, page_of(disk, &hash), &hash, 0);
+}
+
+
+int bloom_disk_add(struct bloom_disk * disk, const void * buffer, int len)
+{
+  if (!usable(disk, 1)) {
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  bloom_hash_buffer(&disk->bloom, buffer, len, &hash);
+
+  return check_add_page(disk, page_of(disk, &hash), &hash, 1);
+}
+
+
+static int compare_items(const void * a, const void * b)
+{
+  const struct disk_item * x = (const struct disk_item *)a;
+  const struct disk_item * y = (const struct disk_item *)b;
+
+  if (x->page != y->page) {
+    return x->page < y->page ? -1 : 1;
+  }
+
+  return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+
+static void readahead(struct bloom_disk * disk, unsigned long int page)
+{
+#ifdef POSIX_FADV_WILLNEED
+  if (lookup(disk, page) == NO_FRAME) {
+    posix_fadvise(disk->fd, page_offset(disk, page), BLOOM_PAGE_BYTES,
+                  POSIX_FADV_WILLNEED);
+  }
+#endif
+}
+
+
+static int check_add_batch(struct bloom_disk * disk,
+                           const struct iovec * elements,
+                           unsigned long int count, unsigned char * results,
+                           int add)
+{
+  if (!usable(disk, add)) {
+    return -1;
+  }
+
+  unsigned long int size = count < DISK_BATCH ? count : DISK_BATCH;
+  struct disk_item * items =
+    (struct disk_item *)malloc(size * sizeof(struct disk_item));
+  unsigned long int * starts =
+    (unsigned long int *)malloc((size + 1) * sizeof(unsigned long int));
+  if (items == NULL || starts == NULL) {                     // LCOV_EXCL_START
+    free(items);
+    free(starts);
+    return -2;
+  }                                                          // LCOV_EXCL_STOP
+
+  unsigned long int done;
+  unsigned long int n, d;
+  int rv = 0;
+
+  for (done = 0; done < count && rv == 0; done += size) {
+    unsigned long int todo = count - done < size ? count - done : size;
+
+    for (n = 0; n < todo; n++) {
+      items[n].index = done + n;
+      bloom_hash_iov(&disk->bloom, &elements[done + n], 1, &items[n].hash);
+      items[n].page = page_of(disk, &items[n].hash);
+    }
+    qsort(items, todo, sizeof(struct disk_item), compare_items);
+
+    // Distinct page d is that of items[starts[d]] up to items[starts[d+1]].
+    unsigned long int distinct = 0;
+    for (n = 0; n < todo; n++) {
+      if (n == 0 || items[n].page != items[n - 1].page) {
+        starts[distinct++] = n;
+      }
+    }
+    starts[distinct] = todo;
+
+    for (d = 0; d < distinct && d < DISK_READAHEAD; d++) {
+      readahead(disk, items[starts[d]].page);
+    }
+
+    for (d = 0; d < distinct && rv == 0; d++) {
+      if (d + DISK_READAHEAD < distinct) {
+        readahead(disk, items[starts[d + DISK_READAHEAD]].page);
+      }
+
+      for (n = starts[d]; n < starts[d + 1]; n++) {
+        int r = check_add_page(disk, items[n].page, &items[n].hash, add);
+        if (r < 0) {
+          rv = r;
+          break;
+        }
+        if (results) {
+          results[items[n].index] = (unsigned char)r;
+        }
+      }
+    }
+  }
+
+  free(items);
+  free(starts);
+
+  return rv;
+}
+
+
+int bloom_disk_check_batch(struct bloom_disk * disk,
+                           const struct iovec * elements,
+                           unsigned long int count, unsigned char * results)
+{
+  return check_add_batch(disk, elements, count, results, 0);
+}
+
+
+int bloom_disk_add_batch(struct bloom_disk * disk,
+                         const struct iovec * elements,
+                         unsigned long int count, unsigned char * results)
+{
+  return check_add_batch(disk, elements, count, results, 1);
+}
+
+
+int bloom_disk_flush(struct bloom_disk * disk)
+{
+  if (disk->ready == 0) {
+    printf("bloom_disk at %p not initialized!\n", (void *)disk);
+    return -1;
+  }
+
+  unsigned int f;
+  for (f = 0; f < disk->used; f++) {
+    if (disk->frame[f].dirty && write_frame(disk, f)) {
+      return 1;                                              // LCOV_EXCL_LINE
+    }
+  }
+
+  if (disk->writable && fsync(disk->fd)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  return 0;
+}
+
+
+int bloom_disk_close(struct bloom_disk * disk)
+{
+  int rv = 0;
+
+  if (disk->ready) {
+    if (disk->writable) {
+      rv = bloom_disk_flush(disk);
+    }
+    close(disk->fd);
+    free(disk->pool);
+    free(disk->frame);
+    free(disk->buckets);
+  }
+
+  disk->ready = 0;
+
+  return rv;
+}
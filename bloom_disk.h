@@ -0,0 +1,228 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_DISK_H
+#define _BLOOM_DISK_H
+
+#include <sys/uio.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A BLOOM_PAGED filter used in place in its saved file (see bloom_save()),
+ * for filters larger than the memory available to hold them.
+ *
+ * All the bits of an element are in one 4KB page of the file, so adding
+ * or checking an element reads at most one page. Pages are kept in a pool
+ * of a fixed size given when opening the filter. When the pool is full,
+ * the least recently used pages (approximately, using the clock algorithm)
+ * are evicted, and written back first if they were modified.
+ *
+ * The file is an ordinary saved filter: it can also be loaded with
+ * bloom_load() where memory allows, and filters saved with bloom_save()
+ * can be opened here if they were created with BLOOM_PAGED.
+ *
+ * Not thread safe: concurrent calls on the same struct bloom_disk must be
+ * serialized by the caller.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_disk_create() or bloom_disk_open().
+ *
+ */
+struct bloom_disk
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  struct bloom bloom;                 // Filter parameters ('bf' is unused)
+  unsigned long int hits;             // Page lookups served from the pool
+  unsigned long int reads;            // Pages read from the file
+  unsigned long int writes;           // Pages written to the file
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  unsigned char writable;
+  int fd;
+  unsigned long int pages;
+  unsigned int frames;
+  unsigned int used;
+  unsigned int hand;
+  unsigned char * pool;
+  struct bloom_disk_frame * frame;
+  unsigned int * buckets;
+  unsigned int mask;
+};
+
+
+/** ***************************************************************************
+ * Create a new, empty disk-resident filter in 'filename' and open it for
+ * reading and writing. An existing file is replaced.
+ *
+ * The file is created sparse, so it takes up disk space only as pages get
+ * written. BLOOM_PAGED is always added to 'flags'.
+ *
+ * Parameters:
+ * -----------
+ *     disk       - Pointer to an allocated struct bloom_disk (see above).
+ *     filename   - Create the filter in this file.
+ *     entries    - As for bloom_init3().
+ *     error      - As for bloom_init3().
+ *     flags      - As for bloom_init3().
+ *     pool_bytes - Memory to use for caching pages, at least 4KB.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_disk_create(struct bloom_disk * disk, const char * filename,
+                      unsigned long int entries, double error,
+                      unsigned int flags, unsigned long int pool_bytes);
+
+
+/** ***************************************************************************
+ * Open a saved BLOOM_PAGED filter.
+ *
+ * Parameters:
+ * -----------
+ *     disk       - Pointer to an allocated struct bloom_disk (see above).
+ *     filename   - The saved filter.
+ *     writable   - If non-zero, elements may be added (and are written back
+ *                  to the file), otherwise the filter can only be checked.
+ *     pool_bytes - Memory to use for caching pages, at least 4KB.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure to open or read the filter
+ *     2 - the filter was not created with BLOOM_PAGED
+ *
+ */
+int bloom_disk_open(struct bloom_disk * disk, const char * filename,
+                    int writable, unsigned long int pool_bytes);
+
+
+/** ***************************************************************************
+ * Check if the given element is in the filter. Same as bloom_check().
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - filter not initialized
+ *    -2 - I/O error
+ *
+ */
+int bloom_disk_check(struct bloom_disk * disk, const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Add the given element to the filter. Same as bloom_add(). The modified
+ * page is written to the file when it is evicted from the pool or by
+ * bloom_disk_flush() or bloom_disk_close().
+ *
+ * Return:
+ * -------
+ *     0 - element was not present and was added
+ *     1 - element (or a collision) had already been added previously
+ *    -1 - filter not initialized or not writable
+ *    -2 - I/O error
+ *
+ */
+int bloom_disk_add(struct bloom_disk * disk, const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Check many elements. Same as calling bloom_disk_check() on each, but the
+ * elements are processed grouped by page, so every page is looked up (and
+ * read) once per call however many of the elements fall in it, and the
+ * kernel is asked to read ahead the pages the next elements need.
+ *
+ * Parameters:
+ * -----------
+ *     disk     - Pointer to an initialized struct bloom_disk.
+ *     elements - The elements, one per iovec.
+ *     count    - Number of elements.
+ *     results  - Receives the bloom_disk_check() result (0 or 1) of each
+ *                element, in the order of 'elements'.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *    -1 - filter not initialized
+ *    -2 - I/O error or out of memory (results are incomplete)
+ *
+ */
+int bloom_disk_check_batch(struct bloom_disk * disk,
+                           const struct iovec * elements,
+                           unsigned long int count, unsigned char * results);
+
+
+/** ***************************************************************************
+ * Add many elements. Same as calling bloom_disk_add() on each, processed
+ * grouped by page as in bloom_disk_check_batch(). Elements which fall in
+ * the same page are added in the order given.
+ *
+ * Parameters:
+ * -----------
+ *     disk     - Pointer to an initialized struct bloom_disk.
+ *     elements - The elements, one per iovec.
+ *     count    - Number of elements.
+ *     results  - If not NULL, receives the bloom_disk_add() result (0 or 1)
+ *                of each element, in the order of 'elements'.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *    -1 - filter not initialized or not writable
+ *    -2 - I/O error or out of memory (not all elements were added)
+ *
+ */
+int bloom_disk_add_batch(struct bloom_disk * disk,
+                         const struct iovec * elements,
+                         unsigned long int count, unsigned char * results);
+
+
+/** ***************************************************************************
+ * Write all modified pages to the file and wait for them to reach the
+ * disk (fsync).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_disk_flush(struct bloom_disk * disk);
+
+
+/** ***************************************************************************
+ * Flush (if writable) and close the filter, freeing the pool. Upon return,
+ * the struct is no longer usable.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - if flushing failed (the file may be missing some additions)
+ *
+ */
+int bloom_disk_close(struct bloom_disk * disk);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
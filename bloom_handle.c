@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_handle.h for documentation on the public interfaces.
+ *
+ * Readers register in one of two sets of counters, chosen by the parity
+ * of the epoch they saw, and then load the current filter. A publisher
+ * swaps the filter, increments the epoch and waits for the counters of the
+ * old parity to reach zero. A reader which registered under the old epoch
+ * but observes the increment before loading the filter backs out and
+ * retries, so any reader counted under the new parity is guaranteed to
+ * load the new filter. All accesses are sequentially consistent.
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "bloom_handle.h"
+
+// Reader counters are spread over this many cache lines (per parity) so
+// readers on different threads don't contend on one counter.
+#define STRIPES 16
+
+struct bloom_handle_readers
+{
+  unsigned long int count;
+  char pad[64 - sizeof(unsigned long int)];
+};
+
+static unsigned int next_stripe = 0;
+static __thread unsigned int my_stripe = 0;      // stripe + 1, 0 if not set
+
+
+static unsigned int stripe()
+{
+  if (my_stripe == 0) {
+    my_stripe = 1 + __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) %
+      STRIPES;
+  }
+  return my_stripe - 1;
+}
+
+
+int bloom_handle_init(struct bloom_handle * handle)
+{
+  memset(handle, 0, sizeof(struct bloom_handle));
+
+  size_t size = 2 * STRIPES * sizeof(struct bloom_handle_readers);
+  if (posix_memalign((void **)&handle->readers, 64, size)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+  memset(handle->readers, 0, size);
+
+  if (pthread_mutex_init(&handle->writer, NULL)) {           // LCOV_EXCL_START
+    free(handle->readers);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  handle->ready = 1;
+
+  return 0;
+}
+
+
+struct bloom * bloom_handle_acquire(struct bloom_handle * handle,
+                                    unsigned int * token)
+{
+  unsigned int s = stripe();
+  unsigned long int epoch;
+  unsigned long int * count;
+
+  while (1) {
+    epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+    count = &handle->readers[(epoch & 1) * STRIPES + s].count;
+    __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST) == epoch) {
+      break;
+    }
+    // A publisher moved on meanwhile and may not be waiting for us.
+    __atomic_fetch_sub(count, 1, __ATOMIC_SEQ_CST);
+  }
+
+  *token = (epoch & 1) * STRIPES + s;
+
+  return __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+}
+
+
+void bloom_handle_release(struct bloom_handle * handle, unsigned int token)
+{
+  __atomic_fetch_sub(&handle->readers[token].count, 1, __ATOMIC_SEQ_CST);
+}
+
+
+int bloom_handle_check(struct bloom_handle * handle,
+                       const void * buffer, int len)
+{
+  if (handle->ready == 0) {
+    printf("handle at %p not initialized!\n", (void *)handle);
+    return -1;
+  }
+
+  unsigned int token;
+  struct bloom * bloom = bloom_handle_acquire(handle, &token);
+  int rv = bloom ? bloom_check(bloom, buffer, len) : -1;
+  bloom_handle_release(handle, token);
+
+  return rv;
+}
+
+
+int bloom_handle_publish(struct bloom_handle * handle, struct bloom * bloom)
+{
+  if (handle->ready == 0) {
+    printf("handle at %p not initialized!\n", (void *)handle);
+    return -1;
+  }
+
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  struct bloom * copy = (struct bloom *)malloc(sizeof(struct bloom));
+  if (copy == NULL) {                                        // LCOV_EXCL_START
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+  memcpy(copy, bloom, sizeof(struct bloom));
+  memset(bloom, 0, sizeof(struct bloom));
+
+  pthread_mutex_lock(&handle->writer);
+
+  struct bloom * old =
+    __atomic_exchange_n(&handle->current, copy, __ATOMIC_SEQ_CST);
+  unsigned long int epoch =
+    __atomic_fetch_add(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+
+  struct bloom_handle_readers * readers =
+    handle->readers + (epoch & 1) * STRIPES;
+  unsigned int s;
+  for (s = 0; s < STRIPES; s++) {
+    while (__atomic_load_n(&readers[s].count, __ATOMIC_SEQ_CST) != 0) {
+      sched_yield();
+    }
+  }
+
+  pthread_mutex_unlock(&handle->writer);
+
+  if (old != NULL) {
+    bloom_free(old);
+    free(old);
+  }
+
+  return 0;
+}
+
+
+void bloom_handle_free(struct bloom_handle * handle)
+{
+  if (handle->ready) {
+    if (handle->current != NULL) {
+      bloom_free(handle->current);
+      free(handle->current);
+    }
+    free(handle->readers);
+    pthread_mutex_destroy(&handle->writer);
+  }
+  handle->ready = 0;
+}
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_HANDLE_H
+#define _BLOOM_HANDLE_H
+
+#include <pthread.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A handle to the current version of a filter which is replaced from time
+ * to time (for example, rebuilt in the background) while other threads
+ * keep checking elements against it.
+ *
+ * Readers never block and never take a lock: they announce themselves in
+ * a per-thread counter of the current epoch and read the current filter.
+ * Publishing a new filter swaps the pointer, advances the epoch and waits
+ * for the readers of the previous epoch to finish before freeing the
+ * previous filter. Only publishing (and bloom_handle_free()) ever waits.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_handle_init().
+ *
+ */
+struct bloom_handle
+{
+  // All fields are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  struct bloom * current;
+  unsigned long int epoch;
+  struct bloom_handle_readers * readers;
+  pthread_mutex_t writer;
+};
+
+
+/** ***************************************************************************
+ * Initialize a handle. Until the first bloom_handle_publish() it holds no
+ * filter.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_handle_init(struct bloom_handle * handle);
+
+
+/** ***************************************************************************
+ * Make 'bloom' the current filter of the handle.
+ *
+ * The handle takes over the filter: its contents are moved into the handle
+ * and *bloom is cleared (as if by bloom_free()), so the caller's struct may
+ * be reused right away. The previously current filter, if any, is freed
+ * once no reader can be using it any more, before this call returns.
+ *
+ * Concurrent calls are serialized.
+ *
+ * Parameters:
+ * -----------
+ *     handle - Pointer to an initialized struct bloom_handle.
+ *     bloom  - Pointer to an initialized filter.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (the filter was not taken over)
+ *    -1 - handle or bloom not initialized
+ *
+ */
+int bloom_handle_publish(struct bloom_handle * handle, struct bloom * bloom);
+
+
+/** ***************************************************************************
+ * Get the current filter for reading, for example to check a batch of
+ * elements against one consistent version. It remains valid until the
+ * matching bloom_handle_release(), which must be called by the same thread
+ * and soon: bloom_handle_publish() waits for it.
+ *
+ * The filter MUST NOT be modified (no bloom_add(), bloom_reset() etc.).
+ *
+ * Parameters:
+ * -----------
+ *     handle - Pointer to an initialized struct bloom_handle.
+ *     token  - Receives a value to pass to bloom_handle_release().
+ *
+ * Return:
+ * -------
+ *     The current filter, or NULL if none has been published yet (in which
+ *     case bloom_handle_release() must still be called).
+ *
+ */
+struct bloom * bloom_handle_acquire(struct bloom_handle * handle,
+                                    unsigned int * token);
+
+
+/** ***************************************************************************
+ * Finish using a filter obtained from bloom_handle_acquire().
+ *
+ */
+void bloom_handle_release(struct bloom_handle * handle, unsigned int token);
+
+
+/** ***************************************************************************
+ * Check if the given element is in the current filter of the handle.
+ * Same as bloom_check() on the filter returned by bloom_handle_acquire().
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - handle not initialized or no filter published yet
+ *
+ */
+int bloom_handle_check(struct bloom_handle * handle,
+                       const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Free the handle and its current filter. There must be no concurrent
+ * readers or writers. Upon return, the handle is no longer usable.
+ *
+ */
+void bloom_handle_free(struct bloom_handle * handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_iblt.h for documentation on the public interfaces.
+ *
+ * The table is split into IBLT_HASHES equal parts and every key goes into
+ * one cell of each part, so its cells are always distinct. A cell is pure
+ * (holds exactly one key, inserted or removed) if its count is 1 or -1
+ * and its hash sum is the check hash of its key sum. Decoding repeatedly
+ * takes a key out of a pure cell and removes it from its other cells,
+ * which may make those pure in turn.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_iblt.h"
+#include "bloom_internal.h"
+#include "murmurhash2.h"
+
+#define IBLT_MAGIC "libbloomiblt1"
+
+// Number of cells each key goes into.
+#define IBLT_HASHES 4
+
+// Salt of the check hash, to keep it independent of the cell positions.
+#define IBLT_CHECK 0x2545f4914f6cdd1dull
+
+struct bloom_iblt_cell
+{
+  int64_t count;
+  uint64_t key;
+  uint64_t hash;
+};
+
+
+static unsigned long int cell_of(const struct bloom_iblt * iblt,
+                                 uint64_t key, unsigned int i)
+{
+  unsigned long int part = iblt->cells / IBLT_HASHES;
+  uint64_t h = bloom_mix64(key + i * 0x9e3779b97f4a7c15ull);
+
+  return i * part + h % part;
+}
+
+
+static void update(struct bloom_iblt * iblt, uint64_t key, int64_t count)
+{
+  uint64_t check = bloom_mix64(key ^ IBLT_CHECK);
+  unsigned int i;
+
+  for (i = 0; i < IBLT_HASHES; i++) {
+    struct bloom_iblt_cell * cell = &iblt->table[cell_of(iblt, key, i)];
+    cell->count += count;
+    cell->key ^= key;
+    cell->hash ^= check;
+  }
+}
+
+
+static int pure(const struct bloom_iblt_cell * cell)
+{
+  return (cell->count == 1 || cell->count == -1) &&
+    cell->hash == bloom_mix64(cell->key ^ IBLT_CHECK);
+}
+
+
+/*
+ * Number of cells of a table for 'differences', or 0 if that many are not
+ * supported.
+ *
+ */
+static unsigned long int cells_for(unsigned long int differences)
+{
+  if (differences < 1 || differences > (1ul << 40)) {
+    return 0;
+  }
+
+  // With four cells per key, about 1.3 cells per key suffice for large
+  // tables. The margin keeps failures rare, particularly in small ones
+  // (a few in a thousand at worst, around 10 to 50 differences).
+  unsigned long int cells = differences + differences / 2 + 40;
+  return (cells + IBLT_HASHES - 1) / IBLT_HASHES * IBLT_HASHES;
+}
+
+
+int bloom_iblt_init(struct bloom_iblt * iblt, unsigned long int differences)
+{
+  memset(iblt, 0, sizeof(struct bloom_iblt));
+
+  iblt->cells = cells_for(differences);
+  if (iblt->cells == 0) {
+    return 1;
+  }
+
+  iblt->differences = differences;
+  iblt->hashes = IBLT_HASHES;
+  iblt->major = BLOOM_VERSION_MAJOR;
+  iblt->minor = BLOOM_VERSION_MINOR;
+
+  iblt->table = (struct bloom_iblt_cell *)
+    calloc(iblt->cells, sizeof(struct bloom_iblt_cell));
+  if (iblt->table == NULL) {                                 // LCOV_EXCL_START
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  iblt->ready = 1;
+
+  return 0;
+}
+
+
+uint64_t bloom_iblt_key(const void * buffer, int len)
+{
+  return murmurhash64a(buffer, len, BLOOM_SEED);
+}
+
+
+int bloom_iblt_insert(struct bloom_iblt * iblt, uint64_t key)
+{
+  if (!bloom_struct_ready(iblt, iblt->ready, "bloom_iblt")) {
+    return -1;
+  }
+
+  update(iblt, key, 1);
+
+  return 0;
+}
+
+
+int bloom_iblt_remove(struct bloom_iblt * iblt, uint64_t key)
+{
+  if (!bloom_struct_ready(iblt, iblt->ready, "bloom_iblt")) {
+    return -1;
+  }
+
+  update(iblt, key, -1);
+
+  return 0;
+}
+
+
+int bloom_iblt_subtract(struct bloom_iblt * dest,
+                        const struct bloom_iblt * src)
+{
+  if (!bloom_struct_ready(dest, dest->ready, "bloom_iblt") ||
+      !bloom_struct_ready(src, src->ready, "bloom_iblt")) {
+    return -1;
+  }
+
+  if (dest->cells != src->cells || dest->hashes != src->hashes ||
+      dest->major != src->major) {
+    return 1;
+  }
+
+  unsigned long int c;
+  for (c = 0; c < dest->cells; c++) {
+    dest->table[c].count -= src->table[c].count;
+    dest->table[c].key ^= src->table[c].key;
+    dest->table[c].hash ^= src->table[c].hash;
+  }
+
+  return 0;
+}
+
+
+int bloom_iblt_decode(struct bloom_iblt * iblt,
+                      uint64_t * inserted, unsigned long int * ninserted,
+                      uint64_t * removed, unsigned long int * nremoved,
+                      unsigned long int max)
+{
+  if (!bloom_struct_ready(iblt, iblt->ready, "bloom_iblt")) {
+    return -1;
+  }
+
+  *ninserted = 0;
+  *nremoved = 0;
+
+  // Cells to look at, which may have become pure. Every cell is queued
+  // once up front and again whenever a key is taken out of it.
+  unsigned long int size = iblt->cells;
+  unsigned long int * queue =
+    (unsigned long int *)malloc(size * sizeof(unsigned long int));
+  if (queue == NULL) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  unsigned long int top = 0;
+  unsigned long int c;
+  for (c = 0; c < iblt->cells; c++) {
+    if (pure(&iblt->table[c])) {
+      queue[top++] = c;
+    }
+  }
+
+  int rv = 0;
+
+  while (top > 0 && rv == 0) {
+    struct bloom_iblt_cell * cell = &iblt->table[queue[--top]];
+    if (!pure(cell)) {
+      continue;
+    }
+
+    uint64_t key = cell->key;
+    int64_t count = cell->count;
+
+    if (count > 0) {
+      if (*ninserted == max) { rv = 2; break; }
+      inserted[(*ninserted)++] = key;
+    } else {
+      if (*nremoved == max) { rv = 2; break; }
+      removed[(*nremoved)++] = key;
+    }
+
+    update(iblt, key, -count);
+
+    unsigned int i;
+    for (i = 0; i < IBLT_HASHES; i++) {
+      c = cell_of(iblt, key, i);
+      if (pure(&iblt->table[c])) {
+        if (top == size) {
+          size *= 2;
+          unsigned long int * bigger = (unsigned long int *)
+            realloc(queue, size * sizeof(unsigned long int));
+          if (bigger == NULL) {                              // LCOV_EXCL_START
+            rv = 1;
+            break;
+          }                                                  // LCOV_EXCL_STOP
+          queue = bigger;
+        }
+        queue[top++] = c;
+      }
+    }
+  }
+
+  free(queue);
+
+  if (rv) {
+    return rv;
+  }
+
+  for (c = 0; c < iblt->cells; c++) {
+    struct bloom_iblt_cell * cell = &iblt->table[c];
+    if (cell->count || cell->key || cell->hash) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+int bloom_iblt_save(struct bloom_iblt * iblt, char * filename)
+{
+  if (filename == NULL || filename[0] == 0 || !iblt->ready) {
+    return 1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return 1;
+  }
+
+  int rv = bloom_write_blob_header(fd, IBLT_MAGIC, iblt,
+                                   sizeof(struct bloom_iblt)) ||
+    bloom_write_full(fd, iblt->table,
+                     iblt->cells * sizeof(struct bloom_iblt_cell));
+
+  close(fd);
+  return rv;
+}
+
+
+int bloom_iblt_load(struct bloom_iblt * iblt, char * filename)
+{
+  int rv = 0;
+
+  if (filename == NULL || filename[0] == 0) { return 1; }
+  if (iblt == NULL) { return 2; }
+
+  memset(iblt, 0, sizeof(struct bloom_iblt));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) { return 3; }
+
+  rv = bloom_read_blob_header(fd, IBLT_MAGIC, iblt,
+                              sizeof(struct bloom_iblt));
+  if (rv) { goto done; }
+
+  iblt->ready = 0;
+  iblt->table = NULL;
+  if (iblt->major != BLOOM_VERSION_MAJOR) { rv = 9; goto done; }
+  // The cells must be those bloom_iblt_init() makes for 'differences'
+  // (cell_of() divides by a quarter of them).
+  if (iblt->hashes != IBLT_HASHES ||
+      iblt->cells == 0 || iblt->cells != cells_for(iblt->differences)) {
+    rv = 12;
+    goto done;
+  }
+
+  size_t bytes = iblt->cells * sizeof(struct bloom_iblt_cell);
+  iblt->table = (struct bloom_iblt_cell *)malloc(bytes);
+  if (iblt->table == NULL) { rv = 10; goto done; }           // LCOV_EXCL_LINE
+
+  if (bloom_read_full(fd, iblt->table, bytes)) {
+    free(iblt->table);
+    iblt->table = NULL;
+    rv = 11;
+    goto done;
+  }
+
+  iblt->ready = 1;
+
+ done:
+  close(fd);
+  return rv;
+}
+
+
+void bloom_iblt_free(struct bloom_iblt * iblt)
+{
+  if (iblt->ready) {
+    free(iblt->table);
+  }
+  iblt->ready = 0;
+}
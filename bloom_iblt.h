@@ -0,0 +1,189 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_IBLT_H
+#define _BLOOM_IBLT_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * An invertible bloom lookup table (IBLT), for finding the difference of
+ * two large sets by exchanging data in proportion to the size of the
+ * difference only.
+ *
+ * Like a counting bloom filter, every element updates a few cells, each
+ * holding the number of elements in it and the XOR of their keys and of
+ * a check hash of their keys. Two tables with the same parameters can be
+ * subtracted, which cancels out the elements common to both. What is left
+ * can be decoded back into the keys present on only one side, as long as
+ * there are not many more of them than the table was sized for.
+ *
+ * A typical exchange: two nodes each build a table of their own set, one
+ * sends its table (bloom_iblt_save()) to the other, which subtracts it
+ * from its own and decodes the difference.
+ *
+ * Keys are 64-bit values. Elements of other types are added as their
+ * 64-bit hash (see bloom_iblt_key()), and decoding then returns those
+ * hashes, which the caller maps back to its elements.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_iblt_init() or bloom_iblt_load().
+ *
+ */
+struct bloom_iblt
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  unsigned long int differences;
+  unsigned long int cells;
+  unsigned int hashes;
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  unsigned char major;
+  unsigned char minor;
+  struct bloom_iblt_cell * table;
+};
+
+
+/** ***************************************************************************
+ * Initialize an empty table.
+ *
+ * Parameters:
+ * -----------
+ *     iblt        - Pointer to an allocated struct bloom_iblt (see above).
+ *     differences - Number of differing keys the table needs to decode.
+ *                   Decoding nearly always succeeds up to this number
+ *                   (a failed exchange can be retried with a larger
+ *                   table), and fails more and more often above it. The
+ *                   table takes about 36 bytes per difference (more for
+ *                   small numbers).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_iblt_init(struct bloom_iblt * iblt, unsigned long int differences);
+
+
+/** ***************************************************************************
+ * Return the 64-bit key for an element: the MurmurHash64A hash bloom
+ * filters created with BLOOM_HASH64 use.
+ *
+ */
+uint64_t bloom_iblt_key(const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Insert or remove a key. Removing a key which was never inserted is
+ * allowed: it shows up as a removed key when decoding.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *    -1 - table not initialized
+ *
+ */
+int bloom_iblt_insert(struct bloom_iblt * iblt, uint64_t key);
+int bloom_iblt_remove(struct bloom_iblt * iblt, uint64_t key);
+
+
+/** ***************************************************************************
+ * Subtract 'src' from 'dest': afterwards 'dest' holds the keys inserted
+ * in 'dest' but not 'src' as inserted, and those in 'src' but not 'dest'
+ * as removed. 'src' is not modified.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - tables have different parameters
+ *    -1 - table not initialized
+ *
+ */
+int bloom_iblt_subtract(struct bloom_iblt * dest,
+                        const struct bloom_iblt * src);
+
+
+/** ***************************************************************************
+ * Decode the keys of the table, typically the difference of two tables
+ * (see bloom_iblt_subtract()). Decoding empties the table of the keys it
+ * recovers.
+ *
+ * Parameters:
+ * -----------
+ *     iblt     - Pointer to an initialized struct bloom_iblt.
+ *     inserted - Receives the inserted keys (those only in 'dest').
+ *     ninserted - Receives the number of keys stored in 'inserted'.
+ *     removed  - Receives the removed keys (those only in 'src').
+ *     nremoved - Receives the number of keys stored in 'removed'.
+ *     max      - Room in each of 'inserted' and 'removed', in keys.
+ *
+ * Return:
+ * -------
+ *     0 - on success, all keys were recovered
+ *     1 - could not recover all keys (there were too many), the keys
+ *         returned are correct but incomplete
+ *     2 - more than 'max' keys on one side, the keys returned are correct
+ *         but incomplete
+ *    -1 - table not initialized
+ *
+ */
+int bloom_iblt_decode(struct bloom_iblt * iblt,
+                      uint64_t * inserted, unsigned long int * ninserted,
+                      uint64_t * removed, unsigned long int * nremoved,
+                      unsigned long int max);
+
+
+/** ***************************************************************************
+ * Save a table to a file, created (or overwritten). The file is about
+ * 'cells' * 24 bytes.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_iblt_save(struct bloom_iblt * iblt, char * filename);
+
+
+/** ***************************************************************************
+ * Load a table saved with bloom_iblt_save(). The struct is initialized by
+ * this call; it must not be initialized already.
+ *
+ * Return:
+ * -------
+ *     0   - on success
+ *     > 0 - on failure
+ *
+ */
+int bloom_iblt_load(struct bloom_iblt * iblt, char * filename);
+
+
+/** ***************************************************************************
+ * Deallocate internal storage. Upon return, the table is no longer usable.
+ *
+ */
+void bloom_iblt_free(struct bloom_iblt * iblt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
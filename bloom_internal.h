@@ -0,0 +1,322 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Interfaces shared between the source files of libbloom itself.
+ *
+ * None of this is part of the public interface. It is not installed and
+ * client code MUST NOT include it or rely on anything declared here.
+ */
+
+#ifndef _BLOOM_INTERNAL_H
+#define _BLOOM_INTERNAL_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "bloom.h"
+
+
+// Seed of the first (or only) murmur hash of an element.
+#define BLOOM_SEED 0x9747b28c
+
+// AVX2 code paths are compiled in on x86-64 and used if the CPU has AVX2,
+// see bloom_have_avx2().
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BLOOM_AVX2 1
+#endif
+
+
+/*
+ * Hash material for one element. The bit positions probed for the element
+ * are derived from this, see bloom_nth_bit().
+ *
+ */
+struct bloom_hash
+{
+  uint64_t a;
+  uint64_t b;
+};
+
+
+/*
+ * Compute the hash material of 'buffer' for a filter shaped like 'bloom'.
+ *
+ */
+void bloom_hash_buffer(const struct bloom * bloom,
+                       const void * buffer, int len, struct bloom_hash * hash);
+
+
+/*
+ * Compute the hash material of the concatenation of the 'iovcnt' buffers
+ * in 'iov'. Identical to bloom_hash_buffer() of the same bytes when they
+ * are contiguous.
+ *
+ */
+void bloom_hash_iov(const struct bloom * bloom,
+                    const struct iovec * iov, int iovcnt,
+                    struct bloom_hash * hash);
+
+
+/*
+ * All the flags bloom_init3() accepts.
+ *
+ */
+#define BLOOM_FLAGS_KNOWN \
+  (BLOOM_HASH64 | BLOOM_POW2 | BLOOM_ENHANCED | BLOOM_PAGED)
+
+
+/*
+ * Major version in saved files of filters with flags or more than 2^32 - 1
+ * entries, see bloom_write_header(). Files of other filters are unchanged
+ * from version 2.0.
+ *
+ */
+#define BLOOM_FLAGS_MAJOR 3
+
+
+/*
+ * Size of the pages of a BLOOM_PAGED filter, in bytes and in bits.
+ *
+ */
+#define BLOOM_PAGE_BYTES 4096ul
+#define BLOOM_PAGE_BITS (8 * BLOOM_PAGE_BYTES)
+
+
+/*
+ * Finalization mix of MurmurHash3, a bijection on 64-bit values.
+ *
+ */
+static inline uint64_t bloom_mix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+
+/*
+ * Expand a 64-bit element hash into hash material for 'bloom'.
+ *
+ */
+static inline void bloom_hash_fp(const struct bloom * bloom, uint64_t fp,
+                                 struct bloom_hash * hash)
+{
+  if (bloom->flags & BLOOM_HASH64) {
+    hash->a = fp;
+    hash->b = bloom_mix64(fp) | 1;
+  } else {
+    hash->a = (uint32_t)fp;
+    hash->b = fp >> 32;
+  }
+}
+
+
+/*
+ * Return the i'th (0 <= i < bloom->hashes) bit position for the element
+ * whose hash material is 'hash'.
+ *
+ */
+static inline unsigned long int bloom_nth_bit(const struct bloom * bloom,
+                                              const struct bloom_hash * hash,
+                                              unsigned long int i)
+{
+  uint64_t x;
+
+  if (bloom->flags & BLOOM_PAGED) {
+    // The page comes from a, the positions within it are 16 bit slices of
+    // mixes of b, four per mix. (Positions stepping through a page this
+    // small, as double hashing does, give a measurably higher error rate
+    // than independent ones.)
+    uint64_t page = hash->a % (bloom->bits / BLOOM_PAGE_BITS);
+    x = bloom_mix64(hash->b + (i / 4 + 1) * 0x9e3779b97f4a7c15ull);
+    x >>= 16 * (i % 4);
+    return page * BLOOM_PAGE_BITS + (x & (BLOOM_PAGE_BITS - 1));
+  }
+
+  if (bloom->flags & BLOOM_ENHANCED) {
+    x = hash->a + hash->b * i + (i - 1) * i * (i + 1) / 6;
+  } else if (bloom->flags & BLOOM_POW2) {
+    // With an odd step the positions stay distinct under any mask, which
+    // bloom_fold() relies on.
+    x = hash->a + (hash->b | 1) * i;
+  } else {
+    x = hash->a + hash->b * i;
+  }
+
+  if (bloom->flags & BLOOM_POW2) {
+    return x & (bloom->bits - 1);
+  }
+
+  return x % bloom->bits;
+}
+
+
+/*
+ * Return whether 'bit' is set in 'buf', also setting it if 'set_bit'.
+ *
+ */
+static inline int test_bit_set_bit(unsigned char * buf,
+                                   unsigned long int bit, int set_bit)
+{
+  unsigned long int byte = bit >> 3;
+  unsigned char c = buf[byte];        // expensive memory access
+  unsigned char mask = 1 << (bit % 8ul);
+
+  if (c & mask) {
+    return 1;
+  } else {
+    if (set_bit) {
+      buf[byte] = c | mask;
+    }
+    return 0;
+  }
+}
+
+
+#ifdef BLOOM_AVX2
+/*
+ * Return whether the CPU supports AVX2.
+ *
+ */
+static inline int bloom_have_avx2()
+{
+  static int avx2 = -1;
+
+  if (avx2 < 0) {
+    avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+
+  return avx2;
+}
+#endif
+
+
+/*
+ * Fill in the sizing fields of 'bloom' (as bloom_init2() would) without
+ * allocating the bit field. Returns 0 on success, 1 on invalid parameters.
+ *
+ */
+int bloom_shape(struct bloom * bloom, unsigned long int entries, double error);
+
+
+/*
+ * Fill in the sizing fields of 'bloom' as bloom_init3() would, without
+ * allocating the bit field. Returns 0 on success, 1 on invalid parameters.
+ *
+ */
+int bloom_shape3(struct bloom * bloom, unsigned long int entries,
+                 double error, unsigned int flags);
+
+
+/*
+ * bloom_check() (or bloom_add(), if 'add') of the element whose hash
+ * material is 'hash'.
+ *
+ */
+int bloom_check_add_hash(struct bloom * bloom,
+                         const struct bloom_hash * hash, int add);
+
+
+/*
+ * read() or write() all of 'len' bytes, which a single call need not do
+ * (on Linux, no single call transfers more than about 2GB). Return 0 on
+ * success, 1 on failure or end of file.
+ *
+ */
+int bloom_read_full(int fd, void * buf, size_t len);
+int bloom_write_full(int fd, const void * buf, size_t len);
+
+
+/*
+ * Write the header of a saved filter (see bloom_save()) for 'bloom',
+ * leaving 'fd' positioned where the bit field goes. Returns 0 on success,
+ * 1 on failure.
+ *
+ */
+int bloom_write_header(int fd, const struct bloom * bloom);
+
+
+/*
+ * Read and validate the header of a saved filter into 'bloom' (with 'bf'
+ * set to NULL), leaving 'fd' positioned at the start of the bit field.
+ * Returns 0 or one of the bloom_load() error codes.
+ *
+ */
+int bloom_read_header(int fd, struct bloom * bloom);
+
+
+/*
+ * Files saved by the other structures of the library start with their own
+ * 'magic', the uint16_t 'size' of the struct and the struct itself (with
+ * its pointers, which loads replace), followed by their data.
+ *
+ * bloom_write_blob_header() writes that header for 'blob', returning 0 on
+ * success, 1 on failure. bloom_read_blob_header() reads it into 'blob',
+ * leaving 'fd' positioned at the data, and returns 0 or one of the
+ * bloom_load() error codes 4 to 8. The struct read is not validated.
+ *
+ */
+int bloom_write_blob_header(int fd, const char * magic, const void * blob,
+                            uint16_t size);
+int bloom_read_blob_header(int fd, const char * magic, void * blob,
+                           uint16_t size);
+
+
+/*
+ * Return 1 if 'ready', otherwise print that the struct 'p' (of type 'name')
+ * is not initialized and return 0.
+ *
+ */
+int bloom_struct_ready(const void * p, unsigned char ready, const char * name);
+
+
+/*
+ * Return the offset of the bit field in a file saved from 'bloom'. The
+ * bit field of a BLOOM_PAGED filter starts at the first page boundary, so
+ * its pages can be read with one aligned read each. Version 2.0 would read
+ * the padding as bits, it is kept from loading such files by their major
+ * version (see BLOOM_FLAGS_MAJOR).
+ *
+ */
+size_t bloom_bf_offset(const struct bloom * bloom);
+
+
+/*
+ * The started trace, if any (see bloom_trace.h).
+ *
+ */
+struct bloom_trace;
+extern struct bloom_trace * bloom_tracer;
+
+static inline int bloom_tracing()
+{
+  return __builtin_expect(
+    __atomic_load_n(&bloom_tracer, __ATOMIC_ACQUIRE) != NULL, 0);
+}
+
+
+/*
+ * Record (if sampled) a bloom_check() or bloom_add() of the element in
+ * 'iov' which returned 'result', into the started trace.
+ *
+ */
+void bloom_trace_record(const struct iovec * iov, int iovcnt, int add,
+                        int result);
+
+
+/*
+ * Return 0 if filters 'a' and 'b' have identical parameters (and thus
+ * identical bit layouts), 1 otherwise. Does not look at 'ready'.
+ *
+ */
+int bloom_compatible(const struct bloom * a, const struct bloom * b);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom.h for documentation on the public interfaces.
+ *
+ * The hash of a window s[0..k-1] is the polynomial
+ *
+ *     fwd = T[s[0]] * B^(k-1) + T[s[1]] * B^(k-2) + ... + T[s[k-1]]
+ *
+ * (mod 2^64) over a table T of random 64 bit values, which rolls to the
+ * next window in O(1): subtract the leaving byte, multiply by B, add the
+ * entering byte. The hash of the reverse complement of the window,
+ *
+ *     rc = T[c(s[0])] + T[c(s[1])] * B + ... + T[c(s[k-1])] * B^(k-1)
+ *
+ * rolls the other way, which is a multiplication by the inverse of B (B
+ * is odd, so it has one mod 2^64).
+ *
+ * Cyclic polynomial hashes (buzhash, ntHash) rotate instead of multiply,
+ * which is slightly cheaper but makes equal bytes 64 positions apart in a
+ * window cancel out. Multiplying works for any k.
+ *
+ * The polynomial value is mixed into the 64-bit element hash which
+ * bloom_hash_fp() expands into the bit positions.
+ *
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+
+// Odd multiplier of the polynomial.
+#define KMER_B 0x9e3779b97f4a7c15ull
+
+// Hashes are computed, and their first bits prefetched, this many at a time.
+#define KMER_GROUP 16
+
+static uint64_t table[256];
+static uint64_t complement[256];
+static uint64_t inverse;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+
+static void init_tables()
+{
+  static const char * pairs = "ATTAattaCGGCcggc";
+  unsigned int c;
+
+  for (c = 0; c < 256; c++) {
+    table[c] = bloom_mix64((c + 1) * KMER_B);
+  }
+
+  // Complement of every byte; bytes other than ACGT (in either case) are
+  // their own complement.
+  for (c = 0; c < 256; c++) {
+    complement[c] = table[c];
+  }
+  for (c = 0; pairs[c]; c += 2) {
+    complement[(unsigned char)pairs[c]] = table[(unsigned char)pairs[c + 1]];
+  }
+
+  // Newton's iteration doubles the correct low bits of the inverse each
+  // round, starting from 3 (B * B = 1 mod 8 for any odd B).
+  inverse = KMER_B;
+  for (c = 0; c < 5; c++) {
+    inverse *= 2 - KMER_B * inverse;
+  }
+}
+
+
+static long int check_add_kmers(struct bloom * bloom, const void * buffer,
+                                unsigned long int len, unsigned int k,
+                                unsigned int flags, unsigned char * results,
+                                int add)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  if (k < 1) {
+    return -1;
+  }
+
+  if (len < k) {
+    return 0;
+  }
+
+  pthread_once(&table_once, init_tables);
+
+  const unsigned char * s = (const unsigned char *)buffer;
+  int canonical = flags & BLOOM_KMER_CANONICAL;
+  unsigned long int windows = len - k + 1;
+  uint64_t top = 1;                     // B^(k-1)
+  uint64_t fwd = 0;
+  uint64_t rc = 0;
+  unsigned long int i;
+  long int found = 0;
+
+  for (i = 0; i < k; i++) {
+    fwd = fwd * KMER_B + table[s[i]];
+    rc += complement[s[i]] * top;
+    if (i + 1 < k) {
+      top *= KMER_B;
+    }
+  }
+
+  struct bloom_hash hash[KMER_GROUP];
+  unsigned long int n;
+  unsigned int g;
+
+  for (n = 0; n < windows; n += KMER_GROUP) {
+    unsigned int c = windows - n < KMER_GROUP ? windows - n : KMER_GROUP;
+
+    for (g = 0; g < c; g++) {
+      i = n + g;
+      if (i > 0) {
+        fwd = (fwd - table[s[i - 1]] * top) * KMER_B + table[s[i + k - 1]];
+        if (canonical) {
+          rc = (rc - complement[s[i - 1]]) * inverse +
+            complement[s[i + k - 1]] * top;
+        }
+      }
+      uint64_t h = canonical && rc < fwd ? rc : fwd;
+      bloom_hash_fp(bloom, bloom_mix64(h), &hash[g]);
+      unsigned long int first = bloom_nth_bit(bloom, &hash[g], 0);
+      __builtin_prefetch(bloom->bf + (first >> 3));
+    }
+
+    for (g = 0; g < c; g++) {
+      int rv = bloom_check_add_hash(bloom, &hash[g], add);
+      found += rv;
+      if (results) {
+        results[n + g] = (unsigned char)rv;
+      }
+    }
+  }
+
+  return found;
+}
+
+
+long int bloom_check_kmers(struct bloom * bloom, const void * buffer,
+                           unsigned long int len, unsigned int k,
+                           unsigned int flags, unsigned char * results)
+{
+  return check_add_kmers(bloom, buffer, len, k, flags, results, 0);
+}
+
+
+long int bloom_add_kmers(struct bloom * bloom, const void * buffer,
+                         unsigned long int len, unsigned int k,
+                         unsigned int flags, unsigned char * results)
+{
+  return check_add_kmers(bloom, buffer, len, k, flags, results, 1);
+}
@@ -0,0 +1,316 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_pool.h for documentation on the public interfaces.
+ *
+ * A slot is a struct bloom (padded to a cache line) followed by the bit
+ * field. Slot sizes are rounded up to a size class: multiples of 16 bytes
+ * up to 4KB, then eight classes per power of two. A filter's class follows
+ * from its 'bytes', so releasing a filter needs no other bookkeeping.
+ *
+ * Every class allocates its slots from its own arenas, in order, and keeps
+ * released slots on a free list linked through their (unused) bit fields.
+ * Filters too large to share an arena sensibly get an arena of their own.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+#include "bloom_pool.h"
+
+#define POOL_MAGIC "libbloompool1"
+
+#define POOL_ALIGN 64ul
+#define POOL_HEADER \
+  ((sizeof(struct bloom) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+// Granularity of the small classes.
+#define POOL_QUANTUM 16ul
+
+// Arenas are this large, unless a single slot is more than an eighth of it.
+#define POOL_ARENA_BYTES (1ul << 20)
+
+// 256 classes up to 4KB, then 8 per power of two up to 2^64.
+#define POOL_SMALL 4096ul
+#define POOL_CLASSES (256 + 52 * 8)
+
+// Buffer of bloom_pool_save() and bloom_pool_load().
+#define POOL_IO_BYTES (1ul << 20)
+
+struct bloom_pool_arena
+{
+  struct bloom_pool_arena * next;
+};
+
+struct bloom_pool_class
+{
+  unsigned char * next;                 // next unused slot of current arena
+  unsigned char * end;                  // end of current arena
+  void * free;                          // released slots
+};
+
+
+/*
+ * Return the class of a slot of at least 'slot' bytes, and its size in
+ * 'size'.
+ *
+ */
+static unsigned int class_of(unsigned long int slot, unsigned long int * size)
+{
+  slot = (slot + POOL_QUANTUM - 1) & ~(POOL_QUANTUM - 1);
+
+  if (slot <= POOL_SMALL) {
+    *size = slot;
+    return slot / POOL_QUANTUM - 1;
+  }
+
+  // slot is in (2^p, 2^(p+1)], split into 8 steps of 2^(p-3).
+  unsigned int p = 63 - __builtin_clzl(slot - 1);
+  unsigned long int step = 1ul << (p - 3);
+  unsigned long int steps = (slot + step - 1) / step;
+
+  *size = steps * step;
+  return 256 + (p - 12) * 8 + (steps - 9);
+}
+
+
+static unsigned char * alloc_slot(struct bloom_pool * pool,
+                                  unsigned long int bytes)
+{
+  unsigned long int size;
+  struct bloom_pool_class * class =
+    &pool->classes[class_of(POOL_HEADER + bytes, &size)];
+
+  if (class->free != NULL) {
+    unsigned char * slot = (unsigned char *)class->free;
+    class->free = *(void **)(slot + POOL_HEADER);
+    return slot;
+  }
+
+  if (class->next == class->end) {
+    unsigned long int arena_bytes = POOL_ARENA_BYTES;
+    if (size > POOL_ARENA_BYTES / 8) {
+      arena_bytes = POOL_ALIGN + size;
+    }
+
+    void * mem;
+    if (posix_memalign(&mem, POOL_ALIGN, arena_bytes)) {
+      return NULL;                                           // LCOV_EXCL_LINE
+    }
+
+    struct bloom_pool_arena * arena = (struct bloom_pool_arena *)mem;
+    arena->next = pool->arenas;
+    pool->arenas = arena;
+    pool->bytes += arena_bytes;
+
+    class->next = (unsigned char *)mem + POOL_ALIGN;
+    class->end = class->next +
+      (arena_bytes - POOL_ALIGN) / size * size;
+  }
+
+  unsigned char * slot = class->next;
+  class->next += size;
+
+  return slot;
+}
+
+
+int bloom_pool_init(struct bloom_pool * pool)
+{
+  memset(pool, 0, sizeof(struct bloom_pool));
+
+  pool->classes = (struct bloom_pool_class *)
+    calloc(POOL_CLASSES, sizeof(struct bloom_pool_class));
+  if (pool->classes == NULL) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  pool->ready = 1;
+
+  return 0;
+}
+
+
+struct bloom * bloom_pool_alloc(struct bloom_pool * pool,
+                                unsigned long int entries, double error,
+                                unsigned int flags)
+{
+  struct bloom shape;
+
+  if (!bloom_struct_ready(pool, pool->ready, "bloom_pool") ||
+      bloom_shape3(&shape, entries, error, flags)) {
+    return NULL;
+  }
+
+  unsigned char * slot = alloc_slot(pool, shape.bytes);
+  if (slot == NULL) {
+    return NULL;                                             // LCOV_EXCL_LINE
+  }
+
+  struct bloom * bloom = (struct bloom *)slot;
+  memcpy(bloom, &shape, sizeof(struct bloom));
+  bloom->bf = slot + POOL_HEADER;
+  memset(bloom->bf, 0, bloom->bytes);
+  bloom->ready = 1;
+  pool->filters++;
+
+  return bloom;
+}
+
+
+void bloom_pool_release(struct bloom_pool * pool, struct bloom * bloom)
+{
+  if (!pool->ready || bloom == NULL || !bloom->ready) {
+    return;
+  }
+
+  unsigned long int size;
+  struct bloom_pool_class * class =
+    &pool->classes[class_of(POOL_HEADER + bloom->bytes, &size)];
+
+  bloom->ready = 0;
+  *(void **)bloom->bf = class->free;
+  class->free = bloom;
+  pool->filters--;
+}
+
+
+int bloom_pool_save(struct bloom_pool * pool, char * filename,
+                    struct bloom ** blooms, unsigned long int count)
+{
+  if (filename == NULL || filename[0] == 0 || !pool->ready) {
+    return 1;
+  }
+
+  FILE * fp = fopen(filename, "w");
+  if (fp == NULL) {
+    return 1;
+  }
+
+  setvbuf(fp, NULL, _IOFBF, POOL_IO_BYTES);
+
+  struct bloom none;
+  memset(&none, 0, sizeof(struct bloom));
+
+  uint16_t size = sizeof(struct bloom);
+  uint64_t n = count;
+  int rv = fwrite(POOL_MAGIC, strlen(POOL_MAGIC), 1, fp) != 1 ||
+    fwrite(&size, sizeof(uint16_t), 1, fp) != 1 ||
+    fwrite(&n, sizeof(uint64_t), 1, fp) != 1;
+
+  for (n = 0; n < count && rv == 0; n++) {
+    struct bloom * bloom = blooms[n];
+    if (bloom == NULL || !bloom->ready) {
+      rv = fwrite(&none, sizeof(struct bloom), 1, fp) != 1;
+    } else {
+      rv = fwrite(bloom, sizeof(struct bloom), 1, fp) != 1 ||
+        fwrite(bloom->bf, bloom->bytes, 1, fp) != 1;
+    }
+  }
+
+  if (fclose(fp)) {
+    rv = 1;                                                  // LCOV_EXCL_LINE
+  }
+
+  return rv;
+}
+
+
+int bloom_pool_load(struct bloom_pool * pool, char * filename,
+                    struct bloom ** blooms, unsigned long int * count)
+{
+  char line[30];
+  uint16_t size;
+  uint64_t saved;
+  unsigned long int n = 0;
+  int rv = 0;
+
+  if (filename == NULL || filename[0] == 0) { return 1; }
+  if (!bloom_struct_ready(pool, pool->ready, "bloom_pool")) { return 2; }
+
+  FILE * fp = fopen(filename, "r");
+  if (fp == NULL) { return 3; }
+
+  setvbuf(fp, NULL, _IOFBF, POOL_IO_BYTES);
+
+  memset(line, 0, 30);
+  if (fread(line, strlen(POOL_MAGIC), 1, fp) != 1) { rv = 4; goto done; }
+  if (strcmp(line, POOL_MAGIC)) { rv = 5; goto done; }
+  if (fread(&size, sizeof(uint16_t), 1, fp) != 1) { rv = 6; goto done; }
+  if (size != sizeof(struct bloom)) { rv = 7; goto done; }
+  if (fread(&saved, sizeof(uint64_t), 1, fp) != 1) { rv = 8; goto done; }
+  if (saved > *count) { rv = 13; goto done; }
+
+  for (n = 0; n < saved; n++) {
+    struct bloom shape;
+    if (fread(&shape, sizeof(struct bloom), 1, fp) != 1) { rv = 8; break; }
+
+    if (shape.ready == 0) {
+      blooms[n] = NULL;
+      continue;
+    }
+
+    if (shape.major != BLOOM_VERSION_MAJOR) { rv = 9; break; }
+    if ((shape.flags & ~BLOOM_FLAGS_KNOWN) || shape.hashes == 0 ||
+        shape.bits == 0 || shape.bytes < (shape.bits + 7) / 8) {
+      rv = 12;
+      break;
+    }
+
+    unsigned char * slot = alloc_slot(pool, shape.bytes);
+    if (slot == NULL) { rv = 10; break; }                    // LCOV_EXCL_LINE
+
+    struct bloom * bloom = (struct bloom *)slot;
+    memcpy(bloom, &shape, sizeof(struct bloom));
+    bloom->bf = slot + POOL_HEADER;
+    bloom->ready = 1;
+    pool->filters++;
+    blooms[n] = bloom;
+
+    if (fread(bloom->bf, bloom->bytes, 1, fp) != 1) {
+      n++;
+      rv = 11;
+      break;
+    }
+  }
+
+ done:
+  fclose(fp);
+
+  if (rv) {
+    unsigned long int i;
+    for (i = 0; i < n; i++) {
+      bloom_pool_release(pool, blooms[i]);
+      blooms[i] = NULL;
+    }
+    n = 0;
+  }
+
+  *count = n;
+  return rv;
+}
+
+
+void bloom_pool_free(struct bloom_pool * pool)
+{
+  if (pool->ready) {
+    while (pool->arenas != NULL) {
+      struct bloom_pool_arena * next = pool->arenas->next;
+      free(pool->arenas);
+      pool->arenas = next;
+    }
+    free(pool->classes);
+  }
+
+  pool->ready = 0;
+}
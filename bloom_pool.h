@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_POOL_H
+#define _BLOOM_POOL_H
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A pool of bloom filters allocated from large arenas, for applications
+ * keeping very many small filters (one per user, per file, ...).
+ *
+ * bloom_init2() makes two allocations per filter, the struct bloom (by the
+ * caller) and its bit field. A pool filter is instead a single slot of an
+ * arena: its struct bloom immediately followed by its bits. Slots come in
+ * size classes, each class carving its slots out of its own arenas, and
+ * released slots are reused by later filters of the same class. This saves
+ * the per-allocation overhead and fragmentation of the heap, keeps every
+ * filter within adjacent cache lines and makes freeing all the filters
+ * of a pool a matter of freeing its arenas.
+ *
+ * Pool filters are regular filters for bloom_check(), bloom_add(),
+ * bloom_reset(), bloom_save(), bloom_merge() and the other functions which
+ * use a filter in place. They MUST NOT be passed to bloom_free() or
+ * bloom_fold(), which would (re)allocate their bit fields.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_pool_init().
+ *
+ */
+struct bloom_pool
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  unsigned long int filters;            // filters currently allocated
+  unsigned long int bytes;              // arena memory held
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  struct bloom_pool_arena * arenas;
+  struct bloom_pool_class * classes;
+};
+
+
+/** ***************************************************************************
+ * Initialize an empty pool.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_pool_init(struct bloom_pool * pool);
+
+
+/** ***************************************************************************
+ * Allocate an empty filter from the pool, with the parameters of
+ * bloom_init3().
+ *
+ * Return:
+ * -------
+ *     the filter, or NULL on failure (invalid parameters, out of memory or
+ *     pool not initialized)
+ *
+ */
+struct bloom * bloom_pool_alloc(struct bloom_pool * pool,
+                                unsigned long int entries, double error,
+                                unsigned int flags);
+
+
+/** ***************************************************************************
+ * Return a filter allocated by bloom_pool_alloc() (or bloom_pool_load())
+ * to the pool. Upon return, the filter is no longer usable.
+ *
+ */
+void bloom_pool_release(struct bloom_pool * pool, struct bloom * bloom);
+
+
+/** ***************************************************************************
+ * Save 'count' filters to a single file, created (or overwritten). Any of
+ * 'blooms' may be NULL (for instance, for users without a filter), and is
+ * then loaded back as NULL.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_pool_save(struct bloom_pool * pool, char * filename,
+                    struct bloom ** blooms, unsigned long int count);
+
+
+/** ***************************************************************************
+ * Load the filters of a file saved with bloom_pool_save() into the pool,
+ * storing them into 'blooms' in the order they were saved.
+ *
+ * Parameters:
+ * -----------
+ *     pool     - Pointer to an initialized struct bloom_pool.
+ *     filename - The file to load.
+ *     blooms   - Receives the filters.
+ *     count    - On entry, room in 'blooms'. On return, the number of
+ *                filters stored into 'blooms'.
+ *
+ * Return:
+ * -------
+ *     0   - on success
+ *     > 0 - on failure, as bloom_load(); also 13 if the file holds more
+ *           than 'count' filters. No filters are left allocated.
+ *
+ */
+int bloom_pool_load(struct bloom_pool * pool, char * filename,
+                    struct bloom ** blooms, unsigned long int * count);
+
+
+/** ***************************************************************************
+ * Deallocate the pool with all of its filters at once. Upon return, the
+ * pool and its filters are no longer usable.
+ *
+ */
+void bloom_pool_free(struct bloom_pool * pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_prefix.h for documentation on the public interfaces.
+ *
+ * The hash of the first 'len' bytes of a key chains the full 8 byte words
+ * through bloom_mix64() and then mixes in the remaining bytes and 'len'.
+ * The chain state after the words of a shorter prefix is where the chain
+ * of a longer one continues, so all the prefixes of a key (and the key)
+ * are hashed in one pass. Whole keys are told apart from prefixes of the
+ * same bytes by a tag mixed in with the length.
+ *
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+#include "bloom_prefix.h"
+
+#define PREFIX_MAGIC "libbloomprefix1"
+
+#define PREFIX_FLAGS_KNOWN (BLOOM_FLAGS_KNOWN | BLOOM_PREFIX_KEYS)
+
+// Mixed into the hash of whole keys.
+#define PREFIX_KEY_TAG (1ull << 63)
+
+struct prefix_state
+{
+  uint64_t h;
+  unsigned long int done;               // bytes chained so far
+};
+
+
+/*
+ * Chain the full words of the first 'len' bytes of 's' not chained yet.
+ *
+ */
+static inline void advance(struct prefix_state * st, const unsigned char * s,
+                           unsigned long int len)
+{
+  uint64_t w;
+
+  while (st->done + 8 <= len) {
+    memcpy(&w, s + st->done, 8);
+    st->h = bloom_mix64(st->h ^ w);
+    st->done += 8;
+  }
+}
+
+
+/*
+ * Hash of the first 'len' bytes of 's', after advance() to 'len'.
+ *
+ */
+static inline uint64_t finish(const struct prefix_state * st,
+                              const unsigned char * s, unsigned long int len,
+                              uint64_t tag)
+{
+  uint64_t tail = 0;
+
+  memcpy(&tail, s + st->done, len - st->done);
+
+  return bloom_mix64(bloom_mix64(st->h ^ tail) ^ len ^ tag);
+}
+
+
+static uint64_t prefix_hash(const unsigned char * s, unsigned long int len,
+                            uint64_t tag)
+{
+  struct prefix_state st = { BLOOM_SEED, 0 };
+
+  advance(&st, s, len);
+
+  return finish(&st, s, len, tag);
+}
+
+
+static int check_hash(struct bloom_prefix * pf, uint64_t fp)
+{
+  struct bloom_hash hash;
+
+  bloom_hash_fp(&pf->bloom, fp, &hash);
+
+  return bloom_check_add_hash(&pf->bloom, &hash, 0);
+}
+
+
+int bloom_prefix_init(struct bloom_prefix * pf, unsigned long int entries,
+                      double error, const unsigned int * lengths,
+                      unsigned int levels, unsigned int flags)
+{
+  unsigned int n;
+
+  memset(pf, 0, sizeof(struct bloom_prefix));
+
+  if (levels > BLOOM_PREFIX_LEVELS || (flags & ~PREFIX_FLAGS_KNOWN) ||
+      (levels == 0 && !(flags & BLOOM_PREFIX_KEYS))) {
+    return 1;
+  }
+
+  for (n = 0; n < levels; n++) {
+    if (lengths[n] == 0 || (n > 0 && lengths[n] <= lengths[n - 1])) {
+      return 1;
+    }
+    pf->lengths[n] = lengths[n];
+  }
+
+  unsigned int elements = levels + (flags & BLOOM_PREFIX_KEYS ? 1 : 0);
+  if (bloom_init3(&pf->bloom, entries * elements, error,
+                  flags & BLOOM_FLAGS_KNOWN)) {
+    return 1;
+  }
+
+  pf->levels = levels;
+  pf->flags = flags;
+  pf->ready = 1;
+
+  return 0;
+}
+
+
+int bloom_prefix_add(struct bloom_prefix * pf, const void * buffer, int len)
+{
+  if (!bloom_struct_ready(pf, pf->ready, "bloom_prefix")) {
+    return -1;
+  }
+
+  const unsigned char * s = (const unsigned char *)buffer;
+  struct prefix_state st = { BLOOM_SEED, 0 };
+  struct bloom_hash hash[BLOOM_PREFIX_LEVELS + 1];
+  unsigned int count = 0;
+  unsigned int n;
+  uint64_t fp;
+
+  for (n = 0; n < pf->levels && pf->lengths[n] <= (unsigned int)len; n++) {
+    advance(&st, s, pf->lengths[n]);
+    fp = finish(&st, s, pf->lengths[n], 0);
+    bloom_hash_fp(&pf->bloom, fp, &hash[count++]);
+  }
+
+  if (pf->flags & BLOOM_PREFIX_KEYS) {
+    advance(&st, s, len);
+    fp = finish(&st, s, len, PREFIX_KEY_TAG);
+    bloom_hash_fp(&pf->bloom, fp, &hash[count++]);
+  }
+
+  for (n = 0; n < count; n++) {
+    unsigned long int first = bloom_nth_bit(&pf->bloom, &hash[n], 0);
+    __builtin_prefetch(pf->bloom.bf + (first >> 3));
+  }
+
+  int present = 1;
+  for (n = 0; n < count; n++) {
+    present &= bloom_check_add_hash(&pf->bloom, &hash[n], 1);
+  }
+
+  return present;
+}
+
+
+int bloom_prefix_check(struct bloom_prefix * pf, const void * buffer,
+                       int len)
+{
+  if (!bloom_struct_ready(pf, pf->ready, "bloom_prefix")) {
+    return -1;
+  }
+
+  if (!(pf->flags & BLOOM_PREFIX_KEYS)) {
+    return bloom_prefix_check_prefix(pf, buffer, len);
+  }
+
+  return check_hash(pf, prefix_hash((const unsigned char *)buffer, len,
+                                    PREFIX_KEY_TAG));
+}
+
+
+int bloom_prefix_check_prefix(struct bloom_prefix * pf, const void * prefix,
+                              int len)
+{
+  if (!bloom_struct_ready(pf, pf->ready, "bloom_prefix")) {
+    return -1;
+  }
+
+  unsigned int n = pf->levels;
+  while (n > 0 && pf->lengths[n - 1] > (unsigned int)len) {
+    n--;
+  }
+
+  if (n == 0) {
+    return 1;
+  }
+
+  return check_hash(pf, prefix_hash((const unsigned char *)prefix,
+                                    pf->lengths[n - 1], 0));
+}
+
+
+int bloom_prefix_check_range(struct bloom_prefix * pf,
+                             const void * low, int low_len,
+                             const void * high, int high_len)
+{
+  const unsigned char * a = (const unsigned char *)low;
+  const unsigned char * b = (const unsigned char *)high;
+  int n = 0;
+
+  while (n < low_len && n < high_len && a[n] == b[n]) {
+    n++;
+  }
+
+  return bloom_prefix_check_prefix(pf, low, n);
+}
+
+
+int bloom_prefix_save(struct bloom_prefix * pf, char * filename)
+{
+  if (filename == NULL || filename[0] == 0 || !pf->ready) {
+    return 1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return 1;
+  }
+
+  int rv = bloom_write_blob_header(fd, PREFIX_MAGIC, pf,
+                                   sizeof(struct bloom_prefix)) ||
+    bloom_write_full(fd, pf->bloom.bf, pf->bloom.bytes);
+
+  close(fd);
+  return rv;
+}
+
+
+int bloom_prefix_load(struct bloom_prefix * pf, char * filename)
+{
+  unsigned int n;
+  int rv = 0;
+
+  if (filename == NULL || filename[0] == 0) { return 1; }
+  if (pf == NULL) { return 2; }
+
+  memset(pf, 0, sizeof(struct bloom_prefix));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) { return 3; }
+
+  rv = bloom_read_blob_header(fd, PREFIX_MAGIC, pf,
+                              sizeof(struct bloom_prefix));
+  if (rv) { goto done; }
+
+  struct bloom * bloom = &pf->bloom;
+  pf->ready = 0;
+  bloom->ready = 0;
+  bloom->bf = NULL;
+  if (bloom->major != BLOOM_VERSION_MAJOR) { rv = 9; goto done; }
+
+  if ((pf->flags & ~PREFIX_FLAGS_KNOWN) ||
+      (bloom->flags & ~BLOOM_FLAGS_KNOWN) || bloom->hashes == 0 ||
+      bloom->bits == 0 || bloom->bytes < (bloom->bits + 7) / 8 ||
+      pf->levels > BLOOM_PREFIX_LEVELS ||
+      (pf->levels == 0 && !(pf->flags & BLOOM_PREFIX_KEYS))) {
+    rv = 12;
+    goto done;
+  }
+  for (n = 0; n < pf->levels; n++) {
+    if (pf->lengths[n] == 0 ||
+        (n > 0 && pf->lengths[n] <= pf->lengths[n - 1])) {
+      rv = 12;
+      goto done;
+    }
+  }
+
+  bloom->bf = (unsigned char *)malloc(bloom->bytes);
+  if (bloom->bf == NULL) { rv = 10; goto done; }             // LCOV_EXCL_LINE
+
+  if (bloom_read_full(fd, bloom->bf, bloom->bytes)) {
+    free(bloom->bf);
+    bloom->bf = NULL;
+    rv = 11;
+    goto done;
+  }
+
+  bloom->ready = 1;
+  pf->ready = 1;
+
+ done:
+  close(fd);
+  return rv;
+}
+
+
+void bloom_prefix_free(struct bloom_prefix * pf)
+{
+  if (pf->ready) {
+    bloom_free(&pf->bloom);
+  }
+  pf->ready = 0;
+}
@@ -0,0 +1,196 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_PREFIX_H
+#define _BLOOM_PREFIX_H
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * Most prefix lengths a bloom_prefix filter holds.
+ *
+ */
+#define BLOOM_PREFIX_LEVELS 8
+
+
+/** ***************************************************************************
+ * A bloom filter of key prefixes, answering "could any key starting with
+ * this prefix (or within this key range) be here?", so that scans which
+ * would find nothing can be skipped.
+ *
+ * Adding a key adds its prefixes of each of the configured 'lengths' (up
+ * to the length of the key), and with BLOOM_PREFIX_KEYS the whole key too,
+ * as separate elements of one filter. The hashes of all of them come from
+ * a single pass over the key: the key is hashed 8 bytes at a time and each
+ * prefix hash is finished from the state reached at its length.
+ *
+ * A prefix check is a check of one element, the prefix cut to the longest
+ * configured length not above its own, so it probes one group of bits
+ * (with BLOOM_PAGED, all within one page).
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_prefix_init() or
+ * bloom_prefix_load().
+ *
+ */
+struct bloom_prefix
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  unsigned int levels;
+  unsigned int lengths[BLOOM_PREFIX_LEVELS];
+  unsigned int flags;
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  struct bloom bloom;
+};
+
+
+/** ***************************************************************************
+ * Flag for bloom_prefix_init(), in addition to the hashing flags of
+ * bloom_init3().
+ *
+ * BLOOM_PREFIX_KEYS - Add whole keys, not only their prefixes. Without
+ *                it, bloom_prefix_check() of a key checks its longest
+ *                prefix instead, which is smaller but less exact.
+ *
+ */
+#define BLOOM_PREFIX_KEYS 0x100
+
+
+/** ***************************************************************************
+ * Initialize an empty prefix filter.
+ *
+ * Parameters:
+ * -----------
+ *     pf      - Pointer to an allocated struct bloom_prefix (see above).
+ *     entries - The expected number of keys. The filter is sized for one
+ *               element per key and level, so keys sharing prefixes make
+ *               the error rate lower than 'error'.
+ *     error   - Probability of collision, as in bloom_init2().
+ *     lengths - The prefix lengths, in bytes, in increasing order.
+ *     levels  - Number of 'lengths', at most BLOOM_PREFIX_LEVELS. May be
+ *               zero with BLOOM_PREFIX_KEYS (whole keys only).
+ *     flags   - Zero or more of the bloom_init3() flags and
+ *               BLOOM_PREFIX_KEYS.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_prefix_init(struct bloom_prefix * pf, unsigned long int entries,
+                      double error, const unsigned int * lengths,
+                      unsigned int levels, unsigned int flags);
+
+
+/** ***************************************************************************
+ * Add a key, that is its prefixes and (with BLOOM_PREFIX_KEYS) the key
+ * itself.
+ *
+ * Return:
+ * -------
+ *     0 - at least one of them was not present
+ *     1 - all of them were already present (or collisions)
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_prefix_add(struct bloom_prefix * pf, const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Check if the given key may have been added.
+ *
+ * Return:
+ * -------
+ *     0 - key is not present
+ *     1 - key is present (or false positive due to collision)
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_prefix_check(struct bloom_prefix * pf, const void * buffer,
+                       int len);
+
+
+/** ***************************************************************************
+ * Check if any key starting with the given prefix may have been added.
+ * Prefixes longer than a configured length are checked by their first
+ * 'lengths' bytes; prefixes shorter than all of them cannot be ruled out.
+ *
+ * Return:
+ * -------
+ *     0 - no key with this prefix is present
+ *     1 - keys with this prefix may be present
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_prefix_check_prefix(struct bloom_prefix * pf, const void * prefix,
+                              int len);
+
+
+/** ***************************************************************************
+ * Check if any key between 'low' and 'high' (inclusive, in memcmp() order)
+ * may have been added. All such keys start with the common prefix of 'low'
+ * and 'high', which is checked as by bloom_prefix_check_prefix(), so this
+ * rules out narrow ranges only.
+ *
+ * Return:
+ * -------
+ *     as bloom_prefix_check_prefix()
+ *
+ */
+int bloom_prefix_check_range(struct bloom_prefix * pf,
+                             const void * low, int low_len,
+                             const void * high, int high_len);
+
+
+/** ***************************************************************************
+ * Save a prefix filter to a file, created (or overwritten).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_prefix_save(struct bloom_prefix * pf, char * filename);
+
+
+/** ***************************************************************************
+ * Load a prefix filter saved with bloom_prefix_save(). The struct is
+ * initialized by this call; it must not be initialized already.
+ *
+ * Return:
+ * -------
+ *     0   - on success
+ *     > 0 - on failure, as bloom_load()
+ *
+ */
+int bloom_prefix_load(struct bloom_prefix * pf, char * filename);
+
+
+/** ***************************************************************************
+ * Deallocate internal storage. Upon return, the filter is no longer usable.
+ *
+ */
+void bloom_prefix_free(struct bloom_prefix * pf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
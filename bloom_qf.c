@@ -0,0 +1,680 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_qf.h for documentation on the public interfaces.
+ *
+ * Every slot is remainder_bits + 3 bits, packed back to back: the
+ * remainder and the occupied (the slot's quotient has a run somewhere),
+ * continuation (the slot is not the first of its run) and shifted (the
+ * slot is not its remainder's own quotient) bits. A slot is empty when
+ * all three bits are zero. See "Don't Thrash: How to Cache Your Hash on
+ * Flash" (Bender et al.) for how these describe the runs.
+ *
+ * Instead of the usual wrap-around, runs of the last quotients spill into
+ * slack slots past the end of the table.
+ *
+ * Adds and removes decode the stretch of slots from the start of the
+ * cluster of the element's quotient up to the next empty slot into a
+ * sorted list of fingerprints, change the list and lay it back out.
+ * Resizing and merging lay out the fingerprints of whole filters the same
+ * way, reading them in order with a linear scan.
+ *
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+#include "bloom_qf.h"
+#include "murmurhash2.h"
+
+#define QF_MAGIC "libbloomqf1"
+
+#define QF_OCCUPIED 1
+#define QF_CONTINUATION 2
+#define QF_SHIFTED 4
+#define QF_META 3                       // bits of the above
+
+// Filters double when this full.
+#define QF_MAX_LOAD 0.9
+
+// Smallest table, as quotient bits.
+#define QF_MIN_QUOTIENT 6
+
+// Decoded clusters up to this long fit on the stack.
+#define QF_STACK 256
+
+
+struct qf_iter
+{
+  unsigned long int slot;
+  unsigned long int quotient;
+  int started;
+};
+
+
+static inline uint64_t get_slot(const struct bloom_qf * qf,
+                                unsigned long int i)
+{
+  unsigned int w = qf->remainder_bits + QF_META;
+  unsigned long int bit = i * w;
+  unsigned long int word = bit >> 6;
+  unsigned int off = bit & 63;
+  uint64_t v = qf->words[word] >> off;
+
+  if (off + w > 64) {
+    v |= qf->words[word + 1] << (64 - off);
+  }
+
+  return w == 64 ? v : v & ((1ull << w) - 1);
+}
+
+
+static inline void set_slot(struct bloom_qf * qf, unsigned long int i,
+                            uint64_t v)
+{
+  unsigned int w = qf->remainder_bits + QF_META;
+  unsigned long int bit = i * w;
+  unsigned long int word = bit >> 6;
+  unsigned int off = bit & 63;
+  uint64_t mask = w == 64 ? ~0ull : (1ull << w) - 1;
+
+  qf->words[word] = (qf->words[word] & ~(mask << off)) | (v << off);
+
+  if (off + w > 64) {
+    unsigned int high = 64 - off;
+    qf->words[word + 1] =
+      (qf->words[word + 1] & ~(mask >> high)) | (v >> high);
+  }
+}
+
+
+static inline int empty(uint64_t v)
+{
+  return (v & (QF_OCCUPIED | QF_CONTINUATION | QF_SHIFTED)) == 0;
+}
+
+
+static inline uint64_t remainder_mask(const struct bloom_qf * qf)
+{
+  return (1ull << qf->remainder_bits) - 1;
+}
+
+
+static uint64_t fingerprint(const struct bloom_qf * qf,
+                            const void * buffer, int len)
+{
+  unsigned int bits = qf->quotient_bits + qf->remainder_bits;
+  uint64_t h = murmurhash64a(buffer, len, BLOOM_SEED);
+
+  return bits == 64 ? h : h >> (64 - bits);
+}
+
+
+/*
+ * Number of 64 bit words of the slots, including a last slot which is
+ * always empty and the word it may spill into.
+ *
+ */
+static size_t words_size(const struct bloom_qf * qf)
+{
+  unsigned long int bits = (qf->slots + 1) * (qf->remainder_bits + QF_META);
+  return ((bits + 63) / 64 + 1) * sizeof(uint64_t);
+}
+
+
+/*
+ * Set up 'qf' for a table of 2^quotient slots (plus slack) and allocate
+ * its (empty) slots. Returns 0 on success, 1 if out of memory.
+ *
+ */
+static int shape(struct bloom_qf * qf, unsigned int quotient,
+                 unsigned int remainder)
+{
+  unsigned long int size = 1ul << quotient;
+
+  qf->quotient_bits = quotient;
+  qf->remainder_bits = remainder;
+  qf->slots = size + 64 + 10 * (unsigned long int)sqrt((double)size);
+  qf->entries = (unsigned long int)(QF_MAX_LOAD * size);
+  qf->error = 1.0 - exp(-QF_MAX_LOAD / pow(2, remainder));
+  qf->major = BLOOM_VERSION_MAJOR;
+  qf->minor = BLOOM_VERSION_MINOR;
+
+  qf->words = (uint64_t *)calloc(1, words_size(qf));
+  if (qf->words == NULL) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  return 0;
+}
+
+
+static int find(const struct bloom_qf * qf, uint64_t fp)
+{
+  unsigned long int fq = fp >> qf->remainder_bits;
+  uint64_t fr = fp & remainder_mask(qf);
+
+  if (!(get_slot(qf, fq) & QF_OCCUPIED)) {
+    return 0;
+  }
+
+  // Back to the start of the cluster, then forward run by run (counting
+  // the occupied quotients passed) to the run of fq.
+  unsigned long int b = fq;
+  while (get_slot(qf, b) & QF_SHIFTED) {
+    b--;
+  }
+
+  unsigned long int s = b;
+  while (b != fq) {
+    do { s++; } while (get_slot(qf, s) & QF_CONTINUATION);
+    do { b++; } while (!(get_slot(qf, b) & QF_OCCUPIED));
+  }
+
+  do {
+    uint64_t r = get_slot(qf, s) >> QF_META;
+    if (r == fr) {
+      return 1;
+    }
+    if (r > fr) {
+      return 0;
+    }
+    s++;
+  } while (get_slot(qf, s) & QF_CONTINUATION);
+
+  return 0;
+}
+
+
+/*
+ * The stretch of slots [*start, *end) holding the cluster of quotient 'fq'
+ * and any clusters after it up to the next empty slot.
+ *
+ */
+static void stretch(const struct bloom_qf * qf, unsigned long int fq,
+                    unsigned long int * start, unsigned long int * end)
+{
+  unsigned long int b = fq;
+  unsigned long int e = fq;
+
+  if (!empty(get_slot(qf, fq))) {
+    while (get_slot(qf, b) & QF_SHIFTED) {
+      b--;
+    }
+  }
+
+  while (!empty(get_slot(qf, e))) {
+    e++;
+  }
+
+  *start = b;
+  *end = e;
+}
+
+
+/*
+ * Decode the slots [start, end) (see stretch()) into their fingerprints.
+ *
+ */
+static void decode(const struct bloom_qf * qf, unsigned long int start,
+                   unsigned long int end, uint64_t * fps)
+{
+  unsigned long int q = start;
+  unsigned long int p;
+  int first = 1;
+
+  for (p = start; p < end; p++) {
+    uint64_t v = get_slot(qf, p);
+    if (!(v & QF_CONTINUATION)) {
+      if (!first) {
+        q++;
+      }
+      first = 0;
+      while (!(get_slot(qf, q) & QF_OCCUPIED)) {
+        q++;
+      }
+    }
+    *fps++ = (q << qf->remainder_bits) | (v >> QF_META);
+  }
+}
+
+
+/*
+ * Lay out the sorted fingerprints 'fps' starting from slot 'start', where
+ * slots [start, end) held a stretch decoded by decode(). Returns 0 on
+ * success, 1 (with nothing changed) if they would not fit in the table.
+ *
+ */
+static int encode(struct bloom_qf * qf, unsigned long int start,
+                  unsigned long int end, const uint64_t * fps,
+                  unsigned long int count)
+{
+  unsigned long int pos = start;
+  unsigned long int n;
+
+  for (n = 0; n < count; n++) {
+    unsigned long int q = fps[n] >> qf->remainder_bits;
+    pos = (pos < q ? q : pos) + 1;
+  }
+  if (pos > qf->slots) {
+    return 1;
+  }
+
+  for (pos = start; pos < end; pos++) {
+    set_slot(qf, pos, 0);
+  }
+
+  unsigned long int prev = ~0ul;
+  pos = start;
+  for (n = 0; n < count; n++) {
+    unsigned long int q = fps[n] >> qf->remainder_bits;
+    uint64_t v = (fps[n] & remainder_mask(qf)) << QF_META;
+    if (pos < q) {
+      pos = q;
+    }
+    if (q == prev) {
+      v |= QF_CONTINUATION;
+    }
+    if (pos != q) {
+      v |= QF_SHIFTED;
+    }
+    set_slot(qf, pos, (get_slot(qf, pos) & QF_OCCUPIED) | v);
+    set_slot(qf, q, get_slot(qf, q) | QF_OCCUPIED);
+    prev = q;
+    pos++;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Fingerprints of a whole filter, in order.
+ *
+ */
+static int next(const struct bloom_qf * qf, struct qf_iter * it,
+                uint64_t * fp)
+{
+  while (it->slot < qf->slots) {
+    uint64_t v = get_slot(qf, it->slot++);
+    if (empty(v)) {
+      continue;
+    }
+    if (!(v & QF_CONTINUATION)) {
+      if (it->started) {
+        it->quotient++;
+      }
+      it->started = 1;
+      while (!(get_slot(qf, it->quotient) & QF_OCCUPIED)) {
+        it->quotient++;
+      }
+    }
+    *fp = (it->quotient << qf->remainder_bits) | (v >> QF_META);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Replace the table of 'qf' with one of 2^quotient slots holding the
+ * fingerprints of 'qf' and those of 'other' (if not NULL), merged in one
+ * pass and cut to their first 'bits' bits. Returns 0 on success, 1 on
+ * failure ('qf' unchanged).
+ *
+ */
+static int rebuild(struct bloom_qf * qf, struct bloom_qf * other,
+                   unsigned int quotient, unsigned int bits)
+{
+  struct bloom_qf t;
+
+  if (quotient >= bits || quotient > 48) {
+    return 1;
+  }
+
+  memset(&t, 0, sizeof(struct bloom_qf));
+  if (shape(&t, quotient, bits - quotient)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  // A fingerprint is the first bits of the hash, so a shorter one is a
+  // longer one shifted right (which keeps them in order).
+  unsigned int cut_a = qf->quotient_bits + qf->remainder_bits - bits;
+  unsigned int cut_b = 0;
+  struct qf_iter a = { 0, 0, 0 };
+  struct qf_iter b = { 0, 0, 0 };
+  uint64_t fa = 0;
+  uint64_t fb = 0;
+  int more_a = next(qf, &a, &fa);
+  int more_b = 0;
+  unsigned long int prev = ~0ul;
+  unsigned long int pos = 0;
+
+  if (other != NULL) {
+    cut_b = other->quotient_bits + other->remainder_bits - bits;
+    more_b = next(other, &b, &fb);
+  }
+
+  while (more_a || more_b) {
+    uint64_t fp;
+    if (more_a && (!more_b || fa >> cut_a <= fb >> cut_b)) {
+      fp = fa >> cut_a;
+      more_a = next(qf, &a, &fa);
+    } else {
+      fp = fb >> cut_b;
+      more_b = next(other, &b, &fb);
+    }
+
+    unsigned long int q = fp >> t.remainder_bits;
+    uint64_t v = (fp & remainder_mask(&t)) << QF_META;
+    if (pos < q) {
+      pos = q;
+    }
+    if (pos >= t.slots) {
+      free(t.words);
+      return 1;
+    }
+    if (q == prev) {
+      v |= QF_CONTINUATION;
+    }
+    if (pos != q) {
+      v |= QF_SHIFTED;
+    }
+    set_slot(&t, pos, (get_slot(&t, pos) & QF_OCCUPIED) | v);
+    set_slot(&t, q, get_slot(&t, q) | QF_OCCUPIED);
+    prev = q;
+    pos++;
+  }
+
+  free(qf->words);
+  qf->count += other != NULL ? other->count : 0;
+  qf->quotient_bits = t.quotient_bits;
+  qf->remainder_bits = t.remainder_bits;
+  qf->slots = t.slots;
+  qf->entries = t.entries;
+  qf->error = t.error;
+  qf->words = t.words;
+
+  return 0;
+}
+
+
+int bloom_qf_init(struct bloom_qf * qf, unsigned long int entries,
+                  double error)
+{
+  memset(qf, 0, sizeof(struct bloom_qf));
+
+  if (entries < 1 || error <= 0 || error >= 1) {
+    return 1;
+  }
+
+  unsigned int remainder = (unsigned int)ceil(log2(1 / error));
+  unsigned int quotient = QF_MIN_QUOTIENT;
+
+  if (remainder < 1) {
+    remainder = 1;
+  }
+
+  while (QF_MAX_LOAD * (1ul << quotient) < entries && quotient < 48) {
+    quotient++;
+  }
+
+  if (QF_MAX_LOAD * (1ul << quotient) < entries ||
+      quotient + remainder > 64 || remainder + QF_META > 64) {
+    return 1;
+  }
+
+  if (shape(qf, quotient, remainder)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  qf->ready = 1;
+
+  return 0;
+}
+
+
+int bloom_qf_check(struct bloom_qf * qf, const void * buffer, int len)
+{
+  if (!bloom_struct_ready(qf, qf->ready, "bloom_qf")) {
+    return -1;
+  }
+
+  return find(qf, fingerprint(qf, buffer, len));
+}
+
+
+/*
+ * Add (or if 'add' is zero, remove) the fingerprint 'fp'.
+ *
+ */
+static int add_remove(struct bloom_qf * qf, uint64_t fp, int add)
+{
+  uint64_t stack[QF_STACK];
+  uint64_t * fps = stack;
+  unsigned long int start, end, n;
+
+  stretch(qf, fp >> qf->remainder_bits, &start, &end);
+
+  if (end - start + 1 > QF_STACK) {
+    fps = (uint64_t *)malloc((end - start + 1) * sizeof(uint64_t));
+    if (fps == NULL) {
+      return -2;                                             // LCOV_EXCL_LINE
+    }
+  }
+
+  decode(qf, start, end, fps);
+  unsigned long int count = end - start;
+
+  // Position of the first fingerprint >= fp.
+  for (n = 0; n < count && fps[n] < fp; n++) { }
+
+  int rv;
+  if (add) {
+    memmove(fps + n + 1, fps + n, (count - n) * sizeof(uint64_t));
+    fps[n] = fp;
+    rv = encode(qf, start, end, fps, count + 1);
+  } else {
+    memmove(fps + n, fps + n + 1, (count - n - 1) * sizeof(uint64_t));
+    rv = encode(qf, start, end, fps, count - 1);
+  }
+
+  if (fps != stack) {
+    free(fps);
+  }
+
+  return rv;
+}
+
+
+int bloom_qf_add(struct bloom_qf * qf, const void * buffer, int len)
+{
+  if (!bloom_struct_ready(qf, qf->ready, "bloom_qf")) {
+    return -1;
+  }
+
+  if (qf->count >= qf->entries && bloom_qf_resize(qf)) {
+    return -2;
+  }
+
+  // The fingerprint keeps its value when the filter doubles.
+  uint64_t fp = fingerprint(qf, buffer, len);
+  int found = find(qf, fp);
+  int rv;
+
+  // Only the last runs of the table can overflow it, doubling (which
+  // spreads them over twice as many slots) makes room.
+  while ((rv = add_remove(qf, fp, 1)) == 1) {
+    if (bloom_qf_resize(qf)) {
+      return -2;
+    }
+  }
+
+  if (rv < 0) {
+    return rv;                                               // LCOV_EXCL_LINE
+  }
+
+  qf->count++;
+
+  return found;
+}
+
+
+int bloom_qf_remove(struct bloom_qf * qf, const void * buffer, int len)
+{
+  if (!bloom_struct_ready(qf, qf->ready, "bloom_qf")) {
+    return -1;
+  }
+
+  uint64_t fp = fingerprint(qf, buffer, len);
+
+  if (!find(qf, fp)) {
+    return 0;
+  }
+
+  int rv = add_remove(qf, fp, 0);
+  if (rv < 0) {
+    return rv;                                               // LCOV_EXCL_LINE
+  }
+
+  qf->count--;
+
+  return 1;
+}
+
+
+int bloom_qf_resize(struct bloom_qf * qf)
+{
+  if (!bloom_struct_ready(qf, qf->ready, "bloom_qf")) {
+    return -1;
+  }
+
+  return rebuild(qf, NULL, qf->quotient_bits + 1,
+                 qf->quotient_bits + qf->remainder_bits);
+}
+
+
+int bloom_qf_merge(struct bloom_qf * dest, struct bloom_qf * src)
+{
+  if (!bloom_struct_ready(dest, dest->ready, "bloom_qf") ||
+      !bloom_struct_ready(src, src->ready, "bloom_qf")) {
+    return -1;
+  }
+
+  unsigned int bits = dest->quotient_bits + dest->remainder_bits;
+  if (src->quotient_bits + src->remainder_bits < bits) {
+    bits = src->quotient_bits + src->remainder_bits;
+  }
+
+  unsigned int quotient = dest->quotient_bits;
+  if (src->quotient_bits > quotient) {
+    quotient = src->quotient_bits;
+  }
+  while (QF_MAX_LOAD * (1ul << quotient) < dest->count + src->count &&
+         quotient < bits - 1) {
+    quotient++;
+  }
+
+  return rebuild(dest, src, quotient, bits);
+}
+
+
+int bloom_qf_save(struct bloom_qf * qf, char * filename)
+{
+  if (filename == NULL || filename[0] == 0 || !qf->ready) {
+    return 1;
+  }
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return 1;
+  }
+
+  int rv = bloom_write_blob_header(fd, QF_MAGIC, qf,
+                                   sizeof(struct bloom_qf)) ||
+    bloom_write_full(fd, qf->words, words_size(qf));
+
+  close(fd);
+  return rv;
+}
+
+
+int bloom_qf_load(struct bloom_qf * qf, char * filename)
+{
+  int rv = 0;
+
+  if (filename == NULL || filename[0] == 0) { return 1; }
+  if (qf == NULL) { return 2; }
+
+  memset(qf, 0, sizeof(struct bloom_qf));
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) { return 3; }
+
+  rv = bloom_read_blob_header(fd, QF_MAGIC, qf,
+                              sizeof(struct bloom_qf));
+  if (rv) { goto done; }
+
+  qf->ready = 0;
+  qf->words = NULL;
+  if (qf->major != BLOOM_VERSION_MAJOR) { rv = 9; goto done; }
+
+  // Recompute the shape rather than trust the saved sizes.
+  struct bloom_qf saved;
+  memcpy(&saved, qf, sizeof(struct bloom_qf));
+  if (saved.remainder_bits < 1 || saved.quotient_bits > 48 ||
+      saved.quotient_bits + saved.remainder_bits > 64 ||
+      saved.remainder_bits + QF_META > 64) {
+    rv = 12;
+    goto done;
+  }
+
+  if (shape(qf, saved.quotient_bits, saved.remainder_bits)) {
+    rv = 10;                                                 // LCOV_EXCL_LINE
+    goto done;                                               // LCOV_EXCL_LINE
+  }
+
+  if (qf->slots != saved.slots) {
+    free(qf->words);
+    qf->words = NULL;
+    rv = 12;
+    goto done;
+  }
+
+  if (bloom_read_full(fd, qf->words, words_size(qf))) {
+    free(qf->words);
+    qf->words = NULL;
+    rv = 11;
+    goto done;
+  }
+
+  qf->ready = 1;
+
+ done:
+  close(fd);
+  return rv;
+}
+
+
+void bloom_qf_free(struct bloom_qf * qf)
+{
+  if (qf->ready) {
+    free(qf->words);
+  }
+  qf->ready = 0;
+}
@@ -0,0 +1,202 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_QF_H
+#define _BLOOM_QF_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A quotient filter: a membership filter which, unlike a bloom filter,
+ * supports removing elements, growing beyond its initial size and
+ * merging filters of different sizes, all without the original elements.
+ *
+ * Every element is reduced to a fingerprint of 'quotient_bits' +
+ * 'remainder_bits' bits. The quotient selects a slot in a table of
+ * 2^quotient_bits slots and the remainder is stored in it, or in the
+ * nearest free slot after it. The remainders of one quotient (its run)
+ * are kept together and sorted, and runs are kept in quotient order, so
+ * a check reads a few adjacent slots and the whole filter can be read out
+ * (or written) in fingerprint order by one linear scan. Three extra bits
+ * per slot record how the slots are laid out.
+ *
+ * A filter doubles its table when it gets full, moving one bit of every
+ * fingerprint from the remainder to the quotient, which doubles its error
+ * rate. Two filters merge into one (sized for both) by merging their
+ * ordered fingerprints.
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_qf_init() or bloom_qf_load().
+ *
+ */
+struct bloom_qf
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  unsigned long int entries;            // elements held before doubling
+  unsigned long int count;              // elements held
+  unsigned int quotient_bits;
+  unsigned int remainder_bits;
+  double error;                         // error rate when full
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  unsigned char major;
+  unsigned char minor;
+  unsigned long int slots;
+  uint64_t * words;
+};
+
+
+/** ***************************************************************************
+ * Initialize an empty filter.
+ *
+ * Parameters:
+ * -----------
+ *     qf      - Pointer to an allocated struct bloom_qf (see above).
+ *     entries - The expected number of entries (the filter grows if
+ *               needed, at the cost of a higher error rate).
+ *     error   - Probability of collision as long as the filter has not
+ *               grown. The remainders are log2(1 / error) bits, plus 3
+ *               bits per slot and about 10% free slots.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_qf_init(struct bloom_qf * qf, unsigned long int entries,
+                  double error);
+
+
+/** ***************************************************************************
+ * Check if the given element is in the filter.
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_qf_check(struct bloom_qf * qf, const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Add the given element to the filter, doubling the filter first if it is
+ * full. An element added again takes another slot, so that it is still
+ * present after removing it once.
+ *
+ * Return:
+ * -------
+ *     0 - element was not present and was added
+ *     1 - element (or a collision) was already present, and was added
+ *    -1 - filter not initialized
+ *    -2 - filter is full and cannot double (out of memory, or its
+ *         remainders have only one bit left)
+ *
+ */
+int bloom_qf_add(struct bloom_qf * qf, const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Remove the given element from the filter. Only elements which were
+ * added may be removed: removing any other element which happens to
+ * collide with an added one removes that one instead.
+ *
+ * Return:
+ * -------
+ *     0 - element was not present
+ *     1 - element was removed
+ *    -1 - filter not initialized
+ *    -2 - out of memory
+ *
+ */
+int bloom_qf_remove(struct bloom_qf * qf, const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Double the size of the filter (and its error rate), as bloom_qf_add()
+ * does when the filter is full.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (out of memory, or the remainders have only one bit
+ *         left)
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_qf_resize(struct bloom_qf * qf);
+
+
+/** ***************************************************************************
+ * Merge 'src' into 'dest': on success 'dest' holds the elements of both,
+ * doubled as many times as needed to hold them. If the filters have
+ * fingerprints (quotient_bits + remainder_bits) of different lengths, the
+ * longer ones are cut to the length of the shorter ones, so the error
+ * rate of the result is at least that of the filter with the shorter
+ * fingerprints when holding all the elements. 'src' is not modified.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (out of memory, or the fingerprints are too short to
+ *         hold all the elements)
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_qf_merge(struct bloom_qf * dest, struct bloom_qf * src);
+
+
+/** ***************************************************************************
+ * Save a filter to a file, created (or overwritten).
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_qf_save(struct bloom_qf * qf, char * filename);
+
+
+/** ***************************************************************************
+ * Load a filter saved with bloom_qf_save(). The struct is initialized by
+ * this call; it must not be initialized already.
+ *
+ * Return:
+ * -------
+ *     0   - on success
+ *     > 0 - on failure
+ *
+ */
+int bloom_qf_load(struct bloom_qf * qf, char * filename);
+
+
+/** ***************************************************************************
+ * Deallocate internal storage. Upon return, the filter is no longer usable.
+ *
+ */
+void bloom_qf_free(struct bloom_qf * qf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,292 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_sparse.h for documentation on the public interfaces.
+ *
+ * While sparse, the filter holds the sorted positions of the bits its
+ * elements set, which is the bit field itself in another form: checks
+ * binary search the positions of the element checked, adds merge its
+ * missing positions in.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+#include "bloom_sparse.h"
+
+// Positions are held in 32 bits, larger filters start out dense.
+#define SPARSE_MAX_BITS (1ul << 32)
+
+
+static int compare(const void * a, const void * b)
+{
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Index of the first of the first 'count' held positions >= 'x'.
+ *
+ */
+static unsigned int find(const struct bloom_sparse * sparse, uint32_t x,
+                         unsigned int count)
+{
+  unsigned int low = 0;
+  unsigned int high = count;
+
+  while (low < high) {
+    unsigned int mid = low + (high - low) / 2;
+    if (sparse->bits[mid] < x) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+
+static int held(const struct bloom_sparse * sparse, uint32_t x)
+{
+  unsigned int at = find(sparse, x, sparse->count);
+
+  return at < sparse->count && sparse->bits[at] == x;
+}
+
+
+/*
+ * Put the bit positions of the element 'buffer' which are not held yet
+ * into 'missing', sorted and without duplicates, and return their number.
+ *
+ */
+static unsigned int find_missing(const struct bloom_sparse * sparse,
+                                 const void * buffer, int len,
+                                 uint32_t * missing)
+{
+  const struct bloom * bloom = &sparse->bloom;
+  struct bloom_hash hash;
+  unsigned int count = 0;
+  unsigned int i;
+
+  bloom_hash_buffer(bloom, buffer, len, &hash);
+
+  for (i = 0; i < bloom->hashes; i++) {
+    uint32_t x = bloom_nth_bit(bloom, &hash, i);
+    if (!held(sparse, x)) {
+      missing[count++] = x;
+    }
+  }
+
+  qsort(missing, count, sizeof(uint32_t), compare);
+
+  unsigned int unique = 0;
+  for (i = 0; i < count; i++) {
+    if (unique == 0 || missing[unique - 1] != missing[i]) {
+      missing[unique++] = missing[i];
+    }
+  }
+
+  return unique;
+}
+
+
+/*
+ * Allocate the bit field and set the held bits.
+ *
+ */
+static int fill(const struct bloom_sparse * sparse, struct bloom * bloom)
+{
+  unsigned int n;
+
+  memcpy(bloom, &sparse->bloom, sizeof(struct bloom));
+  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
+  if (bloom->bf == NULL) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  for (n = 0; n < sparse->count; n++) {
+    test_bit_set_bit(bloom->bf, sparse->bits[n], 1);
+  }
+
+  bloom->ready = 1;
+
+  return 0;
+}
+
+
+static int densify(struct bloom_sparse * sparse)
+{
+  struct bloom bloom;
+
+  if (fill(sparse, &bloom)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  memcpy(&sparse->bloom, &bloom, sizeof(struct bloom));
+  free(sparse->bits);
+  sparse->bits = NULL;
+  sparse->count = 0;
+  sparse->capacity = 0;
+  sparse->dense = 1;
+
+  return 0;
+}
+
+
+int bloom_sparse_init(struct bloom_sparse * sparse, unsigned long int entries,
+                      double error, unsigned int flags)
+{
+  memset(sparse, 0, sizeof(struct bloom_sparse));
+
+  if (bloom_shape3(&sparse->bloom, entries, error, flags)) {
+    return 1;
+  }
+
+  sparse->ready = 1;
+
+  if (sparse->bloom.bits > SPARSE_MAX_BITS) {
+    if (densify(sparse)) {                                   // LCOV_EXCL_START
+      sparse->ready = 0;
+      return 1;
+    }                                                        // LCOV_EXCL_STOP
+  }
+
+  return 0;
+}
+
+
+int bloom_sparse_check(struct bloom_sparse * sparse,
+                       const void * buffer, int len)
+{
+  if (!bloom_struct_ready(sparse, sparse->ready, "bloom_sparse")) {
+    return -1;
+  }
+
+  if (sparse->dense) {
+    return bloom_check(&sparse->bloom, buffer, len);
+  }
+
+  const struct bloom * bloom = &sparse->bloom;
+  struct bloom_hash hash;
+  unsigned int i;
+
+  bloom_hash_buffer(bloom, buffer, len, &hash);
+
+  for (i = 0; i < bloom->hashes; i++) {
+    if (!held(sparse, bloom_nth_bit(bloom, &hash, i))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+int bloom_sparse_add(struct bloom_sparse * sparse,
+                     const void * buffer, int len)
+{
+  if (!bloom_struct_ready(sparse, sparse->ready, "bloom_sparse")) {
+    return -1;
+  }
+
+  if (sparse->dense) {
+    return bloom_add(&sparse->bloom, buffer, len);
+  }
+
+  uint32_t missing[256];
+  unsigned int added = find_missing(sparse, buffer, len, missing);
+  unsigned int i;
+
+  if (added == 0) {
+    return 1;
+  }
+
+  unsigned long int count = sparse->count + added;
+
+  if (4 * count > sparse->bloom.bytes) {
+    if (densify(sparse)) {
+      return -2;                                             // LCOV_EXCL_LINE
+    }
+    for (i = 0; i < added; i++) {
+      test_bit_set_bit(sparse->bloom.bf, missing[i], 1);
+    }
+    return 0;
+  }
+
+  if (count > sparse->capacity) {
+    unsigned long int capacity = sparse->capacity ? 2 * sparse->capacity : 64;
+    if (capacity < count) {
+      capacity = count;
+    }
+    if (4 * capacity > sparse->bloom.bytes) {
+      capacity = sparse->bloom.bytes / 4;
+    }
+    uint32_t * bits =
+      (uint32_t *)realloc(sparse->bits, capacity * sizeof(uint32_t));
+    if (bits == NULL) {
+      return -2;                                             // LCOV_EXCL_LINE
+    }
+    sparse->bits = bits;
+    sparse->capacity = capacity;
+  }
+
+  // Insert from the highest position down, so each held position moves
+  // at most once, by one memmove() per position inserted.
+  unsigned int end = sparse->count;
+  while (added > 0) {
+    unsigned int at = find(sparse, missing[added - 1], end);
+    memmove(sparse->bits + at + added, sparse->bits + at,
+            (end - at) * sizeof(uint32_t));
+    sparse->bits[at + added - 1] = missing[added - 1];
+    end = at;
+    added--;
+  }
+  sparse->count = count;
+
+  return 0;
+}
+
+
+int bloom_sparse_export(const struct bloom_sparse * sparse,
+                        struct bloom * bloom)
+{
+  if (!bloom_struct_ready(sparse, sparse->ready, "bloom_sparse")) {
+    return -1;
+  }
+
+  if (fill(sparse, bloom)) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  if (sparse->dense) {
+    memcpy(bloom->bf, sparse->bloom.bf, bloom->bytes);
+  }
+
+  return 0;
+}
+
+
+void bloom_sparse_free(struct bloom_sparse * sparse)
+{
+  if (sparse->ready) {
+    free(sparse->bits);
+    if (sparse->dense) {
+      bloom_free(&sparse->bloom);
+    }
+  }
+
+  sparse->ready = 0;
+}
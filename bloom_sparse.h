@@ -0,0 +1,138 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_SPARSE_H
+#define _BLOOM_SPARSE_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A bloom filter which uses memory in proportion to the elements added
+ * while it holds few of them, for applications keeping very many filters
+ * of which most stay nearly empty.
+ *
+ * The filter starts out sparse: as a sorted array of the positions of the
+ * bits its elements set, 4 bytes per bit (at most 'hashes' bits per
+ * element). Once the array would be larger than the bit field, the
+ * filter turns itself into an ordinary (dense) filter with those bits
+ * set. Filters of more than 2^32 bits start out dense.
+ *
+ * Either way, bloom_sparse_check() and bloom_sparse_add() return exactly
+ * what bloom_check() and bloom_add() would on a filter created with the
+ * same parameters, including the false positives, so the switch makes no
+ * difference to the results. A sparse check is 'hashes' binary searches
+ * of the array; a sparse add also merges the new positions into it, in
+ * time proportional to its size (at most bytes / 4 positions).
+ *
+ * Caller needs to allocate this and pass it to the functions below. First
+ * call for every struct must be to bloom_sparse_init().
+ *
+ */
+struct bloom_sparse
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  unsigned char dense;                // 1 once switched to the bit field
+  unsigned int count;                 // Bits set while sparse
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  unsigned int capacity;
+  uint32_t * bits;
+  struct bloom bloom;
+};
+
+
+/** ***************************************************************************
+ * Initialize an empty sparse filter. No memory is allocated until the
+ * first element is added.
+ *
+ * Parameters:
+ * -----------
+ *     sparse  - Pointer to an allocated struct bloom_sparse (see above).
+ *     entries - As for bloom_init3().
+ *     error   - As for bloom_init3().
+ *     flags   - As for bloom_init3().
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_sparse_init(struct bloom_sparse * sparse, unsigned long int entries,
+                      double error, unsigned int flags);
+
+
+/** ***************************************************************************
+ * Check if the given element is in the filter. Same as bloom_check().
+ *
+ * Return:
+ * -------
+ *     0 - element is not present
+ *     1 - element is present (or false positive due to collision)
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_sparse_check(struct bloom_sparse * sparse,
+                       const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Add the given element to the filter. Same as bloom_add().
+ *
+ * Return:
+ * -------
+ *     0 - element was not present and was added
+ *     1 - element (or a collision) had already been added previously
+ *    -1 - filter not initialized
+ *    -2 - out of memory (the element was not added)
+ *
+ */
+int bloom_sparse_add(struct bloom_sparse * sparse,
+                     const void * buffer, int len);
+
+
+/** ***************************************************************************
+ * Initialize 'bloom' as an ordinary filter holding the elements of the
+ * sparse filter, for example to bloom_save() or bloom_merge() it. The bit
+ * field is identical to that of a filter created with the same parameters
+ * and given the same elements with bloom_add(). The sparse filter is not
+ * modified.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *    -1 - filter not initialized
+ *
+ */
+int bloom_sparse_export(const struct bloom_sparse * sparse,
+                        struct bloom * bloom);
+
+
+/** ***************************************************************************
+ * Deallocate internal storage. Upon return, the filter is no longer usable.
+ *
+ */
+void bloom_sparse_free(struct bloom_sparse * sparse);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom_trace.h for documentation on the public interfaces.
+ *
+ * Records are built on the stack of the calling thread and appended to
+ * the buffer of the trace under its lock, which is held only for the copy
+ * (and for writing out a full buffer). Elements are sampled by their hash,
+ * so calls which are not sampled touch no shared state at all, and every
+ * call on a sampled element is recorded whichever thread makes it.
+ *
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+#include "bloom_trace.h"
+#include "murmurhash2.h"
+
+#define TRACE_MAGIC "libbloomtrace1"
+
+// Records are written out in blocks of up to this many bytes.
+#define TRACE_BUFFER (1ul << 20)
+
+// time, op, result, len
+#define TRACE_RECORD_HEADER (8 + 1 + 1 + 4)
+
+struct bloom_trace * bloom_tracer = NULL;
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/*
+ * Write out the buffered records. Called with the lock held.
+ *
+ */
+static void flush(struct bloom_trace * trace)
+{
+  if (trace->used > 0 &&
+      bloom_write_full(trace->fd, trace->buf, trace->used)) {
+    trace->failed = 1;                                       // LCOV_EXCL_LINE
+  }
+  trace->used = 0;
+}
+
+
+void bloom_trace_record(const struct iovec * iov, int iovcnt, int add,
+                        int result)
+{
+  struct bloom_trace * trace =
+    __atomic_load_n(&bloom_tracer, __ATOMIC_ACQUIRE);
+
+  if (trace == NULL) {
+    return;                                                  // LCOV_EXCL_LINE
+  }
+
+  unsigned char key[BLOOM_TRACE_MAX_KEY];
+  unsigned long int len = 0;
+  unsigned long int kept = 0;
+  int i;
+
+  for (i = 0; i < iovcnt; i++) {
+    unsigned long int n = iov[i].iov_len;
+    if (n > BLOOM_TRACE_MAX_KEY - kept) {
+      n = BLOOM_TRACE_MAX_KEY - kept;
+    }
+    memcpy(key + kept, iov[i].iov_base, n);
+    kept += n;
+    len += iov[i].iov_len;
+  }
+
+  // Mixed, so the recorded hashes are not all multiples of 'sample'.
+  uint64_t h = murmurhash64a(key, kept, BLOOM_SEED);
+  if (bloom_mix64(h) % trace->sample) {
+    return;
+  }
+
+  unsigned char record[TRACE_RECORD_HEADER + sizeof(uint64_t)];
+  uint64_t time = now_ns() - trace->start;
+  uint32_t len32 = len > UINT32_MAX ? UINT32_MAX : len;
+  unsigned long int size = TRACE_RECORD_HEADER;
+  unsigned long int data = 0;
+
+  memcpy(record, &time, sizeof(uint64_t));
+  record[8] = add ? BLOOM_TRACE_ADD : BLOOM_TRACE_CHECK;
+  record[9] = (unsigned char)result;
+  memcpy(record + 10, &len32, sizeof(uint32_t));
+
+  if (trace->flags & BLOOM_TRACE_KEYS) {
+    data = kept;
+  } else {
+    memcpy(record + size, &h, sizeof(uint64_t));
+    size += sizeof(uint64_t);
+  }
+
+  pthread_mutex_lock(&trace->lock);
+
+  if (trace->ready) {
+    if (trace->used + size + data > TRACE_BUFFER) {
+      flush(trace);
+    }
+    memcpy(trace->buf + trace->used, record, size);
+    memcpy(trace->buf + trace->used + size, key, data);
+    trace->used += size + data;
+    trace->bytes += size + data;
+    trace->records++;
+  }
+
+  pthread_mutex_unlock(&trace->lock);
+}
+
+
+int bloom_trace_start(struct bloom_trace * trace, char * filename,
+                      unsigned int sample, unsigned int flags)
+{
+  // Checked before clearing 'trace', which may be the started one.
+  if (__atomic_load_n(&bloom_tracer, __ATOMIC_ACQUIRE) != NULL) {
+    return 1;
+  }
+
+  memset(trace, 0, sizeof(struct bloom_trace));
+
+  if (filename == NULL || filename[0] == 0 || sample < 1 ||
+      (flags & ~BLOOM_TRACE_KEYS)) {
+    return 1;
+  }
+
+  trace->buf = (unsigned char *)malloc(TRACE_BUFFER);
+  if (trace->buf == NULL) {
+    return 1;                                                // LCOV_EXCL_LINE
+  }
+
+  trace->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (trace->fd < 0) {
+    free(trace->buf);
+    return 1;
+  }
+
+  uint32_t f = flags;
+  uint32_t s = sample;
+  if (bloom_write_full(trace->fd, TRACE_MAGIC, strlen(TRACE_MAGIC)) ||
+      bloom_write_full(trace->fd, &f, sizeof(uint32_t)) ||
+      bloom_write_full(trace->fd, &s, sizeof(uint32_t))) {
+    close(trace->fd);                                        // LCOV_EXCL_START
+    free(trace->buf);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  pthread_mutex_init(&trace->lock, NULL);
+  trace->bytes = strlen(TRACE_MAGIC) + 2 * sizeof(uint32_t);
+  trace->sample = sample;
+  trace->flags = flags;
+  trace->start = now_ns();
+  trace->ready = 1;
+
+  struct bloom_trace * none = NULL;
+  if (!__atomic_compare_exchange_n(&bloom_tracer, &none, trace, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    trace->ready = 0;                                        // LCOV_EXCL_START
+    close(trace->fd);
+    free(trace->buf);
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  return 0;
+}
+
+
+int bloom_trace_stop(struct bloom_trace * trace)
+{
+  struct bloom_trace * expected = trace;
+
+  if (!trace->ready ||
+      !__atomic_compare_exchange_n(&bloom_tracer, &expected, NULL, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return 1;
+  }
+
+  // Calls which loaded the trace before it was cleared above may still
+  // take the lock, so it is not destroyed; they find the trace not ready.
+  pthread_mutex_lock(&trace->lock);
+  flush(trace);
+  trace->ready = 0;
+  pthread_mutex_unlock(&trace->lock);
+
+  int rv = trace->failed;
+  if (close(trace->fd)) {
+    rv = 1;                                                  // LCOV_EXCL_LINE
+  }
+  free(trace->buf);
+  trace->buf = NULL;
+
+  return rv;
+}
@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+#ifndef _BLOOM_TRACE_H
+#define _BLOOM_TRACE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/** ***************************************************************************
+ * A trace of the bloom_check() and bloom_add() calls (and their _iov
+ * variants) of a process, on all filters, for replaying the real workload
+ * of an application against other filter configurations offline (see
+ * misc/test/replay.c).
+ *
+ * While a trace is started, the calls on one in every 'sample' elements
+ * are recorded: elements are picked by their hash, so every call on a
+ * picked element is, and the trace keeps the repeats and the add-then-check
+ * patterns of the workload. Every call pays for that hash while tracing.
+ * When no trace is started the calls pay only for a test of a global
+ * pointer.
+ *
+ * The trace file is the magic "libbloomtrace1", the uint32_t 'flags' and
+ * the uint32_t 'sample', followed by the records, in host byte order:
+ *
+ *     uint64_t time   - nanoseconds since the trace was started
+ *     uint8_t op      - BLOOM_TRACE_CHECK or BLOOM_TRACE_ADD
+ *     uint8_t result  - what the call returned
+ *     uint32_t len    - length of the element
+ *
+ * followed by the first min(len, BLOOM_TRACE_MAX_KEY) bytes of the element
+ * with BLOOM_TRACE_KEYS, and otherwise by a uint64_t hash of those bytes.
+ * Records of concurrent threads are in the order they were recorded, so
+ * their times are not strictly increasing.
+ *
+ * Caller needs to allocate this and pass it to the functions below. Only
+ * one trace can be started at a time.
+ *
+ */
+struct bloom_trace
+{
+  // These fields are part of the public interface of this structure.
+  // Client code may read these values if desired. Client code MUST NOT
+  // modify any of these.
+  uint64_t records;
+  uint64_t bytes;
+  unsigned int sample;
+  unsigned int flags;
+
+  // Fields below are private to the implementation. These may go away or
+  // change incompatibly at any moment. Client code MUST NOT access or rely
+  // on these.
+  unsigned char ready;
+  int fd;
+  int failed;
+  uint64_t start;
+  unsigned char * buf;
+  unsigned long int used;
+  pthread_mutex_t lock;
+};
+
+
+/** ***************************************************************************
+ * Values of the 'op' of trace records.
+ *
+ */
+#define BLOOM_TRACE_CHECK 0
+#define BLOOM_TRACE_ADD 1
+
+
+/** ***************************************************************************
+ * Elements longer than this are recorded (or hashed) by their first
+ * BLOOM_TRACE_MAX_KEY bytes.
+ *
+ */
+#define BLOOM_TRACE_MAX_KEY 4096
+
+
+/** ***************************************************************************
+ * Flag for bloom_trace_start().
+ *
+ * BLOOM_TRACE_KEYS - Record the elements themselves instead of hashes of
+ *                them. Replays then hash the same bytes, but the trace
+ *                holds (possibly sensitive) application data.
+ *
+ */
+#define BLOOM_TRACE_KEYS 0x01
+
+
+/** ***************************************************************************
+ * Start recording calls into a trace file, created (or overwritten).
+ *
+ * Parameters:
+ * -----------
+ *     trace    - Pointer to an allocated struct bloom_trace (see above).
+ *                It must remain valid after bloom_trace_stop() for as
+ *                long as calls started before then may still be running.
+ *     filename - The trace file.
+ *     sample   - Record the calls on one in every 'sample' elements (1
+ *                records all calls).
+ *     flags    - Zero or BLOOM_TRACE_KEYS.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (including a trace already started)
+ *
+ */
+int bloom_trace_start(struct bloom_trace * trace, char * filename,
+                      unsigned int sample, unsigned int flags);
+
+
+/** ***************************************************************************
+ * Stop recording and complete the trace file. Calls which are being
+ * recorded concurrently may be left out of it.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure (the trace could not be written completely, or was
+ *         not started)
+ *
+ */
+int bloom_trace_stop(struct bloom_trace * trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Refer to bloom.h for documentation on the public interfaces.
+ *
+ * Fast paths for elements which are 64 bit integers. The hashes are those
+ * bloom_add() computes for the 8 bytes of the integer, specialized for
+ * that length, and on x86-64 CPUs with AVX2 the default (murmurhash2)
+ * hashes of eight integers are computed at once.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "bloom_internal.h"
+#include "murmurhash2.h"
+
+#ifdef BLOOM_AVX2
+#include <immintrin.h>
+#endif
+
+// Mixing constant of murmurhash2.
+#define M 0x5bd1e995
+
+// Elements are hashed, and their first bits loaded, this many at a time.
+#define GROUP 8
+
+
+/*
+ * murmurhash2() of an 8 byte key, given as its two 32 bit words.
+ *
+ */
+static inline uint32_t murmur8(uint32_t lo, uint32_t hi, uint32_t seed)
+{
+  uint32_t h = seed ^ 8;
+  uint32_t k;
+
+  k = lo * M;
+  k ^= k >> 24;
+  k *= M;
+  h *= M;
+  h ^= k;
+
+  k = hi * M;
+  k ^= k >> 24;
+  k *= M;
+  h *= M;
+  h ^= k;
+
+  h ^= h >> 13;
+  h *= M;
+  h ^= h >> 15;
+
+  return h;
+}
+
+
+static inline void hash_u64(const struct bloom * bloom, uint64_t key,
+                            struct bloom_hash * hash)
+{
+  if (bloom->flags & BLOOM_HASH64) {
+    bloom_hash_fp(bloom, murmurhash64a(&key, sizeof(key), BLOOM_SEED), hash);
+    return;
+  }
+
+  uint32_t w[2];
+  memcpy(w, &key, sizeof(w));
+  hash->a = murmur8(w[0], w[1], BLOOM_SEED);
+  hash->b = murmur8(w[0], w[1], (uint32_t)hash->a);
+}
+
+
+#ifdef BLOOM_AVX2
+
+__attribute__((target("avx2")))
+static inline __m256i murmur8_avx2(__m256i lo, __m256i hi, __m256i seed)
+{
+  const __m256i m = _mm256_set1_epi32(M);
+  __m256i h = _mm256_xor_si256(seed, _mm256_set1_epi32(8));
+  __m256i k;
+
+  k = _mm256_mullo_epi32(lo, m);
+  k = _mm256_xor_si256(k, _mm256_srli_epi32(k, 24));
+  k = _mm256_mullo_epi32(k, m);
+  h = _mm256_mullo_epi32(h, m);
+  h = _mm256_xor_si256(h, k);
+
+  k = _mm256_mullo_epi32(hi, m);
+  k = _mm256_xor_si256(k, _mm256_srli_epi32(k, 24));
+  k = _mm256_mullo_epi32(k, m);
+  h = _mm256_mullo_epi32(h, m);
+  h = _mm256_xor_si256(h, k);
+
+  h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+  h = _mm256_mullo_epi32(h, m);
+  h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+
+  return h;
+}
+
+
+__attribute__((target("avx2")))
+static void hash_group_avx2(const uint64_t * keys, struct bloom_hash * hash)
+{
+  uint32_t a[GROUP];
+  uint32_t b[GROUP];
+  int n;
+
+  // Split the keys into their low and high words:
+  // [l0 h0 l1 h1 | l2 h2 l3 h3] -> [l0 l1 h0 h1 | l2 l3 h2 h3]
+  //                             -> [l0 l1 l2 l3 | h0 h1 h2 h3]
+  __m256i v0 = _mm256_loadu_si256((const __m256i *)keys);
+  __m256i v1 = _mm256_loadu_si256((const __m256i *)(keys + 4));
+  v0 = _mm256_shuffle_epi32(v0, _MM_SHUFFLE(3, 1, 2, 0));
+  v1 = _mm256_shuffle_epi32(v1, _MM_SHUFFLE(3, 1, 2, 0));
+  v0 = _mm256_permute4x64_epi64(v0, _MM_SHUFFLE(3, 1, 2, 0));
+  v1 = _mm256_permute4x64_epi64(v1, _MM_SHUFFLE(3, 1, 2, 0));
+  __m256i lo = _mm256_permute2x128_si256(v0, v1, 0x20);
+  __m256i hi = _mm256_permute2x128_si256(v0, v1, 0x31);
+
+  __m256i va = murmur8_avx2(lo, hi, _mm256_set1_epi32(BLOOM_SEED));
+  __m256i vb = murmur8_avx2(lo, hi, va);
+
+  _mm256_storeu_si256((__m256i *)a, va);
+  _mm256_storeu_si256((__m256i *)b, vb);
+
+  for (n = 0; n < GROUP; n++) {
+    hash[n].a = a[n];
+    hash[n].b = b[n];
+  }
+}
+
+
+#endif
+
+
+static void hash_group(const struct bloom * bloom, const uint64_t * keys,
+                       struct bloom_hash * hash)
+{
+  int n;
+
+#ifdef BLOOM_AVX2
+  if (!(bloom->flags & BLOOM_HASH64) && bloom_have_avx2()) {
+    hash_group_avx2(keys, hash);
+    return;
+  }
+#endif
+
+  for (n = 0; n < GROUP; n++) {
+    hash_u64(bloom, keys[n], &hash[n]);
+  }
+}
+
+
+/*
+ * Like bloom_check_add_hash() in bloom.c, given the first bit position.
+ *
+ * With the default hashes a + b * i never exceeds 64 bits, so the positions
+ * can be stepped through incrementally, with one division per element
+ * instead of one per position.
+ *
+ */
+static inline int probe(struct bloom * bloom, const struct bloom_hash * hash,
+                        unsigned long int first, int add)
+{
+  int incremental = bloom->flags == 0;
+  unsigned long int step = incremental ? hash->b % bloom->bits : 0;
+  unsigned long int x = first;
+  unsigned char hits = 0;
+  unsigned long int i = 0;
+
+  while (1) {
+    if (test_bit_set_bit(bloom->bf, x, add)) {
+      hits++;
+    } else if (!add) {
+      return 0;
+    }
+
+    if (++i == bloom->hashes) {
+      break;
+    }
+
+    if (incremental) {
+      x += step;
+      if (x >= bloom->bits) {
+        x -= bloom->bits;
+      }
+    } else {
+      x = bloom_nth_bit(bloom, hash, i);
+    }
+  }
+
+  return hits == bloom->hashes;
+}
+
+
+static int check_add_u64(struct bloom * bloom, uint64_t key, int add)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  struct bloom_hash hash;
+  hash_u64(bloom, key, &hash);
+
+  return probe(bloom, &hash, bloom_nth_bit(bloom, &hash, 0), add);
+}
+
+
+static int check_add_u64_array(struct bloom * bloom, const uint64_t * keys,
+                               unsigned long int count,
+                               unsigned char * results, int add)
+{
+  if (bloom->ready == 0) {
+    printf("bloom at %p not initialized!\n", (void *)bloom);
+    return -1;
+  }
+
+  struct bloom_hash hash[GROUP];
+  unsigned long int first[GROUP];
+  unsigned long int n;
+  unsigned long int g;
+
+  for (n = 0; n < count; n += GROUP) {
+    unsigned long int c = count - n < GROUP ? count - n : GROUP;
+
+    if (c == GROUP) {
+      hash_group(bloom, keys + n, hash);
+    } else {
+      for (g = 0; g < c; g++) {
+        hash_u64(bloom, keys[n + g], &hash[g]);
+      }
+    }
+
+    // Get the first byte of every element in the group on its way from
+    // memory before waiting on any of them.
+    for (g = 0; g < c; g++) {
+      first[g] = bloom_nth_bit(bloom, &hash[g], 0);
+      __builtin_prefetch(bloom->bf + (first[g] >> 3));
+    }
+
+    for (g = 0; g < c; g++) {
+      int rv = probe(bloom, &hash[g], first[g], add);
+      if (results) {
+        results[n + g] = (unsigned char)rv;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+int bloom_check_u64(struct bloom * bloom, uint64_t key)
+{
+  return check_add_u64(bloom, key, 0);
+}
+
+
+int bloom_add_u64(struct bloom * bloom, uint64_t key)
+{
+  return check_add_u64(bloom, key, 1);
+}
+
+
+int bloom_check_u64_array(struct bloom * bloom, const uint64_t * keys,
+                          unsigned long int count, unsigned char * results)
+{
+  return check_add_u64_array(bloom, keys, count, results, 0);
+}
+
+
+int bloom_add_u64_array(struct bloom * bloom, const uint64_t * keys,
+                        unsigned long int count, unsigned char * results)
+{
+  return check_add_u64_array(bloom, keys, count, results, 1);
+}
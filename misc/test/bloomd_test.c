@@ -0,0 +1,286 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Starts the given bloomd binary on a temporary socket, with /tmp as its
+ * data directory, and exercises all of its operations, pipelining all
+ * requests and shutting down the writing side of the connection before
+ * reading responses.
+ *
+ * Usage: test-bloomd PATH-TO-BLOOMD
+ *
+ */
+
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloomd.h"
+
+#define KEYS 5000
+
+static unsigned char * req = NULL;
+static size_t req_len = 0;
+static uint32_t next_id = 1;
+
+
+static void append(const void * data, size_t len)
+{
+  req = realloc(req, req_len + len);
+  assert(req != NULL);
+  memcpy(req + req_len, data, len);
+  req_len += len;
+}
+
+
+static uint32_t request(uint8_t op, const char * name,
+                        const void * payload, size_t len)
+{
+  struct bloomd_req_header h;
+  memset(&h, 0, sizeof(h));
+  h.op = op;
+  h.id = next_id++;
+  h.name_len = strlen(name);
+  h.length = h.name_len + len;
+  append(&h, sizeof(h));
+  append(name, h.name_len);
+  append(payload, len);
+  return h.id;
+}
+
+
+static uint32_t batch(uint8_t op, const char * name, uint64_t from, uint64_t to)
+{
+  size_t len = sizeof(uint32_t) + (to - from) * (sizeof(uint32_t) + 8);
+  unsigned char * p = malloc(len);
+  unsigned char * q = p;
+  uint32_t count = to - from;
+  uint32_t elen = sizeof(uint64_t);
+  uint64_t n;
+
+  memcpy(q, &count, sizeof(uint32_t));
+  q += sizeof(uint32_t);
+  for (n = from; n < to; n++) {
+    memcpy(q, &elen, sizeof(uint32_t));
+    q += sizeof(uint32_t);
+    memcpy(q, &n, sizeof(uint64_t));
+    q += sizeof(uint64_t);
+  }
+
+  uint32_t id = request(op, name, p, len);
+  free(p);
+  return id;
+}
+
+
+static void read_full(int fd, void * buf, size_t len)
+{
+  unsigned char * p = (unsigned char *)buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    assert(n > 0);
+    p += n;
+    len -= n;
+  }
+}
+
+
+/*
+ * Read the next response, check it is for 'id' with the given status and
+ * return its payload (caller frees).
+ *
+ */
+static unsigned char * response(int fd, uint32_t id, uint8_t status,
+                                uint32_t * len)
+{
+  struct bloomd_resp_header h;
+  read_full(fd, &h, sizeof(h));
+  if (h.id != id || h.status != status) {
+    printf("error: response %u status %u, expected %u status %u\n",
+           h.id, h.status, id, status);
+    exit(1);
+  }
+  unsigned char * p = malloc(h.length + 1);
+  read_full(fd, p, h.length);
+  if (len) { *len = h.length; }
+  return p;
+}
+
+
+static void expect(int fd, uint32_t id, uint8_t status)
+{
+  free(response(fd, id, status, NULL));
+}
+
+
+int main(int argc, char **argv)
+{
+  char sock[64];
+  char file[64];
+  char path[80];
+  struct stat st;
+  int status;
+  struct sockaddr_un addr;
+  uint32_t len, n;
+
+  printf("----- bloomd tests -----\n");
+
+  if (argc != 2) {
+    printf("usage: test-bloomd PATH-TO-BLOOMD\n");
+    return 1;
+  }
+
+  snprintf(sock, sizeof(sock), "/tmp/bloomd.test.%d", (int)getpid());
+  snprintf(file, sizeof(file), "bloomd.test.%d.bloom", (int)getpid());
+  snprintf(path, sizeof(path), "/tmp/%s", file);
+
+  // Won't replace anything but a socket.
+  FILE * f = fopen(sock, "w");
+  assert(f != NULL);
+  fclose(f);
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(argv[1], argv[1], "-s", sock, (char *)NULL);
+    _exit(2);
+  }
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+  assert(stat(sock, &st) == 0 && S_ISREG(st.st_mode));
+  unlink(sock);
+
+  pid = fork();
+  if (pid == 0) {
+    execl(argv[1], argv[1], "-s", sock, "-d", "/tmp", "-t", "3",
+          (char *)NULL);
+    perror("execl");
+    _exit(1);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sock);
+  for (n = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)); n++) {
+    assert(n < 500);
+    usleep(10000);
+  }
+  assert(stat(sock, &st) == 0 && (st.st_mode & 0777) == 0600);
+
+  struct bloomd_create create = { 100000, 0.01, 0, 0 };
+  struct bloomd_create bad = { 10, 0.01, 0, 0 };
+
+  uint32_t r_create = request(BLOOMD_CREATE, "a", &create, sizeof(create));
+  uint32_t r_exists = request(BLOOMD_CREATE, "a", &create, sizeof(create));
+  uint32_t r_bad = request(BLOOMD_CREATE, "x", &bad, sizeof(bad));
+  uint32_t r_short = request(BLOOMD_CREATE, "x", &bad, 4);
+  uint32_t r_op = request(99, "a", NULL, 0);
+  uint32_t r_none = batch(BLOOMD_CHECK, "nope", 0, 10);
+  uint32_t r_add = batch(BLOOMD_ADD, "a", 0, KEYS);
+  uint32_t r_check = batch(BLOOMD_CHECK, "a", 0, 2 * KEYS);
+  uint32_t r_stats = request(BLOOMD_STATS, "a", NULL, 0);
+  uint32_t r_abs = request(BLOOMD_SAVE, "a", path, strlen(path));
+  uint32_t r_up = request(BLOOMD_SAVE, "a", "x/../../a", 9);
+  uint32_t r_upload = request(BLOOMD_LOAD, "b", "..", 2);
+  uint32_t r_nosave = request(BLOOMD_SAVE, "a", "nonexistent/a", 13);
+  uint32_t r_save = request(BLOOMD_SAVE, "a", file, strlen(file));
+  uint32_t r_load = request(BLOOMD_LOAD, "b", file, strlen(file));
+  uint32_t r_create2 = request(BLOOMD_CREATE, "c", &create, sizeof(create));
+  uint32_t r_add2 = batch(BLOOMD_ADD, "c", KEYS, 2 * KEYS);
+  uint32_t r_merge = request(BLOOMD_MERGE, "b", "c", 1);
+  uint32_t r_self = request(BLOOMD_MERGE, "b", "b", 1);
+  uint32_t r_check2 = batch(BLOOMD_CHECK, "b", 0, 2 * KEYS);
+  uint32_t r_drop = request(BLOOMD_DROP, "a", NULL, 0);
+  uint32_t r_gone = request(BLOOMD_STATS, "a", NULL, 0);
+
+  unsigned char * p = req;
+  size_t left = req_len;
+  while (left > 0) {
+    ssize_t w = write(fd, p, left);
+    assert(w > 0);
+    p += w;
+    left -= w;
+  }
+
+  // All responses must still arrive, then the end of file.
+  assert(shutdown(fd, SHUT_WR) == 0);
+
+  expect(fd, r_create, BLOOMD_OK);
+  expect(fd, r_exists, BLOOMD_EXISTS);
+  expect(fd, r_bad, BLOOMD_FAILED);
+  expect(fd, r_short, BLOOMD_BAD_REQ);
+  expect(fd, r_op, BLOOMD_BAD_REQ);
+  expect(fd, r_none, BLOOMD_NO_FILTER);
+
+  p = response(fd, r_add, BLOOMD_OK, &len);
+  assert(len == sizeof(uint32_t) + KEYS);
+  free(p);
+
+  p = response(fd, r_check, BLOOMD_OK, &len);
+  assert(len == sizeof(uint32_t) + 2 * KEYS);
+  int fp = 0;
+  for (n = 0; n < 2 * KEYS; n++) {
+    if (n < KEYS) {
+      assert(p[sizeof(uint32_t) + n] == 1);
+    } else {
+      fp += p[sizeof(uint32_t) + n];
+    }
+  }
+  assert(fp < KEYS / 10);
+  free(p);
+
+  struct bloomd_stats stats;
+  p = response(fd, r_stats, BLOOMD_OK, &len);
+  assert(len == sizeof(stats));
+  memcpy(&stats, p, sizeof(stats));
+  assert(stats.entries == 100000);
+  assert(stats.adds == KEYS);
+  assert(stats.checks == 2 * KEYS);
+  free(p);
+
+  expect(fd, r_abs, BLOOMD_DENIED);
+  expect(fd, r_up, BLOOMD_DENIED);
+  expect(fd, r_upload, BLOOMD_DENIED);
+  expect(fd, r_nosave, BLOOMD_FAILED);
+  expect(fd, r_save, BLOOMD_OK);
+  expect(fd, r_load, BLOOMD_OK);
+  expect(fd, r_create2, BLOOMD_OK);
+  expect(fd, r_add2, BLOOMD_OK);
+  expect(fd, r_merge, BLOOMD_OK);
+  expect(fd, r_self, BLOOMD_BAD_REQ);
+
+  p = response(fd, r_check2, BLOOMD_OK, &len);
+  for (n = 0; n < 2 * KEYS; n++) {
+    assert(p[sizeof(uint32_t) + n] == 1);
+  }
+  free(p);
+
+  expect(fd, r_drop, BLOOMD_OK);
+  expect(fd, r_gone, BLOOMD_NO_FILTER);
+  assert(read(fd, &n, 1) == 0);
+
+  close(fd);
+  kill(pid, SIGTERM);
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(access(sock, F_OK) != 0);
+
+  unlink(path);
+  free(req);
+
+  printf("----- DONE bloomd tests -----\n");
+  return 0;
+}
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+#
+# Exercise the bloomtool commands.
+#
+# Usage: bloomtool_test.sh PATH-TO-BLOOMTOOL
+#
+
+set -e
+
+BT=$1
+DIR=/tmp/bloomtool.test.$$
+mkdir -p $DIR
+trap "rm -rf $DIR" EXIT
+
+fail() {
+    echo "error: $1"
+    exit 1
+}
+
+echo "----- bloomtool tests -----"
+
+seq 1 100000 > $DIR/keys
+seq 100001 200000 > $DIR/other
+perl -e 'for (1..100000) { $k = "key$_"; print pack("V", length $k) . $k }' \
+    > $DIR/keys.ld
+
+# Built from a file (mmap) and from stdin, with various thread counts
+$BT build -n 100000 -e 0.01 -t 4 -o $DIR/a.bloom $DIR/keys
+cat $DIR/keys | $BT build -n 100000 -e 0.01 -t 1 -o $DIR/b.bloom
+cat $DIR/keys | $BT build -n 100000 -e 0.01 -H -o $DIR/h.bloom -
+
+for f in a b h; do
+    n=`$BT query $DIR/$f.bloom $DIR/keys | wc -l`
+    [ $n -eq 100000 ] || fail "$f: expected 100000 hits, got $n"
+    n=`$BT query -v $DIR/$f.bloom < $DIR/keys | wc -l`
+    [ $n -eq 0 ] || fail "$f: expected 0 misses, got $n"
+    n=`$BT query $DIR/$f.bloom $DIR/other | wc -l`
+    [ $n -lt 1500 ] || fail "$f: too many false positives ($n)"
+done
+
+# Output is the matching keys
+$BT query $DIR/a.bloom $DIR/keys | cmp -s - $DIR/keys || fail "query output"
+
+# Length-delimited elements
+$BT build -l -n 100000 -e 0.01 -o $DIR/l.bloom $DIR/keys.ld
+$BT query -l $DIR/l.bloom < $DIR/keys.ld | cmp -s - $DIR/keys.ld \
+    || fail "length-delimited query output"
+n=`$BT query $DIR/l.bloom $DIR/keys | wc -l`
+[ $n -lt 1500 ] || fail "length-delimited filter matches other keys ($n)"
+
+# Merge
+$BT build -n 100000 -e 0.01 -o $DIR/c.bloom $DIR/other
+$BT merge -o $DIR/m.bloom $DIR/a.bloom $DIR/c.bloom
+n=`cat $DIR/keys $DIR/other | $BT query $DIR/m.bloom | wc -l`
+[ $n -eq 200000 ] || fail "merged filter has $n of 200000"
+if $BT merge -o $DIR/x.bloom $DIR/a.bloom $DIR/h.bloom 2> /dev/null; then
+    fail "merged incompatible filters"
+fi
+
+# Stats
+$BT stats $DIR/a.bloom > $DIR/stats
+grep -q "entries *100000" $DIR/stats || fail "stats entries"
+grep -q "est. elements *99[0-9][0-9][0-9]\|est. elements *100[0-9][0-9][0-9]" \
+    $DIR/stats || fail "stats estimate"
+
+# Convert to raw bits and back
+$BT convert -r $DIR/a.bloom $DIR/a.raw
+$BT convert -R -n 100000 -e 0.01 $DIR/a.raw $DIR/r.bloom
+$BT query $DIR/r.bloom $DIR/keys | cmp -s - $DIR/keys || fail "convert"
+if $BT convert -R -n 200000 -e 0.01 $DIR/a.raw $DIR/x.bloom 2> /dev/null; then
+    fail "converted raw bits of the wrong size"
+fi
+
+# Fold
+$BT build -P -n 100000 -e 0.01 -o $DIR/p.bloom $DIR/keys
+$BT fold -f 1 -o $DIR/f1.bloom $DIR/p.bloom
+$BT fold -s 100000 -o $DIR/f2.bloom $DIR/p.bloom
+$BT stats $DIR/f1.bloom | grep -q "bytes *65536" || fail "fold -f size"
+$BT stats $DIR/f2.bloom | grep -q "bytes *65536" || fail "fold -s size"
+$BT query $DIR/f1.bloom $DIR/keys | cmp -s - $DIR/keys || fail "fold query"
+if $BT fold -f 1 -o $DIR/x.bloom $DIR/a.bloom 2> /dev/null; then
+    fail "folded a filter built without -P"
+fi
+
+echo "----- DONE bloomtool tests -----"
@@ -0,0 +1,321 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Parallel false positive rate validation, the multithreaded counterpart
+ * of 'test-libbloom -G'.
+ *
+ * Usage: test-collisions [-t THREADS] [-f FLAGS] [-s SAMPLES] [-r SEED]
+ *                        START END INCREMENT ERROR
+ *
+ * For every ENTRIES in START, START + INCREMENT, ... END a filter of
+ * ENTRIES and ERROR (created with bloom_init3() and FLAGS) is filled with
+ * ENTRIES elements, counting the collisions while adding. Then SAMPLES
+ * (default 1000000) elements which were never added are checked to
+ * measure the false positive rate of the full filter.
+ *
+ * The filters are spread over THREADS threads (default: all online CPUs).
+ * Each filter gets its own key stream, derived from SEED (default random,
+ * printed to stderr) and ENTRIES, so results are reproducible regardless
+ * of the number of threads.
+ *
+ * Output is one line per filter, in order, with the columns of the
+ * collision_data files (so misc/collisions/dograph works on it):
+ *
+ *     entries error count collisions collision-rate bytes
+ *
+ * followed by the 95% (Wilson) confidence interval of the collision rate,
+ * the measured false positive rate and its confidence interval, and the
+ * false positive rate expected from the filter's actual size and hashes:
+ *
+ *     rate-low rate-high fp-rate fp-low fp-high fp-expected
+ *
+ * A summary over all filters is printed to stderr. The exit status is 1
+ * if the pooled false positive rate is significantly (99.9%) above the
+ * expected one.
+ *
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bloom.h"
+
+struct point
+{
+  unsigned long int entries;
+  unsigned long int collisions;
+  unsigned long int fp;
+  unsigned long int bytes;
+  double expected;
+  int done;
+};
+
+static struct point * points;
+static unsigned long int npoints;
+static unsigned long int next_point = 0;
+static double error;
+static unsigned int flags = 0;
+static unsigned long int samples = 1000000;
+static uint64_t seed;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+
+static uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+
+/*
+ * Wilson score interval of x successes out of n at the given z.
+ *
+ */
+static void wilson(unsigned long int x, unsigned long int n, double z,
+                   double * low, double * high)
+{
+  if (n == 0) {
+    *low = 0;
+    *high = 1;
+    return;
+  }
+
+  double p = (double)x / n;
+  double z2 = z * z;
+  double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+  double half = z / (1 + z2 / n) * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n));
+
+  *low = center - half < 0 ? 0 : center - half;
+  *high = center + half;
+}
+
+
+/*
+ * Expected false positive rate of a BLOOM_PAGED filter: a blocked bloom
+ * filter whose pages hold a Poisson distributed number of elements, the
+ * k (distinct) bits of each within one page.
+ *
+ */
+static double paged_expected(const struct bloom * bloom,
+                             unsigned long int entries)
+{
+  double page_bits = 32768;
+  double k = bloom->hashes;
+  double lambda = entries / (bloom->bits / page_bits);
+  double spread = 12 * sqrt(lambda) + 50;
+  double j = lambda > spread ? floor(lambda - spread) : 0;
+  double fp = 0;
+
+  for (; j < lambda + spread; j++) {
+    double pmf = exp(j * log(lambda) - lambda - lgamma(j + 1));
+    fp += pmf * pow(1 - pow(1 - k / page_bits, j), k);
+  }
+
+  return fp;
+}
+
+
+static void run(struct point * point)
+{
+  struct bloom bloom;
+  uint64_t key[2];
+  unsigned long int n;
+
+  if (bloom_init3(&bloom, point->entries, error, flags)) {
+    fprintf(stderr, "error: unable to create filter of %lu\n", point->entries);
+    exit(1);
+  }
+
+  key[0] = splitmix64(seed ^ splitmix64(point->entries));
+
+  for (n = 0; n < point->entries; n++) {
+    key[1] = n;
+    if (bloom_add(&bloom, key, sizeof(key))) { point->collisions++; }
+  }
+
+  for (n = 0; n < point->entries; n++) {
+    key[1] = n;
+    if (!bloom_check(&bloom, key, sizeof(key))) {
+      fprintf(stderr, "error: data saved in filter is not there!\n");
+      exit(1);
+    }
+  }
+
+  for (n = point->entries; n < point->entries + samples; n++) {
+    key[1] = n;
+    point->fp += bloom_check(&bloom, key, sizeof(key));
+  }
+
+  double k = bloom.hashes;
+  if (flags & BLOOM_PAGED) {
+    point->expected = paged_expected(&bloom, point->entries);
+  } else {
+    point->expected = pow(1 - exp(-k * point->entries / bloom.bits), k);
+  }
+  point->bytes = bloom.bytes;
+
+  bloom_free(&bloom);
+}
+
+
+static void * worker(void * arg)
+{
+  while (1) {
+    unsigned long int p = __atomic_fetch_add(&next_point, 1, __ATOMIC_RELAXED);
+    if (p >= npoints) {
+      return NULL;
+    }
+
+    run(&points[p]);
+
+    pthread_mutex_lock(&lock);
+    points[p].done = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+
+static void usage()
+{
+  printf("usage: test-collisions [-t THREADS] [-f FLAGS] [-s SAMPLES] "
+         "[-r SEED]\n");
+  printf("                       START END INCREMENT ERROR\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int have_seed = 0;
+  unsigned long int p;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:f:s:r:")) != -1) {
+    switch (opt) {
+    case 't': threads = atoi(optarg); break;
+    case 'f': flags = strtoul(optarg, NULL, 0); break;
+    case 's': samples = strtoul(optarg, NULL, 10); break;
+    case 'r': seed = strtoull(optarg, NULL, 0); have_seed = 1; break;
+    default: usage();
+    }
+  }
+
+  if (optind != argc - 4) {
+    usage();
+  }
+
+  unsigned long int start = strtoul(argv[optind], NULL, 10);
+  unsigned long int end = strtoul(argv[optind + 1], NULL, 10);
+  unsigned long int inc = strtoul(argv[optind + 2], NULL, 10);
+  error = atof(argv[optind + 3]);
+
+  if (inc == 0 || start > end || threads < 1) {
+    usage();
+  }
+
+  if (!have_seed) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, &seed, sizeof(seed)) != sizeof(seed)) {
+      fprintf(stderr, "error: unable to read /dev/urandom\n");
+      return 1;
+    }
+    close(fd);
+  }
+  fprintf(stderr, "# seed 0x%016lx, %ld threads\n", (unsigned long)seed,
+          threads);
+
+  npoints = (end - start) / inc + 1;
+  points = (struct point *)calloc(npoints, sizeof(struct point));
+  if (points == NULL) {
+    fprintf(stderr, "error: out of memory\n");
+    return 1;
+  }
+  for (p = 0; p < npoints; p++) {
+    points[p].entries = start + p * inc;
+  }
+
+  pthread_t * tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  long t;
+  for (t = 0; t < threads; t++) {
+    if (pthread_create(&tids[t], NULL, worker, NULL)) {
+      fprintf(stderr, "error: unable to create threads\n");
+      return 1;
+    }
+  }
+
+  unsigned long int added = 0;
+  unsigned long int collisions = 0;
+  unsigned long int sampled = 0;
+  unsigned long int fp = 0;
+  double expected = 0;
+  double low, high, fp_low, fp_high;
+
+  for (p = 0; p < npoints; p++) {
+    pthread_mutex_lock(&lock);
+    while (!points[p].done) {
+      pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    struct point * point = &points[p];
+    wilson(point->collisions, point->entries, 1.96, &low, &high);
+    wilson(point->fp, samples, 1.96, &fp_low, &fp_high);
+
+    printf("%lu %f %lu %lu %f %lu %f %f %f %f %f %f\n",
+           point->entries, error, point->entries, point->collisions,
+           (double)point->collisions / point->entries, point->bytes,
+           low, high, samples ? (double)point->fp / samples : 0,
+           fp_low, fp_high, point->expected);
+    fflush(stdout);
+
+    added += point->entries;
+    collisions += point->collisions;
+    sampled += samples;
+    fp += point->fp;
+    expected += point->expected * samples;
+  }
+
+  for (t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+  }
+
+  wilson(collisions, added, 1.96, &low, &high);
+  fprintf(stderr, "# %lu filters, %lu added, collision rate %g "
+          "(95%%: %g - %g)\n", npoints, added,
+          (double)collisions / added, low, high);
+
+  int rv = 0;
+  if (sampled > 0) {
+    expected /= sampled;
+    wilson(fp, sampled, 1.96, &low, &high);
+    fprintf(stderr, "# %lu sampled, false positive rate %g "
+            "(95%%: %g - %g), expected %g\n",
+            sampled, (double)fp / sampled, low, high, expected);
+    wilson(fp, sampled, 3.29, &low, &high);
+    if (low > expected) {
+      fprintf(stderr, "error: false positive rate is above expected\n");
+      rv = 1;
+    }
+  }
+
+  free(tids);
+  free(points);
+
+  return rv;
+}
@@ -77,6 +77,52 @@ void add_and_test(int entries, double error, uint64_t count,
 }
 
 
+/*
+ * Compare checking 64 bit integers with bloom_check(), bloom_check_u64()
+ * and bloom_check_u64_array().
+ *
+ */
+void u64_test(int entries, double error)
+{
+  struct bloom bloom;
+  uint64_t * keys = (uint64_t *)malloc(entries * sizeof(uint64_t));
+  unsigned char * results = (unsigned char *)malloc(entries);
+  uint64_t found[3] = { 0, 0, 0 };
+  int n;
+
+  assert(bloom_init(&bloom, entries, error) == 0);
+  for (n = 0; n < entries; n++) {
+    keys[n] = n;
+  }
+  assert(bloom_add_u64_array(&bloom, keys, entries / 2, NULL) == 0);
+
+  uint64_t t1 = get_current_time_millis();
+  for (n = 0; n < entries; n++) {
+    found[0] += bloom_check(&bloom, &keys[n], sizeof(uint64_t));
+  }
+  uint64_t t2 = get_current_time_millis();
+  for (n = 0; n < entries; n++) {
+    found[1] += bloom_check_u64(&bloom, keys[n]);
+  }
+  uint64_t t3 = get_current_time_millis();
+  assert(bloom_check_u64_array(&bloom, keys, entries, results) == 0);
+  for (n = 0; n < entries; n++) {
+    found[2] += results[n];
+  }
+  uint64_t t4 = get_current_time_millis();
+
+  assert(found[0] == found[1] && found[0] == found[2]);
+
+  printf("u64_test:     %10d (%1.4f): %10" PRIu64 " found; CHECK: %6" PRIu64
+         " ms, U64: %6" PRIu64 " ms, ARRAY: %6" PRIu64 " ms\n",
+         entries, error, found[0], (t2-t1), (t3-t2), (t4-t3));
+
+  bloom_free(&bloom);
+  free(keys);
+  free(results);
+}
+
+
 void basic()
 {
   printf("libloom %s\n", bloom_version());
@@ -99,6 +145,10 @@ void basic()
   n = 10000000;
   add_and_test(n, 0.001, n, 1);
   add_and_test(n, 0.001, n, 0);
+
+  u64_test(1000000, 0.01);
+  u64_test(10000000, 0.01);
+  u64_test(100000000, 0.01);
 }
 
 
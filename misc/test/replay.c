@@ -0,0 +1,289 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Replay a trace recorded with bloom_trace_start() (see bloom_trace.h)
+ * against filters of one or more configurations.
+ *
+ * Usage: test-replay [-e ENTRIES] [-p ERROR] [-f FLAGS]... TRACE
+ *
+ * Every FLAGS (bloom_init3() flags, as a number; by default 0, POW2,
+ * ENHANCED and PAGED in turn) gets a filter of ENTRIES (default: the
+ * number of adds in the trace, so a sampled trace fills it as much as the
+ * traced filters were) and ERROR (default 0.01). The calls of the trace
+ * are replayed on it, in order, twice:
+ *
+ *   - untimed, for the throughput of the whole replay
+ *   - timing every call, for the latency percentiles of checks and adds
+ *
+ * Traces of hashes replay elements of the recorded lengths made of the
+ * recorded hash, so equal elements stay equal and hashing costs the same.
+ *
+ * Output is one line per configuration with the throughput and the hit
+ * ratio of the checks (the ratio recorded in the trace is printed first),
+ * followed by the percentiles. Latencies include the cost of reading the
+ * clock, which is printed too.
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloom_trace.h"
+
+#define MAGIC "libbloomtrace1"
+#define MAX_CONFIGS 16
+
+struct op
+{
+  unsigned char op;
+  unsigned char result;
+  unsigned int len;
+  unsigned char * key;
+};
+
+static struct op * ops;
+static unsigned long int count;
+static unsigned long int adds;
+static unsigned long int recorded_hits;
+
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static void fail(const char * message)
+{
+  fprintf(stderr, "error: %s\n", message);
+  exit(1);
+}
+
+
+/*
+ * Read the whole trace into 'ops'.
+ *
+ */
+static void load(const char * filename)
+{
+  char magic[sizeof(MAGIC)];
+  uint32_t flags, sample;
+  unsigned long int room = 1024;
+  unsigned char header[14];
+
+  FILE * fp = fopen(filename, "r");
+  if (fp == NULL) {
+    fail("unable to open trace");
+  }
+
+  memset(magic, 0, sizeof(magic));
+  if (fread(magic, strlen(MAGIC), 1, fp) != 1 || strcmp(magic, MAGIC) ||
+      fread(&flags, sizeof(uint32_t), 1, fp) != 1 ||
+      fread(&sample, sizeof(uint32_t), 1, fp) != 1) {
+    fail("not a trace");
+  }
+
+  ops = (struct op *)malloc(room * sizeof(struct op));
+
+  while (fread(header, sizeof(header), 1, fp) == 1) {
+    struct op * op;
+    uint32_t len;
+    uint64_t h;
+
+    if (count == room) {
+      room *= 2;
+      ops = (struct op *)realloc(ops, room * sizeof(struct op));
+    }
+    if (ops == NULL) {
+      fail("out of memory");
+    }
+
+    op = &ops[count++];
+    memcpy(&len, header + 10, sizeof(uint32_t));
+    op->op = header[8];
+    op->result = header[9];
+    op->len = len < BLOOM_TRACE_MAX_KEY ? len : BLOOM_TRACE_MAX_KEY;
+    op->key = (unsigned char *)malloc(op->len + 1);
+    if (op->key == NULL) {
+      fail("out of memory");
+    }
+
+    if (flags & BLOOM_TRACE_KEYS) {
+      if (op->len > 0 && fread(op->key, op->len, 1, fp) != 1) {
+        fail("truncated trace");
+      }
+    } else {
+      unsigned int n;
+      if (fread(&h, sizeof(uint64_t), 1, fp) != 1) {
+        fail("truncated trace");
+      }
+      for (n = 0; n < op->len; n++) {
+        op->key[n] = (unsigned char)(h >> (8 * (n % 8)));
+      }
+    }
+
+    if (op->op == BLOOM_TRACE_ADD) {
+      adds++;
+    } else {
+      recorded_hits += op->result;
+    }
+  }
+
+  fclose(fp);
+
+  printf("# %lu calls (%lu adds), 1 in %u elements, %s\n", count, adds,
+         sample, flags & BLOOM_TRACE_KEYS ? "elements" : "hashes");
+}
+
+
+static int compare(const void * a, const void * b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+
+static void percentiles(const char * name, uint64_t * ns, unsigned long n)
+{
+  if (n == 0) {
+    return;
+  }
+
+  qsort(ns, n, sizeof(uint64_t), compare);
+  printf("    %-5s p50 %5lu  p90 %5lu  p99 %6lu  p99.9 %7lu  max %8lu ns\n",
+         name, (unsigned long)ns[n / 2], (unsigned long)ns[n * 9 / 10],
+         (unsigned long)ns[n * 99 / 100], (unsigned long)ns[n * 999 / 1000],
+         (unsigned long)ns[n - 1]);
+}
+
+
+static void replay(unsigned long int entries, double error, unsigned int flags)
+{
+  struct bloom bloom;
+  unsigned long int hits = 0;
+  unsigned long int checks = 0;
+  unsigned long int i;
+
+  if (bloom_init3(&bloom, entries, error, flags)) {
+    fail("invalid filter parameters");
+  }
+
+  uint64_t t1 = now_ns();
+  for (i = 0; i < count; i++) {
+    struct op * op = &ops[i];
+    if (op->op == BLOOM_TRACE_ADD) {
+      bloom_add(&bloom, op->key, op->len);
+    } else {
+      hits += bloom_check(&bloom, op->key, op->len);
+    }
+  }
+  uint64_t t2 = now_ns();
+
+  printf("flags 0x%02x: %10lu bytes, %8.2f Mops/s, %6.1f ns/call, "
+         "hits %.4f (recorded %.4f)\n", flags, bloom.bytes,
+         count * 1000.0 / (t2 - t1), (double)(t2 - t1) / count,
+         count > adds ? (double)hits / (count - adds) : 0,
+         count > adds ? (double)recorded_hits / (count - adds) : 0);
+
+  uint64_t * check_ns = (uint64_t *)malloc(count * sizeof(uint64_t));
+  uint64_t * add_ns = (uint64_t *)malloc(count * sizeof(uint64_t));
+  if (check_ns == NULL || add_ns == NULL) {
+    fail("out of memory");
+  }
+
+  bloom_reset(&bloom);
+  for (i = 0; i < count; i++) {
+    struct op * op = &ops[i];
+    uint64_t t = now_ns();
+    if (op->op == BLOOM_TRACE_ADD) {
+      bloom_add(&bloom, op->key, op->len);
+      add_ns[i - checks] = now_ns() - t;
+    } else {
+      bloom_check(&bloom, op->key, op->len);
+      check_ns[checks++] = now_ns() - t;
+    }
+  }
+
+  percentiles("check", check_ns, checks);
+  percentiles("add", add_ns, count - checks);
+
+  free(check_ns);
+  free(add_ns);
+  bloom_free(&bloom);
+}
+
+
+static void usage()
+{
+  printf("usage: test-replay [-e ENTRIES] [-p ERROR] [-f FLAGS]... TRACE\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  unsigned int configs[MAX_CONFIGS] = { 0, BLOOM_POW2, BLOOM_ENHANCED,
+                                        BLOOM_PAGED };
+  unsigned int nconfigs = 0;
+  unsigned long int entries = 0;
+  double error = 0.01;
+  unsigned int c;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "e:p:f:")) != -1) {
+    switch (opt) {
+    case 'e': entries = strtoul(optarg, NULL, 10); break;
+    case 'p': error = atof(optarg); break;
+    case 'f':
+      if (nconfigs == MAX_CONFIGS) {
+        usage();
+      }
+      configs[nconfigs++] = strtoul(optarg, NULL, 0);
+      break;
+    default: usage();
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage();
+  }
+
+  if (nconfigs == 0) {
+    nconfigs = 4;
+  }
+
+  load(argv[optind]);
+  if (count == 0) {
+    fail("empty trace");
+  }
+
+  if (entries == 0) {
+    entries = adds < 1000 ? 1000 : adds;
+  }
+
+  uint64_t t = now_ns();
+  for (c = 0; c < 1000; c++) {
+    now_ns();
+  }
+  printf("# %lu entries, error %f, clock read %.1f ns\n", entries, error,
+         (now_ns() - t) / 1000.0);
+
+  for (c = 0; c < nconfigs; c++) {
+    replay(entries, error, configs[c]);
+  }
+
+  return 0;
+}
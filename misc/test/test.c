@@ -8,6 +8,8 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +20,17 @@
 #include <unistd.h>
 
 #include "bloom.h"
+#include "bloom_bank.h"
+#include "bloom_cms.h"
+#include "bloom_disk.h"
+#include "bloom_handle.h"
+#include "bloom_iblt.h"
+#include "bloom_pool.h"
+#include "bloom_prefix.h"
+#include "bloom_qf.h"
+#include "bloom_sparse.h"
+#include "bloom_trace.h"
+#include "murmurhash2.h"
 
 #ifdef __linux
 #include <sys/time.h>
@@ -141,6 +154,1893 @@ static void merge_test(unsigned int entries, double error, int count)
 }
 
 
+/** ***************************************************************************
+ * Test bloom_merge_files operation.
+ *
+ */
+static void merge_files_test()
+{
+  char * names[] = { "/tmp/libbloom.mf0.test", "/tmp/libbloom.mf1.test",
+                     "/tmp/libbloom.mf2.test" };
+  char * output = "/tmp/libbloom.mf.test";
+  char * missing[] = { names[0], "/tmp/libbloom.mf-missing.test" };
+  struct bloom bloom;
+  struct bloom merged;
+  struct bloom loaded;
+  uint64_t n;
+  int f;
+
+  printf("----- bloom_merge_files tests -----\n");
+
+  // Big enough for the bit fields to be merged in several chunks.
+  for (f = 0; f < 3; f++) {
+    assert(bloom_init2(&bloom, 5000000, 0.01) == 0);
+    for (n = f; n < 300000; n += 3) {
+      bloom_add(&bloom, &n, sizeof(n));
+    }
+    if (f == 0) {
+      assert(bloom_init2(&merged, 5000000, 0.01) == 0);
+    }
+    assert(bloom_merge(&merged, &bloom) == 0);
+    unlink(names[f]);
+    assert(bloom_save(&bloom, names[f]) == 0);
+    bloom_free(&bloom);
+  }
+
+  unlink(output);
+  assert(bloom_merge_files(output, names, 3) == 0);
+  assert(bloom_load(&loaded, output) == 0);
+  assert(loaded.bytes == merged.bytes && loaded.hashes == merged.hashes);
+  assert(!memcmp(loaded.bf, merged.bf, merged.bytes));
+  for (n = 0; n < 300000; n++) {
+    assert(bloom_check(&loaded, &n, sizeof(n)) == 1);
+  }
+  bloom_free(&loaded);
+
+  // Output may be one of the inputs.
+  assert(bloom_merge_files(names[0], names, 3) == 0);
+  assert(bloom_load(&loaded, names[0]) == 0);
+  assert(!memcmp(loaded.bf, merged.bf, merged.bytes));
+  bloom_free(&loaded);
+  bloom_free(&merged);
+
+  assert(bloom_merge_files(output, names, 0) == 1);
+  assert(bloom_merge_files("", names, 3) == 1);
+  unlink(missing[1]);
+  assert(bloom_merge_files(output, missing, 2) == 2);
+
+  assert(bloom_init2(&bloom, 5000001, 0.01) == 0);
+  unlink(names[2]);
+  assert(bloom_save(&bloom, names[2]) == 0);
+  bloom_free(&bloom);
+  assert(bloom_merge_files(output, names, 3) == 3);
+
+  // A truncated input is rejected before anything is written.
+  assert(truncate(names[1], 1000) == 0);
+  assert(bloom_merge_files(output, names, 2) == 2);
+
+  for (f = 0; f < 3; f++) {
+    unlink(names[f]);
+  }
+  unlink(output);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_save_background saves the filter as of the call while adds
+ * go on.
+ *
+ */
+static void save_background_test()
+{
+  char * filename = "/tmp/libbloom.bg.test";
+  char * dirname = "/tmp/libbloom.bg-dir.test";
+  struct bloom_snapshot snapshot;
+  struct bloom bloom;
+  struct bloom copy;
+  struct bloom loaded;
+  uint64_t n;
+  int rv;
+
+  printf("----- bloom_save_background tests -----\n");
+
+  assert(bloom_init2(&bloom, 5000000, 0.01) == 0);
+  assert(bloom_save_background(&bloom, filename, &snapshot) == 0);
+  assert(bloom_save_wait(&snapshot, 1) == 0);
+  for (n = 0; n < 300000; n++) {
+    bloom_add(&bloom, &n, sizeof(n));
+  }
+  memcpy(&copy, &bloom, sizeof(struct bloom));
+  copy.bf = (unsigned char *)malloc(bloom.bytes);
+  memcpy(copy.bf, bloom.bf, bloom.bytes);
+
+  // Adds made while the save runs are not in the saved file.
+  assert(bloom_save_background(&bloom, filename, &snapshot) == 0);
+  for (n = 300000; n < 600000; n++) {
+    bloom_add(&bloom, &n, sizeof(n));
+  }
+  while ((rv = bloom_save_wait(&snapshot, 0)) == 2) {
+    usleep(1000);
+  }
+  assert(rv == 0);
+  assert(bloom_save_wait(&snapshot, 1) == 1);
+
+  assert(bloom_load(&loaded, filename) == 0);
+  assert(loaded.bytes == copy.bytes);
+  assert(!memcmp(loaded.bf, copy.bf, copy.bytes));
+  bloom_free(&loaded);
+  free(copy.bf);
+
+  // The file is only replaced once complete.
+  rmdir(dirname);
+  assert(mkdir(dirname, 0755) == 0);
+  assert(bloom_save_background(&bloom, dirname, &snapshot) == 0);
+  assert(bloom_save_wait(&snapshot, 1) == 1);
+  assert(rmdir(dirname) == 0);
+
+  assert(bloom_save_background(&bloom, "/no-such-directory/foo",
+                               &snapshot) == 1);
+  assert(bloom_save_background(&bloom, "", &snapshot) == 1);
+  assert(bloom_save_wait(&snapshot, 0) == 1);
+  bloom_free(&bloom);
+  assert(bloom_save_background(&bloom, filename, &snapshot) == 1);
+  unlink(filename);
+}
+
+
+/** ***************************************************************************
+ * Test incremental hashing and bloom_add_iov/bloom_check_iov against the
+ * contiguous functions.
+ *
+ */
+static void iov_test()
+{
+  struct bloom bloom;
+  struct murmurhash2_state state;
+  struct iovec iov[3];
+  unsigned char buf[64];
+  int len, i, j, n;
+
+  printf("----- iov tests -----\n");
+
+  for (n = 0; n < sizeof(buf); n++) {
+    buf[n] = (unsigned char)(n * 37 + 11);
+  }
+
+  // Every split of every length hashes the same as the whole buffer
+  for (len = 0; len <= sizeof(buf); len++) {
+    unsigned int h = murmurhash2(buf, len, 0x1234);
+    for (i = 0; i <= len; i++) {
+      for (j = i; j <= len; j++) {
+        murmurhash2_init(&state, 0x1234, len);
+        murmurhash2_update(&state, buf, i);
+        murmurhash2_update(&state, buf + i, j - i);
+        murmurhash2_update(&state, buf + j, len - j);
+        assert(murmurhash2_final(&state) == h);
+      }
+    }
+  }
+
+  struct iovec empty = { NULL, 0 };
+  assert(bloom_init2(&bloom, 10000, 0.01) == 0);
+  bloom.ready = 0;
+  assert(bloom_add_iov(&bloom, &empty, 1) == -1);
+  assert(bloom_check_iov(&bloom, &empty, 1) == -1);
+  bloom.ready = 1;
+
+  // Elements added one way are found the other way
+  for (n = 0; n < 2000; n++) {
+    memcpy(buf, &n, sizeof(int));
+    len = 8 + n % 50;
+    iov[0].iov_base = buf;
+    iov[0].iov_len = n % 7;
+    iov[1].iov_base = buf + iov[0].iov_len;
+    iov[1].iov_len = n % 3;
+    iov[2].iov_base = buf + iov[0].iov_len + iov[1].iov_len;
+    iov[2].iov_len = len - iov[0].iov_len - iov[1].iov_len;
+    if (n % 2) {
+      assert(bloom_add_iov(&bloom, iov, 3) >= 0);
+      assert(bloom_check(&bloom, buf, len) == 1);
+    } else {
+      assert(bloom_add(&bloom, buf, len) >= 0);
+      assert(bloom_check_iov(&bloom, iov, 3) == 1);
+      assert(bloom_add_iov(&bloom, iov, 3) == 1);
+    }
+  }
+
+  assert(bloom_check_iov(&bloom, &empty, 1) == bloom_check(&bloom, "", 0));
+  assert(bloom_check_iov(&bloom, iov, 0) == bloom_check(&bloom, "", 0));
+
+  bloom_free(&bloom);
+}
+
+
+/** ***************************************************************************
+ * Test filters using 64-bit hash material (BLOOM_HASH64).
+ *
+ */
+static void hash64_test()
+{
+  char * filename = "/tmp/libbloom.hash64.test";
+  struct bloom bloom;
+  struct bloom bloom2;
+  struct murmurhash64a_state state;
+  unsigned char buf[64];
+  int len, i, fp;
+  uint64_t n;
+
+  printf("----- BLOOM_HASH64 tests -----\n");
+
+  for (n = 0; n < sizeof(buf); n++) {
+    buf[n] = (unsigned char)(n * 53 + 7);
+  }
+
+  for (len = 0; len <= sizeof(buf); len++) {
+    uint64_t h = murmurhash64a(buf, len, 0x1234);
+    for (i = 0; i <= len; i++) {
+      murmurhash64a_init(&state, 0x1234, len);
+      murmurhash64a_update(&state, buf, i / 2);
+      murmurhash64a_update(&state, buf + i / 2, i - i / 2);
+      murmurhash64a_update(&state, buf + i, len - i);
+      assert(murmurhash64a_final(&state) == h);
+    }
+  }
+
+  assert(bloom_init3(&bloom, 100000, 0.01, 0x80) == 1);
+  assert(bloom_init3(&bloom, 999, 0.01, BLOOM_HASH64) == 1);
+  assert(bloom_init3(&bloom, 100000, 0.01, BLOOM_HASH64) == 0);
+  bloom_print(&bloom);
+
+  for (n = 0; n < 100000; n++) {
+    bloom_add(&bloom, &n, sizeof(uint64_t));
+  }
+  fp = 0;
+  for (n = 0; n < 200000; n++) {
+    int rv = bloom_check(&bloom, &n, sizeof(uint64_t));
+    if (n < 100000) {
+      assert(rv == 1);
+    } else {
+      fp += rv;
+    }
+  }
+  printf("%d false positives in 100000 checks\n", fp);
+  assert(fp < 100000 * 0.01 * 1.2);
+
+  struct iovec iov[2] = { { &n, 3 }, { (char *)&n + 3, 5 } };
+  for (n = 0; n < 100; n++) {
+    assert(bloom_check_iov(&bloom, iov, 2) == 1);
+  }
+
+  unlink(filename);
+  assert(bloom_save(&bloom, filename) == 0);
+  assert(bloom_load(&bloom2, filename) == 0);
+  assert(bloom2.flags == BLOOM_HASH64);
+  assert(bloom2.entries == bloom.entries);
+  for (n = 0; n < 200000; n++) {
+    assert(bloom_check(&bloom2, &n, sizeof(uint64_t)) ==
+           bloom_check(&bloom, &n, sizeof(uint64_t)));
+  }
+  bloom_free(&bloom2);
+
+  // Different hashing, so never compatible with default filters
+  assert(bloom_init2(&bloom2, 100000, 0.01) == 0);
+  assert(bloom_merge(&bloom2, &bloom) == 1);
+  bloom_free(&bloom2);
+
+  bloom.flags = 0x80;
+  unlink(filename);
+  assert(bloom_save(&bloom, filename) == 0);
+  assert(bloom_load(&bloom2, filename) == 12);
+
+  bloom_free(&bloom);
+  unlink(filename);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_build_parallel produces the same filter as bloom_add.
+ *
+ */
+static void build_parallel_test(unsigned long int entries, unsigned int flags,
+                                unsigned long int count, int threads)
+{
+  struct bloom bloom;
+  struct bloom bloom2;
+  unsigned long int n;
+
+  printf("----- bloom_build_parallel(%lu, 0x%x, %lu, %d) -----\n",
+         entries, flags, count, threads);
+
+  uint64_t * keys = (uint64_t *)malloc(count * sizeof(uint64_t));
+  struct iovec * iov = (struct iovec *)malloc(count * sizeof(struct iovec));
+  assert(keys != NULL && iov != NULL);
+
+  assert(bloom_init3(&bloom, entries, 0.01, flags) == 0);
+  assert(bloom_init3(&bloom2, entries, 0.01, flags) == 0);
+
+  for (n = 0; n < count; n++) {
+    keys[n] = n * 2654435761ul;
+    iov[n].iov_base = &keys[n];
+    iov[n].iov_len = 1 + n % sizeof(uint64_t);
+    bloom_add(&bloom, iov[n].iov_base, iov[n].iov_len);
+  }
+
+  assert(bloom_build_parallel(&bloom2, iov, count, threads) == 0);
+  assert(memcmp(bloom.bf, bloom2.bf, bloom.bytes) == 0);
+
+  bloom_free(&bloom);
+  bloom_free(&bloom2);
+  free(keys);
+  free(iov);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_init_budget choices and that its error estimate holds.
+ *
+ */
+static void budget_test()
+{
+  char * filename = "/tmp/libbloom.budget.test";
+  struct bloom_budget budget;
+  struct bloom bloom;
+  struct bloom bloom2;
+  uint64_t n;
+  int fp = 0;
+
+  printf("----- bloom_init_budget tests -----\n");
+
+  memset(&budget, 0, sizeof(budget));
+  budget.goal = BLOOM_MIN_ERROR;
+  budget.max_bytes = 1000;
+  assert(bloom_init_budget(&bloom, &budget) == 1);     // no entries
+  budget.entries = 1000;
+  budget.goal = 0;
+  assert(bloom_init_budget(&bloom, &budget) == 1);     // no goal
+  budget.goal = BLOOM_MIN_COST;
+  assert(bloom_init_budget(&bloom, &budget) == 1);     // no max_error
+  budget.goal = BLOOM_MIN_ERROR;
+  budget.max_bytes = 0;
+  assert(bloom_init_budget(&bloom, &budget) == 1);     // no max_bytes
+  budget.max_bytes = 100;
+  budget.max_error = 0.001;
+  assert(bloom_init_budget(&bloom, &budget) == 1);     // can't be met
+
+  // Small filters are fine.
+  memset(&budget, 0, sizeof(budget));
+  budget.entries = 10;
+  budget.max_bytes = 16;
+  budget.goal = BLOOM_MIN_ERROR;
+  assert(bloom_init_budget(&bloom, &budget) == 0);
+  assert(bloom.bytes == 16 && bloom.bits == 128 && bloom.hashes == 9);
+  assert(bloom.flags == (BLOOM_POW2 | BLOOM_ENHANCED | BLOOM_HASH64));
+  for (n = 0; n < 10; n++) {
+    assert(bloom_add(&bloom, &n, sizeof(n)) >= 0);
+  }
+  for (n = 0; n < 10; n++) {
+    assert(bloom_check(&bloom, &n, sizeof(n)) == 1);
+  }
+  bloom_free(&bloom);
+
+  // 8 bits per entry, ln(2) * 8 = 5.5 hashes but 6 is (barely) better.
+  memset(&budget, 0, sizeof(budget));
+  budget.entries = 100000;
+  budget.max_bytes = 100000;
+  budget.goal = BLOOM_MIN_ERROR;
+  assert(bloom_init_budget(&bloom, &budget) == 0);
+  assert(bloom.bytes == 100000 && bloom.hashes == 6);
+  assert(bloom.flags == (BLOOM_ENHANCED | BLOOM_HASH64));
+  assert(budget.error == bloom.error);
+  assert(budget.error > 0.0215 && budget.error < 0.0217);
+  assert(budget.ns_miss > 0 && budget.ns_miss < budget.ns_hit);
+
+  for (n = 0; n < budget.entries; n++) {
+    assert(bloom_add(&bloom, &n, sizeof(n)) >= 0);
+  }
+  for (n = budget.entries; n < 11 * budget.entries; n++) {
+    fp += bloom_check(&bloom, &n, sizeof(n));
+  }
+  printf("expected error %f, measured %f\n", budget.error, fp / 1000000.0);
+  assert(fp > 0.9 * budget.error * 1000000);
+  assert(fp < 1.1 * budget.error * 1000000);
+
+  // Filters from identical budgets are compatible.
+  unlink(filename);
+  assert(bloom_save(&bloom, filename) == 0);
+  assert(bloom_init_budget(&bloom2, &budget) == 0);
+  assert(bloom_merge(&bloom2, &bloom) == 0);
+  bloom_free(&bloom);
+  assert(bloom_load(&bloom, filename) == 0);
+  assert(memcmp(bloom.bf, bloom2.bf, bloom.bytes) == 0);
+  bloom_free(&bloom2);
+
+  // Same error but a different number of hashes are not.
+  budget.max_hashes = 5;
+  assert(bloom_init_budget(&bloom2, &budget) == 0);
+  assert(bloom2.hashes == 5);
+  assert(bloom_merge(&bloom2, &bloom) == 1);
+  bloom_free(&bloom2);
+  bloom_free(&bloom);
+  unlink(filename);
+
+  // Past the cache, the default cost model prefers one random probe and
+  // the rest within the same page.
+  memset(&budget, 0, sizeof(budget));
+  budget.entries = 1000000;
+  budget.max_error = 0.01;
+  budget.goal = BLOOM_MIN_COST;
+  assert(bloom_init_budget(&bloom, &budget) == 0);
+  assert(bloom.flags & BLOOM_PAGED);
+  assert(bloom.bytes % 4096 == 0 && budget.error <= 0.01);
+  for (n = 0; n < budget.entries; n++) {
+    assert(bloom_add(&bloom, &n, sizeof(n)) >= 0);
+  }
+  fp = 0;
+  for (n = budget.entries; n < 2 * budget.entries; n++) {
+    fp += bloom_check(&bloom, &n, sizeof(n));
+  }
+  printf("paged: expected error %f, measured %f\n", budget.error,
+         fp / 1000000.0);
+  assert(fp > 0.9 * budget.error * 1000000);
+  assert(fp < 1.1 * budget.error * 1000000);
+  bloom_free(&bloom);
+
+  assert(bloom_calibrate() == 0);
+
+  memset(&budget, 0, sizeof(budget));
+  budget.entries = 1000000;
+  budget.max_error = 0.01;
+  budget.max_hashes = 3;
+  budget.goal = BLOOM_MIN_COST;
+  assert(bloom_init_budget(&bloom, &budget) == 0);
+  assert(bloom.hashes <= 3 && budget.error <= 0.01);
+  bloom_print(&bloom);
+  printf("expected error %f, ns/op hit %.1f miss %.1f\n",
+         budget.error, budget.ns_hit, budget.ns_miss);
+  bloom_free(&bloom);
+
+  budget.max_hashes = 0;
+  budget.max_bytes = 1200000;
+  assert(bloom_init_budget(&bloom, &budget) == 0);
+  assert(bloom.bytes <= 1200000 && budget.error <= 0.01);
+  bloom_free(&bloom);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_fold keeps all elements and matches its error estimate.
+ *
+ */
+static void fold_test(unsigned int flags)
+{
+  struct bloom bloom;
+  struct bloom folded;
+  uint64_t n;
+  int fp = 0;
+
+  printf("----- bloom_fold(0x%x) -----\n", flags);
+
+  assert(bloom_init3(&bloom, 100000, 0.01, flags) == 0);
+  assert(bloom_fold(&bloom, 1) == 1);
+  bloom_free(&bloom);
+
+  flags |= BLOOM_POW2;
+  assert(bloom_init3(&bloom, 100000, 0.01, flags) == 0);
+  assert(bloom.bits == 1 << 20 && bloom.bytes == 1 << 17);
+  assert(bloom_init3(&folded, 100000, 0.01, flags) == 0);
+  assert(bloom_fold(&bloom, 0) == 1);
+  assert(bloom_fold(&bloom, 18) == 1);
+
+  // Folding an empty filter and then adding gives the same bits as adding
+  // and then folding.
+  assert(bloom_fold(&folded, 1) == 0);
+  assert(folded.bits == 1 << 19 && folded.bytes == 1 << 16);
+  for (n = 0; n < 100000; n++) {
+    assert(bloom_add(&bloom, &n, sizeof(n)) >= 0);
+    assert(bloom_add(&folded, &n, sizeof(n)) >= 0);
+  }
+  assert(bloom_fold(&bloom, 1) == 0);
+  assert(bloom_merge(&folded, &bloom) == 0);
+  assert(memcmp(bloom.bf, folded.bf, bloom.bytes) == 0);
+
+  for (n = 0; n < 100000; n++) {
+    assert(bloom_check(&bloom, &n, sizeof(n)) == 1);
+  }
+  for (n = 100000; n < 1100000; n++) {
+    fp += bloom_check(&bloom, &n, sizeof(n));
+  }
+  printf("expected error %f, measured %f\n", bloom.error, fp / 1000000.0);
+  assert(fp > 0.95 * bloom.error * 1000000);
+  assert(fp < 1.05 * bloom.error * 1000000);
+
+  assert(bloom_fold(&bloom, 2) == 0);
+  assert(bloom.bits == 1 << 17 && bloom_merge(&folded, &bloom) == 1);
+  for (n = 0; n < 100000; n++) {
+    assert(bloom_check(&bloom, &n, sizeof(n)) == 1);
+  }
+
+  bloom_free(&bloom);
+  bloom_free(&folded);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_handle: readers always see a complete filter while new ones
+ * are published.
+ *
+ */
+#define HANDLE_READERS 3
+#define HANDLE_VERSIONS 300
+
+static struct bloom_handle handle;
+static int handle_done = 0;
+
+
+static void * handle_reader(void * arg)
+{
+  unsigned long int * reads = (unsigned long int *)arg;
+  unsigned int token;
+  uint64_t n;
+
+  while (!__atomic_load_n(&handle_done, __ATOMIC_SEQ_CST)) {
+    struct bloom * bloom = bloom_handle_acquire(&handle, &token);
+    assert(bloom != NULL);
+    for (n = 0; n < 1000; n += 7) {
+      assert(bloom_check(bloom, &n, sizeof(n)) == 1);
+    }
+    bloom_handle_release(&handle, token);
+    assert(bloom_handle_check(&handle, &n, sizeof(n)) >= 0);
+    (*reads)++;
+  }
+
+  return NULL;
+}
+
+
+static void handle_version(struct bloom * bloom, uint64_t version)
+{
+  uint64_t n;
+
+  assert(bloom_init2(bloom, 1000, 0.01) == 0);
+  for (n = 0; n < 1000; n++) {
+    assert(bloom_add(bloom, &n, sizeof(n)) >= 0);
+  }
+  n = 1000000 + version;
+  assert(bloom_add(bloom, &n, sizeof(n)) >= 0);
+}
+
+
+static void handle_test()
+{
+  pthread_t readers[HANDLE_READERS];
+  unsigned long int reads[HANDLE_READERS];
+  struct bloom bloom;
+  unsigned int token;
+  uint64_t n;
+  int t;
+
+  printf("----- bloom_handle tests -----\n");
+
+  assert(bloom_handle_init(&handle) == 0);
+  assert(bloom_handle_check(&handle, "hello", 5) == -1);
+  assert(bloom_handle_acquire(&handle, &token) == NULL);
+  bloom_handle_release(&handle, token);
+
+  struct bloom unready = NULL_BLOOM_FILTER;
+  assert(bloom_handle_publish(&handle, &unready) == -1);
+
+  handle_version(&bloom, 0);
+  assert(bloom_handle_publish(&handle, &bloom) == 0);
+  assert(bloom.ready == 0 && bloom.bf == NULL);
+  n = 1000000;
+  assert(bloom_handle_check(&handle, &n, sizeof(n)) == 1);
+
+  for (t = 0; t < HANDLE_READERS; t++) {
+    reads[t] = 0;
+    assert(pthread_create(&readers[t], NULL, handle_reader, &reads[t]) == 0);
+  }
+
+  for (n = 1; n < HANDLE_VERSIONS; n++) {
+    handle_version(&bloom, n);
+    assert(bloom_handle_publish(&handle, &bloom) == 0);
+    uint64_t key = 1000000 + n;
+    assert(bloom_handle_check(&handle, &key, sizeof(key)) == 1);
+  }
+
+  __atomic_store_n(&handle_done, 1, __ATOMIC_SEQ_CST);
+  for (t = 0; t < HANDLE_READERS; t++) {
+    assert(pthread_join(readers[t], NULL) == 0);
+    printf("reader %d: %lu snapshots\n", t, reads[t]);
+  }
+
+  bloom_handle_free(&handle);
+  assert(bloom_handle_check(&handle, "hello", 5) == -1);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_check() (which probes several bits at a time where the CPU
+ * allows) against the bit by bit probing of bloom_check_u64(), across
+ * numbers of hashes, fill levels and sizes down to a few bytes.
+ *
+ */
+static void gather_test(unsigned int flags)
+{
+  double errors[] = { 0.5, 0.1, 0.01, 0.0001, 0.000000001 };
+  struct bloom bloom;
+  unsigned int e;
+  uint64_t n, key;
+
+  printf("----- bloom_check gather(0x%x) -----\n", flags);
+
+  for (e = 0; e < sizeof(errors) / sizeof(errors[0]); e++) {
+    assert(bloom_init3(&bloom, 10007, errors[e], flags) == 0);
+
+    // Up to three times overfilled, so the probes often hit every bit.
+    for (n = 0; n < 30000; n++) {
+      key = n * 0x9e3779b97f4a7c15ull;
+      bloom_add_u64(&bloom, key);
+      if (n % 1000 == 0) {
+        for (key = 0; key < 2000; key++) {
+          assert(bloom_check(&bloom, &key, sizeof(key)) ==
+                 bloom_check_u64(&bloom, key));
+        }
+      }
+    }
+
+    if (flags & BLOOM_POW2) {
+      // Down to 8 bytes, where every probe reads the last word.
+      while (bloom.bytes > 8) {
+        assert(bloom_fold(&bloom, 1) == 0);
+        for (key = 0; key < 2000; key++) {
+          assert(bloom_check(&bloom, &key, sizeof(key)) ==
+                 bloom_check_u64(&bloom, key));
+        }
+      }
+    }
+
+    bloom_free(&bloom);
+  }
+}
+
+
+/** ***************************************************************************
+ * Test BLOOM_PAGED filters, in memory and used from disk with bloom_disk.
+ *
+ */
+static void disk_test(unsigned int flags)
+{
+  char * filename = "/tmp/libbloom.disk.test";
+  char * filename2 = "/tmp/libbloom.disk2.test";
+  unsigned long int count = 200000;
+  unsigned long int n;
+  struct bloom bloom;
+  struct bloom loaded;
+  struct bloom_disk disk;
+  uint64_t * keys = (uint64_t *)malloc(2 * count * sizeof(uint64_t));
+  struct iovec * iov = (struct iovec *)malloc(2 * count * sizeof(struct iovec));
+  unsigned char * results = (unsigned char *)malloc(2 * count);
+
+  printf("----- bloom_disk(0x%x) -----\n", flags);
+
+  assert(bloom_init3(&bloom, count, 0.01, BLOOM_PAGED | BLOOM_POW2) == 1);
+  assert(bloom_init3(&bloom, count, 0.01, BLOOM_PAGED | BLOOM_ENHANCED) == 1);
+
+  assert(bloom_init3(&bloom, count, 0.01, flags | BLOOM_PAGED) == 0);
+  assert(bloom.bytes % 4096 == 0 && bloom.bits == 8 * bloom.bytes);
+  unsigned long int pages = bloom.bytes / 4096;
+
+  for (n = 0; n < 2 * count; n++) {
+    keys[n] = n * 0x9e3779b97f4a7c15ull;
+    iov[n].iov_base = &keys[n];
+    iov[n].iov_len = sizeof(uint64_t);
+  }
+
+  // A pool of a few pages, so pages get evicted and read back.
+  unlink(filename);
+  assert(bloom_disk_create(&disk, filename, count, 0.01, flags, 8 * 4096) == 0);
+  assert(disk.bloom.bytes == bloom.bytes);
+
+  for (n = 0; n < count / 2; n++) {
+    assert(bloom_add(&bloom, &keys[n], sizeof(uint64_t)) ==
+           bloom_disk_add(&disk, &keys[n], sizeof(uint64_t)));
+  }
+  assert(disk.writes > 0);
+
+  assert(bloom_disk_add_batch(&disk, iov + count / 2, count - count / 2,
+                              results) == 0);
+  for (n = count / 2; n < count; n++) {
+    assert(bloom_add(&bloom, &keys[n], sizeof(uint64_t)) ==
+           results[n - count / 2]);
+  }
+  assert(bloom_disk_close(&disk) == 0);
+
+  assert(bloom_load(&loaded, filename) == 0);
+  assert(loaded.flags == (flags | BLOOM_PAGED));
+  assert(memcmp(loaded.bf, bloom.bf, bloom.bytes) == 0);
+  bloom_free(&loaded);
+
+  // Every check reads at most one page.
+  assert(bloom_disk_open(&disk, filename, 0, 4 * 4096) == 0);
+  unsigned long int found = 0;
+  for (n = 0; n < 2 * count; n++) {
+    unsigned long int reads = disk.reads;
+    int rv = bloom_disk_check(&disk, &keys[n], sizeof(uint64_t));
+    assert(rv == bloom_check(&bloom, &keys[n], sizeof(uint64_t)));
+    assert(disk.reads - reads <= 1);
+    if (n < count) {
+      assert(rv == 1);
+    } else {
+      found += rv;
+    }
+  }
+  printf("%lu false positives in %lu\n", found, count);
+  assert(found < 2 * 0.01 * count);
+
+  // A batch (of up to 65536) reads every page at most once.
+  unsigned long int reads = disk.reads;
+  assert(bloom_disk_check_batch(&disk, iov + count - 30000, 60000,
+                                results) == 0);
+  assert(disk.reads - reads <= pages);
+  for (n = 0; n < 60000; n++) {
+    uint64_t * key = &keys[count - 30000 + n];
+    assert(results[n] == bloom_check(&bloom, key, sizeof(uint64_t)));
+  }
+  assert(bloom_disk_check_batch(&disk, iov, 2 * count, results) == 0);
+  for (n = 0; n < 2 * count; n++) {
+    assert(results[n] == bloom_check(&bloom, &keys[n], sizeof(uint64_t)));
+  }
+
+  assert(bloom_disk_add(&disk, &keys[0], sizeof(uint64_t)) == -1);
+  assert(bloom_disk_add_batch(&disk, iov, 1, NULL) == -1);
+  assert(bloom_disk_close(&disk) == 0);
+  assert(bloom_disk_check(&disk, &keys[0], sizeof(uint64_t)) == -1);
+
+  // Filters saved from memory can be used from disk, and merged.
+  unlink(filename2);
+  assert(bloom_save(&bloom, filename2) == 0);
+  assert(bloom_disk_open(&disk, filename2, 1, 1 << 20) == 0);
+  assert(bloom_disk_add(&disk, &keys[count], sizeof(uint64_t)) == 0);
+  assert(bloom_disk_flush(&disk) == 0);
+  assert(bloom_disk_close(&disk) == 0);
+  char * both[] = { filename, filename2 };
+  assert(bloom_merge_files(filename, both, 2) == 0);
+  assert(bloom_load(&loaded, filename) == 0);
+  bloom_add(&bloom, &keys[count], sizeof(uint64_t));
+  assert(memcmp(loaded.bf, bloom.bf, bloom.bytes) == 0);
+  bloom_free(&loaded);
+  bloom_free(&bloom);
+
+  assert(bloom_disk_open(&disk, filename, 0, 100) == 1);
+  assert(bloom_disk_open(&disk, "/tmp/libbloom.disk-missing.test", 0,
+                         4096) == 1);
+  assert(bloom_init2(&bloom, 10000, 0.01) == 0);
+  unlink(filename2);
+  assert(bloom_save(&bloom, filename2) == 0);
+  bloom_free(&bloom);
+  assert(bloom_disk_open(&disk, filename2, 0, 4096) == 2);
+  assert(truncate(filename, 5000) == 0);
+  assert(bloom_disk_open(&disk, filename, 0, 4096) == 1);
+
+  unlink(filename);
+  unlink(filename2);
+  free(keys);
+  free(iov);
+  free(results);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_sparse gives the same results as an ordinary filter, before
+ * and after it switches to a bit field.
+ *
+ */
+static void sparse_test(unsigned int flags)
+{
+  struct bloom_sparse sparse;
+  struct bloom bloom;
+  struct bloom exported;
+  uint64_t n, key;
+  int switched = 0;
+
+  printf("----- bloom_sparse(0x%x) -----\n", flags);
+
+  assert(bloom_sparse_init(&sparse, 100, 0.01, flags) == 1);
+  assert(bloom_sparse_init(&sparse, 1000, 0.1, flags) == 0);
+  assert(bloom_init3(&bloom, 1000, 0.1, flags) == 0);
+  assert(sparse.dense == 0 && sparse.count == 0);
+
+  // Plenty of false positives at this error rate, which must match too.
+  for (n = 0; n < 2000; n++) {
+    key = n * 0x9e3779b97f4a7c15ull;
+    assert(bloom_sparse_add(&sparse, &key, sizeof(key)) ==
+           bloom_add(&bloom, &key, sizeof(key)));
+
+    if (n % 25 == 0) {
+      for (key = 0; key < 1000; key++) {
+        assert(bloom_sparse_check(&sparse, &key, sizeof(key)) ==
+               bloom_check(&bloom, &key, sizeof(key)));
+      }
+      assert(bloom_sparse_export(&sparse, &exported) == 0);
+      assert(memcmp(exported.bf, bloom.bf, bloom.bytes) == 0);
+      bloom_free(&exported);
+    }
+
+    if (!sparse.dense &&
+        4 * (sparse.count + sparse.bloom.hashes) > bloom.bytes) {
+      // Fullest the sparse filter gets, where it has the most false
+      // positives to agree on.
+      unsigned long int fp = 0;
+      for (key = 0; key < 300000; key++) {
+        int rv = bloom_sparse_check(&sparse, &key, sizeof(key));
+        assert(rv == bloom_check(&bloom, &key, sizeof(key)));
+        fp += rv;
+      }
+      printf("%lu false positives in 300000 when sparse\n", fp);
+    }
+
+    if (sparse.dense && !switched) {
+      printf("switched to dense at %lu elements\n", (unsigned long)n + 1);
+      switched = 1;
+    } else if (!sparse.dense) {
+      assert(4 * sparse.count <= bloom.bytes);
+    }
+  }
+  assert(switched);
+
+  bloom_free(&bloom);
+  bloom_sparse_free(&sparse);
+  assert(bloom_sparse_check(&sparse, &key, sizeof(key)) == -1);
+  assert(bloom_sparse_add(&sparse, &key, sizeof(key)) == -1);
+  assert(bloom_sparse_export(&sparse, &exported) == -1);
+
+  // Many hashes cost no more than a binary search each.
+  assert(bloom_sparse_init(&sparse, 1000, 1e-25, flags) == 0);
+  assert(sparse.dense == 0);
+  assert(bloom_sparse_add(&sparse, &key, sizeof(key)) == 0);
+  assert(bloom_sparse_check(&sparse, &key, sizeof(key)) == 1);
+  assert(sparse.count <= sparse.bloom.hashes);
+  bloom_sparse_free(&sparse);
+
+  // Filling a larger filter up to the switch takes a fraction of a second
+  // (not the quadratic time a scan of the elements held would).
+  clock_t start = clock();
+  assert(bloom_sparse_init(&sparse, 100000, 0.01, flags) == 0);
+  for (n = 0; !sparse.dense; n++) {
+    assert(bloom_sparse_add(&sparse, &n, sizeof(n)) >= 0);
+    assert(4ul * sparse.count <= sparse.bloom.bytes);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("switched to dense at %lu elements in %.3f s\n",
+         (unsigned long)n, seconds);
+  assert(seconds < 2);
+  bloom_sparse_free(&sparse);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_cms estimates against exact counts.
+ *
+ */
+static void cms_test(unsigned int flags)
+{
+  char * filename = "/tmp/libbloom.cms.test";
+  struct bloom_cms cms;
+  struct bloom_cms cons;
+  struct bloom_cms half[2];
+  struct bloom_cms loaded;
+  struct bloom bloom;
+  struct bloom bloom2;
+  struct bloom ref;
+  struct bloom ref2;
+  uint64_t n, key;
+  unsigned long int over = 0;
+  unsigned long int excess = 0;
+  unsigned long int excess_cons = 0;
+  unsigned long int keys = 20000;
+
+  printf("----- bloom_cms(0x%x) -----\n", flags);
+
+  assert(bloom_cms_init(&cms, 0, 0.01, flags) == 1);
+  assert(bloom_cms_init(&cms, 0.001, 1, flags) == 1);
+  assert(bloom_cms_init(&cms, 0.001, 0.01, flags | BLOOM_PAGED) == 1);
+
+  assert(bloom_cms_init(&cms, 0.001, 0.01, flags) == 0);
+  assert(cms.width >= 2719 && cms.depth == 5);
+  assert(bloom_cms_init(&cons, 0.001, 0.01,
+                        flags | BLOOM_CMS_CONSERVATIVE) == 0);
+  assert(bloom_cms_init(&half[0], 0.001, 0.01, flags) == 0);
+  assert(bloom_cms_init(&half[1], 0.001, 0.01, flags) == 0);
+  assert(bloom_init3(&bloom, keys, 0.01, flags) == 0);
+  assert(bloom_init3(&bloom2, keys, 0.01, flags ^ BLOOM_HASH64) == 0);
+  assert(bloom_init3(&ref, keys, 0.01, flags) == 0);
+  assert(bloom_init3(&ref2, keys, 0.01, flags ^ BLOOM_HASH64) == 0);
+
+  // Key n occurs 1 + 5000 / (n + 1) times, a long tail of rare keys.
+  for (n = 0; n < keys; n++) {
+    uint32_t count = 1 + 5000 / (n + 1);
+    assert(bloom_cms_add_bloom(&cms, &bloom, &n, sizeof(n), count) ==
+           bloom_add(&ref, &n, sizeof(n)));
+    assert(bloom_cms_add_bloom(&cons, &bloom2, &n, sizeof(n), count) ==
+           bloom_add(&ref2, &n, sizeof(n)));
+    assert(bloom_cms_add(&half[n & 1], &n, sizeof(n), count) == 0);
+  }
+
+  for (n = 0; n < keys; n++) {
+    long int count = 1 + 5000 / (n + 1);
+    long int est = bloom_cms_estimate(&cms, &n, sizeof(n));
+    long int est_cons = bloom_cms_estimate(&cons, &n, sizeof(n));
+    assert(bloom_check(&bloom, &n, sizeof(n)) == 1);
+    assert(est >= count && est_cons >= count && est_cons <= est);
+    if (est > count + cms.error * cms.total) { over++; }
+    excess += est - count;
+    excess_cons += est_cons - count;
+  }
+  printf("total %lu, %lu over the bound, mean excess %.1f (%.1f conservative)"
+         "\n", (unsigned long)cms.total, over, (double)excess / keys,
+         (double)excess_cons / keys);
+  assert(over <= keys * cms.delta);
+  assert(excess_cons < excess);
+  assert(memcmp(bloom.bf, ref.bf, bloom.bytes) == 0);
+  assert(memcmp(bloom2.bf, ref2.bf, bloom2.bytes) == 0);
+
+  assert(bloom_cms_merge(&half[0], &half[1]) == 0);
+  assert(half[0].total == cms.total);
+  assert(memcmp(half[0].counters, cms.counters,
+                cms.width * cms.depth * sizeof(uint32_t)) == 0);
+  assert(bloom_cms_merge(&half[0], &cons) == 1);
+
+  unlink(filename);
+  assert(bloom_cms_save(&cms, filename) == 0);
+  assert(bloom_cms_load(&loaded, filename) == 0);
+  assert(loaded.total == cms.total && loaded.width == cms.width);
+  for (n = 0; n < 1000; n++) {
+    assert(bloom_cms_estimate(&loaded, &n, sizeof(n)) ==
+           bloom_cms_estimate(&cms, &n, sizeof(n)));
+  }
+  bloom_cms_free(&loaded);
+
+  // Corrupt shapes are rejected, not used to index the counters.
+  unsigned int depth = 300;
+  off_t at = strlen("libbloomcms1") + sizeof(uint16_t);
+  int fd = open(filename, O_WRONLY);
+  assert(pwrite(fd, &depth, sizeof(depth),
+                at + offsetof(struct bloom_cms, depth)) == sizeof(depth));
+  close(fd);
+  assert(bloom_cms_load(&loaded, filename) == 12);
+  depth = cms.depth;
+  fd = open(filename, O_WRONLY);
+  assert(pwrite(fd, &depth, sizeof(depth),
+                at + offsetof(struct bloom_cms, depth)) == sizeof(depth));
+  unsigned char hashes = cms.depth + 1;
+  assert(pwrite(fd, &hashes, 1, at + offsetof(struct bloom_cms, shape) +
+                offsetof(struct bloom, hashes)) == 1);
+  close(fd);
+  assert(bloom_cms_load(&loaded, filename) == 12);
+
+  assert(bloom_cms_load(&loaded, "/tmp/libbloom.cms-missing.test") == 3);
+  assert(bloom_save(&bloom, "/tmp/libbloom.cms-bloom.test") == 0);
+  assert(bloom_cms_load(&loaded, "/tmp/libbloom.cms-bloom.test") == 5);
+  unlink("/tmp/libbloom.cms-bloom.test");
+
+  // Saturates instead of wrapping.
+  key = 42;
+  assert(bloom_cms_reset(&cons) == 0);
+  assert(bloom_cms_add(&cons, &key, sizeof(key), UINT32_MAX - 1) == 0);
+  assert(bloom_cms_add(&cons, &key, sizeof(key), 5) == 0);
+  assert(bloom_cms_estimate(&cons, &key, sizeof(key)) == UINT32_MAX);
+  assert(bloom_cms_merge(&half[1], &half[1]) == 0);
+
+  unlink(filename);
+  bloom_free(&bloom);
+  bloom_free(&bloom2);
+  bloom_free(&ref);
+  bloom_free(&ref2);
+  bloom_cms_free(&cms);
+  bloom_cms_free(&cons);
+  bloom_cms_free(&half[0]);
+  bloom_cms_free(&half[1]);
+  assert(bloom_cms_estimate(&cms, &key, sizeof(key)) == -1);
+  assert(bloom_cms_add(&cms, &key, sizeof(key), 1) == -1);
+  assert(bloom_cms_reset(&cms) == 1);
+}
+
+
+static int compare_u64(const void * a, const void * b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/** ***************************************************************************
+ * Test bloom_iblt by reconciling two sets.
+ *
+ */
+static void iblt_test(unsigned long int common, unsigned long int only_a,
+                      unsigned long int only_b)
+{
+  char * filename = "/tmp/libbloom.iblt.test";
+  struct bloom_iblt a;
+  struct bloom_iblt b;
+  struct bloom_iblt small;
+  unsigned long int diff = only_a + only_b;
+  uint64_t * inserted = (uint64_t *)malloc(diff * sizeof(uint64_t));
+  uint64_t * removed = (uint64_t *)malloc(diff * sizeof(uint64_t));
+  unsigned long int ninserted, nremoved;
+  uint64_t n, key;
+
+  printf("----- bloom_iblt(%lu, %lu, %lu) -----\n", common, only_a, only_b);
+
+  assert(bloom_iblt_init(&a, 0) == 1);
+  assert(bloom_iblt_init(&a, diff) == 0);
+  assert(bloom_iblt_init(&b, diff) == 0);
+  assert(bloom_iblt_init(&small, diff / 4 + 1) == 0);
+
+  // Keys 0.. are common, then come those of a and then those of b.
+  for (n = 0; n < common + only_a + only_b; n++) {
+    key = bloom_iblt_key(&n, sizeof(n));
+    if (n < common + only_a) {
+      assert(bloom_iblt_insert(&a, key) == 0);
+      assert(bloom_iblt_insert(&small, key) == 0);
+    }
+    if (n < common || n >= common + only_a) {
+      assert(bloom_iblt_insert(&b, key) == 0);
+    }
+  }
+  printf("%lu cells (%lu bytes) for %lu differences\n", a.cells,
+         a.cells * 24, diff);
+
+  // b travels as a file.
+  unlink(filename);
+  assert(bloom_iblt_save(&b, filename) == 0);
+  bloom_iblt_free(&b);
+  assert(bloom_iblt_load(&b, filename) == 0);
+
+  // Tables whose cells do not match their differences are rejected.
+  unsigned long int cells = 0;
+  off_t at = strlen("libbloomiblt1") + sizeof(uint16_t) +
+    offsetof(struct bloom_iblt, cells);
+  struct bloom_iblt bad;
+  int fd = open(filename, O_WRONLY);
+  assert(pwrite(fd, &cells, sizeof(cells), at) == sizeof(cells));
+  close(fd);
+  assert(bloom_iblt_load(&bad, filename) == 12);
+  cells = b.cells + 4;
+  fd = open(filename, O_WRONLY);
+  assert(pwrite(fd, &cells, sizeof(cells), at) == sizeof(cells));
+  close(fd);
+  assert(bloom_iblt_load(&bad, filename) == 12);
+  unlink(filename);
+
+  assert(small.cells == b.cells || bloom_iblt_subtract(&small, &b) == 1);
+  assert(bloom_iblt_subtract(&a, &b) == 0);
+  assert(bloom_iblt_decode(&a, inserted, &ninserted, removed, &nremoved,
+                           diff) == 0);
+  assert(ninserted == only_a && nremoved == only_b);
+
+  qsort(inserted, ninserted, sizeof(uint64_t), compare_u64);
+  qsort(removed, nremoved, sizeof(uint64_t), compare_u64);
+  for (n = common; n < common + only_a + only_b; n++) {
+    key = bloom_iblt_key(&n, sizeof(n));
+    if (n < common + only_a) {
+      assert(bsearch(&key, inserted, ninserted, sizeof(uint64_t),
+                     compare_u64) != NULL);
+    } else {
+      assert(bsearch(&key, removed, nremoved, sizeof(uint64_t),
+                     compare_u64) != NULL);
+    }
+  }
+
+  // Far too many differences for the table: fails, never returns wrong
+  // keys.
+  bloom_iblt_free(&b);
+  assert(bloom_iblt_init(&b, diff / 4 + 1) == 0);
+  for (n = 0; n < common; n++) {
+    key = bloom_iblt_key(&n, sizeof(n));
+    assert(bloom_iblt_insert(&b, key) == 0);
+  }
+  assert(bloom_iblt_subtract(&small, &b) == 0);
+  assert(bloom_iblt_decode(&small, inserted, &ninserted, removed, &nremoved,
+                           diff) == (diff > 100 ? 1 : 0));
+  assert(nremoved == 0);
+  for (n = 0; n < ninserted; n++) {
+    uint64_t k;
+    for (k = common; k < common + only_a; k++) {
+      if (bloom_iblt_key(&k, sizeof(k)) == inserted[n]) { break; }
+    }
+    assert(k < common + only_a);
+  }
+  printf("%lu of %lu decoded with a quarter of the cells\n", ninserted,
+         only_a);
+
+  // Output arrays too small.
+  bloom_iblt_free(&a);
+  assert(bloom_iblt_init(&a, 100) == 0);
+  for (key = 1; key <= 10; key++) {
+    assert(bloom_iblt_remove(&a, key) == 0);
+  }
+  assert(bloom_iblt_decode(&a, inserted, &ninserted, removed, &nremoved,
+                           5) == 2);
+  assert(nremoved == 5);
+
+  bloom_iblt_free(&a);
+  bloom_iblt_free(&b);
+  bloom_iblt_free(&small);
+  assert(bloom_iblt_insert(&a, key) == -1);
+  assert(bloom_iblt_remove(&a, key) == -1);
+  assert(bloom_iblt_subtract(&a, &b) == -1);
+  assert(bloom_iblt_decode(&a, inserted, &ninserted, removed, &nremoved,
+                           5) == -1);
+  assert(bloom_iblt_load(&a, "/tmp/libbloom.iblt-missing.test") == 3);
+  free(inserted);
+  free(removed);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_pool filters behave as regular ones and survive a bulk
+ * save and load.
+ *
+ */
+static void pool_test()
+{
+  char * filename = "/tmp/libbloom.pool.test";
+  struct bloom_pool pool;
+  struct bloom reference;
+  struct bloom * blooms[1000];
+  struct bloom * loaded[1000];
+  unsigned long int count;
+  unsigned long int n;
+  uint64_t key;
+
+  printf("----- bloom_pool -----\n");
+
+  assert(bloom_pool_init(&pool) == 0);
+  assert(bloom_pool_alloc(&pool, 10, 0.01, 0) == NULL);
+  assert(bloom_init3(&reference, 5000, 0.01, 0) == 0);
+
+  // Two size classes, and every tenth filter left out.
+  for (n = 0; n < 1000; n++) {
+    blooms[n] = NULL;
+    if (n % 10 == 0) { continue; }
+    blooms[n] = bloom_pool_alloc(&pool, n % 2 ? 5000 : 20000, 0.01,
+                                 n % 4 == 1 ? BLOOM_HASH64 : 0);
+    assert(blooms[n] != NULL);
+    assert(blooms[n]->bf == (unsigned char *)blooms[n] + 64);
+    for (key = n; key < n + 100; key++) {
+      assert(bloom_add_u64(blooms[n], key) == 0);
+    }
+  }
+  assert(pool.filters == 900);
+  printf("900 filters in %lu bytes\n", pool.bytes);
+
+  // Released slots are reused, cleared.
+  unsigned char * bf = blooms[3]->bf;
+  bloom_pool_release(&pool, blooms[3]);
+  assert(pool.filters == 899);
+  blooms[3] = bloom_pool_alloc(&pool, 5000, 0.01, 0);
+  assert(blooms[3]->bf == bf);
+  assert(bloom_check_u64(blooms[3], 3) == 0);
+  assert(bloom_add_u64(blooms[3], 3) == 0);
+  assert(pool.filters == 900);
+
+  // Same bits as a filter of its own.
+  for (key = 7; key < 107; key++) {
+    assert(bloom_add_u64(&reference, key) == 0);
+  }
+  assert(memcmp(blooms[7]->bf, reference.bf, reference.bytes) == 0);
+  assert(bloom_check_u64(blooms[7], 106) == 1);
+  assert(bloom_check_u64(blooms[8], 107) == 1);
+
+  unlink(filename);
+  assert(bloom_pool_save(&pool, NULL, blooms, 1000) == 1);
+  assert(bloom_pool_save(&pool, filename, blooms, 1000) == 0);
+
+  count = 999;
+  assert(bloom_pool_load(&pool, filename, loaded, &count) == 13);
+  assert(count == 0 && pool.filters == 900);
+
+  count = 1000;
+  assert(bloom_pool_load(&pool, filename, loaded, &count) == 0);
+  assert(count == 1000 && pool.filters == 1800);
+  for (n = 0; n < 1000; n++) {
+    assert((loaded[n] == NULL) == (blooms[n] == NULL));
+    if (loaded[n] == NULL) { continue; }
+    assert(loaded[n]->bytes == blooms[n]->bytes);
+    assert(loaded[n]->flags == blooms[n]->flags);
+    assert(memcmp(loaded[n]->bf, blooms[n]->bf, blooms[n]->bytes) == 0);
+    bloom_pool_release(&pool, blooms[n]);
+  }
+  assert(pool.filters == 900);
+  assert(bloom_check_u64(loaded[999], 1098) == 1);
+
+  // A truncated file leaves nothing allocated.
+  assert(truncate(filename, 100000) == 0);
+  count = 1000;
+  assert(bloom_pool_load(&pool, filename, blooms, &count) == 11);
+  assert(count == 0 && pool.filters == 900);
+  unlink(filename);
+
+  bloom_free(&reference);
+  bloom_pool_free(&pool);
+  assert(bloom_pool_alloc(&pool, 5000, 0.01, 0) == NULL);
+  assert(bloom_pool_load(&pool, filename, blooms, &count) == 2);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_qf adds, removes, grows and merges without losing elements.
+ *
+ */
+static void qf_test()
+{
+  char * filename = "/tmp/libbloom.qf.test";
+  struct bloom_qf qf;
+  struct bloom_qf other;
+  unsigned char counts[20000];
+  unsigned long int held = 0;
+  unsigned long int fp = 0;
+  uint64_t n, key;
+
+  printf("----- bloom_qf -----\n");
+
+  assert(bloom_qf_init(&qf, 0, 0.01) == 1);
+  assert(bloom_qf_init(&qf, 1000, 1.0) == 1);
+  assert(bloom_qf_init(&qf, 1000, 1e-30) == 1);
+
+  assert(bloom_qf_init(&qf, 100000, 0.001) == 0);
+  assert(qf.remainder_bits == 10 && qf.entries >= 100000);
+  for (n = 0; n < 100000; n++) {
+    fp += bloom_qf_add(&qf, &n, sizeof(n));
+  }
+  for (n = 0; n < 100000; n++) {
+    assert(bloom_qf_check(&qf, &n, sizeof(n)) == 1);
+  }
+  for (n = 100000; n < 200000; n++) {
+    fp += bloom_qf_check(&qf, &n, sizeof(n));
+  }
+  printf("%lu false positives (error %f) in %u + %u bit fingerprints\n",
+         fp, qf.error, qf.quotient_bits, qf.remainder_bits);
+  assert(fp < 100000 * 2 * qf.error);
+
+  // Removed elements go, the others stay.
+  for (n = 0; n < 100000; n += 2) {
+    assert(bloom_qf_remove(&qf, &n, sizeof(n)) == 1);
+  }
+  assert(qf.count == 50000);
+  fp = 0;
+  for (n = 0; n < 100000; n++) {
+    if (n % 2) {
+      assert(bloom_qf_check(&qf, &n, sizeof(n)) == 1);
+    } else {
+      fp += bloom_qf_check(&qf, &n, sizeof(n));
+    }
+  }
+  assert(fp < 100000 * qf.error);
+
+  // Saved and loaded.
+  unlink(filename);
+  assert(bloom_qf_save(&qf, filename) == 0);
+  assert(bloom_qf_load(&other, filename) == 0);
+  assert(other.count == qf.count && other.slots == qf.slots);
+  assert(!memcmp(other.words, qf.words, 8 * (other.slots / 8)));
+  bloom_qf_free(&other);
+  unlink(filename);
+  bloom_qf_free(&qf);
+
+  // Random adds and removes, against exact counts.
+  assert(bloom_qf_init(&qf, 100, 0.000001) == 0);
+  memset(counts, 0, sizeof(counts));
+  srandom(48);
+  for (n = 0; n < 300000; n++) {
+    key = random() % 20000;
+    if (random() % 3 && counts[key] < 255) {
+      assert(bloom_qf_add(&qf, &key, sizeof(key)) >= 0);
+      counts[key]++;
+      held++;
+    } else if (counts[key] > 0) {
+      assert(bloom_qf_remove(&qf, &key, sizeof(key)) == 1);
+      counts[key]--;
+      held--;
+    }
+    if (n % 10000 == 0) {
+      for (key = 0; key < 20000; key++) {
+        assert(!counts[key] || bloom_qf_check(&qf, &key, sizeof(key)));
+      }
+    }
+  }
+  assert(qf.count == held);
+  printf("grew to 2^%u slots for %lu elements\n", qf.quotient_bits, held);
+  assert(qf.quotient_bits > 7 && qf.remainder_bits == 27 - qf.quotient_bits);
+
+  // Merged with a larger filter, into the shorter fingerprints.
+  assert(bloom_qf_init(&other, 300000, 0.000001) == 0);
+  for (n = 1000000; n < 1200000; n++) {
+    assert(bloom_qf_add(&other, &n, sizeof(n)) >= 0);
+  }
+  assert(bloom_qf_merge(&qf, &other) == 0);
+  assert(qf.count == held + 200000);
+  assert(qf.quotient_bits + qf.remainder_bits == 27);
+  assert(qf.entries >= qf.count);
+  for (key = 0; key < 20000; key++) {
+    assert(!counts[key] || bloom_qf_check(&qf, &key, sizeof(key)));
+  }
+  for (n = 1000000; n < 1200000; n++) {
+    assert(bloom_qf_check(&qf, &n, sizeof(n)) == 1);
+  }
+  bloom_qf_free(&other);
+
+  // Nothing left to double into.
+  assert(bloom_qf_init(&other, 1000, 0.5) == 0);
+  assert(bloom_qf_resize(&other) == 1);
+  for (n = 0; n < other.entries; n++) {
+    assert(bloom_qf_add(&other, &n, sizeof(n)) >= 0);
+  }
+  assert(bloom_qf_add(&other, &n, sizeof(n)) == -2);
+  assert(bloom_qf_merge(&qf, &other) == 1);
+  bloom_qf_free(&other);
+
+  // Duplicates are counted.
+  key = 5000000;
+  assert(bloom_qf_add(&qf, &key, sizeof(key)) == 0);
+  assert(bloom_qf_add(&qf, &key, sizeof(key)) == 1);
+  assert(bloom_qf_remove(&qf, &key, sizeof(key)) == 1);
+  assert(bloom_qf_check(&qf, &key, sizeof(key)) == 1);
+  assert(bloom_qf_remove(&qf, &key, sizeof(key)) == 1);
+  assert(bloom_qf_remove(&qf, &key, sizeof(key)) == 0);
+
+  bloom_qf_free(&qf);
+  assert(bloom_qf_add(&qf, &key, sizeof(key)) == -1);
+  assert(bloom_qf_check(&qf, &key, sizeof(key)) == -1);
+  assert(bloom_qf_remove(&qf, &key, sizeof(key)) == -1);
+  assert(bloom_qf_resize(&qf) == -1);
+  assert(bloom_qf_load(&qf, "/tmp/libbloom.qf-missing.test") == 3);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_prefix finds the prefixes and ranges of added keys, and
+ * rules out most of the others.
+ *
+ */
+static void prefix_test(unsigned int flags)
+{
+  char * filename = "/tmp/libbloom.prefix.test";
+  // "tenant000" and "tenant000/user00000"
+  unsigned int lengths[] = { 9, 19 };
+  unsigned int bad[] = { 9, 9 };
+  struct bloom_prefix pf;
+  struct bloom_prefix loaded;
+  char key[64];
+  char low[64];
+  char high[64];
+  unsigned long int fp = 0;
+  unsigned int t, u, i;
+  int len;
+
+  printf("----- bloom_prefix(%u) -----\n", flags);
+
+  assert(bloom_prefix_init(&pf, 1000, 0.01, lengths, 0, flags) == 1);
+  assert(bloom_prefix_init(&pf, 1000, 0.01, bad, 2, flags) == 1);
+  assert(bloom_prefix_init(&pf, 1000, 0.01, lengths,
+                           BLOOM_PREFIX_LEVELS + 1, flags) == 1);
+  assert(bloom_prefix_init(&pf, 1000, 0.01, lengths, 2, 0x8000) == 1);
+
+  // Even tenants, odd users, 10 items each.
+  assert(bloom_prefix_init(&pf, 100000, 0.01, lengths, 2,
+                           flags | BLOOM_PREFIX_KEYS) == 0);
+  for (t = 0; t < 100; t += 2) {
+    for (u = 1; u < 400; u += 2) {
+      for (i = 0; i < 10; i++) {
+        len = sprintf(key, "tenant%03u/user%05u/%u", t, u, i * 7919);
+        assert(bloom_prefix_add(&pf, key, len) >= 0);
+      }
+    }
+  }
+  assert(bloom_prefix_add(&pf, key, len) == 1);
+
+  for (t = 0; t < 100; t += 2) {
+    for (u = 1; u < 400; u += 2) {
+      for (i = 0; i < 10; i++) {
+        len = sprintf(key, "tenant%03u/user%05u/%u", t, u, i * 7919);
+        assert(bloom_prefix_check(&pf, key, len) == 1);
+      }
+      fp += bloom_prefix_check(&pf, key, len - 1);
+      len = sprintf(key, "tenant%03u/user%05u/", t, u);
+      assert(bloom_prefix_check_prefix(&pf, key, len) == 1);
+      assert(bloom_prefix_check_prefix(&pf, key, len - 1) == 1);
+      len = sprintf(key, "tenant%03u/user%05u/", t, u - 1);
+      fp += bloom_prefix_check_prefix(&pf, key, len);
+    }
+  }
+  printf("%lu false positives in %u checks\n", fp, 50 * 200 * 2);
+  assert(fp < 50 * 200 * 2 * 0.02);
+
+  fp = 0;
+  for (t = 0; t < 100; t++) {
+    len = sprintf(key, "tenant%03u", t);
+    if (t % 2 == 0) {
+      assert(bloom_prefix_check_prefix(&pf, key, len) == 1);
+    } else {
+      fp += bloom_prefix_check_prefix(&pf, key, len);
+    }
+  }
+  assert(fp < 5);
+  assert(bloom_prefix_check_prefix(&pf, "tenant", 6) == 1);
+
+  // Ranges within one user, one tenant, or across tenants.
+  sprintf(low, "tenant004/user00011/0");
+  sprintf(high, "tenant004/user00011/zzz");
+  assert(bloom_prefix_check_range(&pf, low, 21, high, 23) == 1);
+  sprintf(low, "tenant004/user00000");
+  sprintf(high, "tenant004/user99999");
+  assert(bloom_prefix_check_range(&pf, low, 19, high, 19) == 1);
+  sprintf(low, "tenant003/user00000");
+  sprintf(high, "tenant003/user99999");
+  assert(bloom_prefix_check_range(&pf, low, 19, high, 19) ==
+         bloom_prefix_check_prefix(&pf, "tenant003", 9));
+  sprintf(low, "tenant003");
+  sprintf(high, "tenant004");
+  assert(bloom_prefix_check_range(&pf, low, 9, high, 9) == 1);
+
+  // Saved and loaded.
+  unlink(filename);
+  assert(bloom_prefix_save(&pf, filename) == 0);
+  assert(bloom_prefix_load(&loaded, filename) == 0);
+  assert(loaded.levels == 2 && loaded.lengths[1] == 19);
+  assert(loaded.flags == pf.flags);
+  assert(!memcmp(loaded.bloom.bf, pf.bloom.bf, pf.bloom.bytes));
+  assert(bloom_prefix_check(&loaded, key, len) ==
+         bloom_prefix_check(&pf, key, len));
+  bloom_prefix_free(&loaded);
+  unlink(filename);
+  assert(bloom_prefix_load(&loaded, filename) == 3);
+
+  bloom_prefix_free(&pf);
+  assert(bloom_prefix_add(&pf, key, len) == -1);
+  assert(bloom_prefix_check(&pf, key, len) == -1);
+  assert(bloom_prefix_check_prefix(&pf, key, len) == -1);
+  assert(bloom_prefix_check_range(&pf, low, 9, high, 9) == -1);
+
+  // Prefixes only: keys are checked by their longest prefix.
+  assert(bloom_prefix_init(&pf, 1000, 0.01, lengths, 2, flags) == 0);
+  len = sprintf(key, "tenant001/user00001/42");
+  assert(bloom_prefix_add(&pf, key, len) == 0);
+  assert(bloom_prefix_check(&pf, key, len) == 1);
+  assert(bloom_prefix_check(&pf, "tenant001/user00001/43", len) == 1);
+  assert(bloom_prefix_add(&pf, "short", 5) == 1);
+  bloom_prefix_free(&pf);
+
+  // Whole keys only.
+  assert(bloom_prefix_init(&pf, 1000, 0.01, NULL, 0, BLOOM_PREFIX_KEYS) == 0);
+  assert(bloom_prefix_add(&pf, key, len) == 0);
+  assert(bloom_prefix_check(&pf, key, len) == 1);
+  assert(bloom_prefix_check_prefix(&pf, key, len) == 1);
+  bloom_prefix_free(&pf);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_trace records the sampled calls, in order.
+ *
+ */
+static void trace_test()
+{
+  char * filename = "/tmp/libbloom.trace.test";
+  struct bloom_trace trace;
+  struct bloom_trace other;
+  struct bloom bloom;
+  unsigned char file[100000];
+  unsigned char results[3000];
+  char key[64];
+  uint32_t u32, len;
+  uint64_t u64, prev = 0;
+  unsigned int n;
+  int rv;
+
+  printf("----- bloom_trace -----\n");
+
+  assert(bloom_init2(&bloom, 10000, 0.01) == 0);
+  assert(bloom_trace_start(&trace, NULL, 1, 0) == 1);
+  assert(bloom_trace_start(&trace, filename, 0, 0) == 1);
+  assert(bloom_trace_start(&trace, filename, 1, 0x10) == 1);
+  assert(bloom_trace_start(&trace, "/nonexistent/trace", 1, 0) == 1);
+  assert(bloom_trace_stop(&trace) == 1);
+
+  // Every call, by hash.
+  assert(bloom_trace_start(&trace, filename, 1, 0) == 0);
+  assert(bloom_trace_start(&other, filename, 1, 0) == 1);
+  assert(bloom_trace_start(&trace, filename, 1, 0) == 1);
+  for (n = 0; n < 3000; n++) {
+    len = sprintf(key, "key%u", n * (n % 7 + 1));
+    if (n < 1000) {
+      results[n] = bloom_add(&bloom, key, len);
+    } else {
+      results[n] = bloom_check(&bloom, key, len);
+    }
+  }
+  struct iovec iov[2] = { { "key", 3 }, { "0", 1 } };
+  assert(bloom_check_iov(&bloom, iov, 2) == 1);
+  assert(trace.records == 3001);
+  assert(bloom_trace_stop(&trace) == 0);
+  assert(bloom_trace_stop(&trace) == 1);
+  assert(bloom_add(&bloom, "after", 5) == 0);
+  assert(trace.records == 3001);
+
+  int fd = open(filename, O_RDONLY);
+  assert(read(fd, file, sizeof(file)) == (ssize_t)trace.bytes);
+  close(fd);
+  unsigned char * p = file;
+  assert(!memcmp(p, "libbloomtrace1", 14));
+  memcpy(&u32, p + 14, 4);
+  assert(u32 == 0);
+  memcpy(&u32, p + 18, 4);
+  assert(u32 == 1);
+  p += 22;
+  for (n = 0; n < 3001; n++) {
+    if (n < 3000) {
+      len = sprintf(key, "key%u", n * (n % 7 + 1));
+    } else {
+      len = sprintf(key, "key0");
+      results[0] = 1;
+    }
+    memcpy(&u64, p, 8);
+    assert(u64 >= prev);
+    prev = u64;
+    assert(p[8] == (n < 1000 ? BLOOM_TRACE_ADD : BLOOM_TRACE_CHECK));
+    assert(p[9] == results[n < 3000 ? n : 0]);
+    memcpy(&u32, p + 10, 4);
+    assert(u32 == len);
+    memcpy(&u64, p + 14, 8);
+    assert(u64 == murmurhash64a(key, len, 0x9747b28c));
+    p += 22;
+  }
+  assert(p == file + trace.bytes);
+
+  // One in ten elements, by element: both calls on each sampled one.
+  assert(bloom_trace_start(&trace, filename, 10, BLOOM_TRACE_KEYS) == 0);
+  for (n = 0; n < 1000; n++) {
+    len = sprintf(key, "key%u", n);
+    rv = bloom_check(&bloom, key, len);
+    assert(rv == 0 || rv == 1);
+    bloom_add(&bloom, key, len);
+  }
+  printf("%lu of 2000 calls recorded\n", (unsigned long)trace.records);
+  assert(trace.records > 100 && trace.records < 300);
+  assert(bloom_trace_stop(&trace) == 0);
+
+  fd = open(filename, O_RDONLY);
+  assert(read(fd, file, sizeof(file)) == (ssize_t)trace.bytes);
+  close(fd);
+  memcpy(&u32, file + 14, 4);
+  assert(u32 == BLOOM_TRACE_KEYS);
+  p = file + 22;
+  for (n = 0; n < trace.records; n += 2) {
+    memcpy(&len, p + 10, 4);
+    assert(p[8] == BLOOM_TRACE_CHECK && !memcmp(p + 14, "key", 3));
+    assert(p[14 + len + 8] == BLOOM_TRACE_ADD);
+    assert(!memcmp(p + 14, p + 14 + len + 14, len));
+    p += 2 * (14 + len);
+  }
+  assert(p == file + trace.bytes);
+  unlink(filename);
+
+  bloom_free(&bloom);
+}
+
+
+/** ***************************************************************************
+ * Test the rolling k-mer hashes match hashing each window on its own.
+ *
+ */
+static void kmer_test(unsigned int flags)
+{
+  const char * bases = "ACGT";
+  const char * pairs = "ACGTTGCA";
+  unsigned long int len = 200000;
+  char * seq = (char *)malloc(len);
+  char * rc = (char *)malloc(len);
+  unsigned char * results = (unsigned char *)malloc(len);
+  struct bloom bloom;
+  unsigned long int n;
+  unsigned int k;
+  long int found;
+
+  printf("----- bloom_add_kmers(0x%02x) -----\n", flags);
+
+  srandom(flags + 1);
+  for (n = 0; n < len; n++) {
+    seq[n] = bases[random() % 4];
+  }
+  for (n = 0; n < len; n++) {
+    rc[len - 1 - n] = pairs[(strchr(pairs, seq[n]) - pairs) + 4];
+  }
+
+  // Short and long k, including k above 64.
+  for (k = 1; k <= 200; k = k * 3 + 2) {
+    unsigned long int windows = len - k + 1;
+
+    assert(bloom_init3(&bloom, windows, 0.01, flags) == 0);
+    assert(bloom_add_kmers(&bloom, seq, k - 1, k, 0, NULL) == 0);
+    found = bloom_add_kmers(&bloom, seq, len, k, 0, results);
+    assert(bloom_check_kmers(&bloom, seq, len, k, 0, NULL) == windows);
+
+    // Added windows are found one at a time, and others mostly not.
+    for (n = 0; n < windows; n += 97) {
+      assert(bloom_check_kmers(&bloom, seq + n, k, k, 0, NULL) == 1);
+      assert(bloom_add_kmers(&bloom, seq + n, k, k, 0, NULL) == 1);
+    }
+    found = bloom_check_kmers(&bloom, rc, len, k, 0, results);
+    printf("k = %u: %ld of %lu reverse complement k-mers found\n",
+           k, found, windows);
+    if (k > 10) {
+      assert(found < windows / 20);
+      for (n = 0; n < windows; n += 89) {
+        assert(results[n] == bloom_check_kmers(&bloom, rc + n, k, k, 0,
+                                               NULL));
+      }
+    }
+    bloom_free(&bloom);
+  }
+
+  // Canonical k-mers are found on either strand.
+  assert(bloom_init3(&bloom, len, 0.01, flags) == 0);
+  found = bloom_add_kmers(&bloom, seq, len, 31, BLOOM_KMER_CANONICAL, NULL);
+  assert(found < len / 20);
+  assert(bloom_check_kmers(&bloom, rc, len, 31, BLOOM_KMER_CANONICAL,
+                           results) == len - 30);
+  assert(bloom_check_kmers(&bloom, rc + 1000, 31, 31, BLOOM_KMER_CANONICAL,
+                           NULL) == 1);
+  assert(bloom_check_kmers(&bloom, seq, len, 0, 0, NULL) == -1);
+  bloom_free(&bloom);
+  assert(bloom_check_kmers(&bloom, seq, len, 31, 0, NULL) == -1);
+  assert(bloom_add_kmers(&bloom, seq, len, 31, 0, NULL) == -1);
+
+  free(seq);
+  free(rc);
+  free(results);
+}
+
+
+/** ***************************************************************************
+ * Test the 64 bit integer functions match bloom_add/bloom_check of the
+ * 8 bytes.
+ *
+ */
+static void u64_test(unsigned int flags)
+{
+  struct bloom bloom;
+  struct bloom bloom2;
+  unsigned long int count = 100003;
+  unsigned char * results = (unsigned char *)malloc(count);
+  uint64_t * keys = (uint64_t *)malloc(count * sizeof(uint64_t));
+  unsigned long int n;
+
+  printf("----- bloom_add_u64(0x%x) -----\n", flags);
+
+  assert(bloom_init3(&bloom, count, 0.01, flags) == 0);
+  assert(bloom_init3(&bloom2, count, 0.01, flags) == 0);
+
+  for (n = 0; n < count; n++) {
+    keys[n] = n * 0x9e3779b97f4a7c15ull;
+  }
+
+  for (n = 0; n < count / 2; n++) {
+    assert(bloom_add(&bloom, &keys[n], sizeof(uint64_t)) ==
+           bloom_add_u64(&bloom2, keys[n]));
+  }
+  assert(memcmp(bloom.bf, bloom2.bf, bloom.bytes) == 0);
+
+  assert(bloom_add_u64_array(&bloom2, keys + count / 2, count - count / 2,
+                             results) == 0);
+  for (n = count / 2; n < count; n++) {
+    assert(bloom_add(&bloom, &keys[n], sizeof(uint64_t)) ==
+           results[n - count / 2]);
+  }
+  assert(memcmp(bloom.bf, bloom2.bf, bloom.bytes) == 0);
+
+  // Check both the added keys and as many others.
+  for (n = 0; n < count; n++) {
+    keys[n] = (n & 1) ? keys[n] : ~keys[n];
+  }
+  assert(bloom_check_u64_array(&bloom2, keys, count, results) == 0);
+  for (n = 0; n < count; n++) {
+    int rv = bloom_check(&bloom, &keys[n], sizeof(uint64_t));
+    assert(rv == results[n]);
+    assert(rv == bloom_check_u64(&bloom2, keys[n]));
+    if (n & 1) {
+      assert(rv == 1);
+    }
+  }
+
+  assert(bloom_add_u64_array(&bloom2, keys, 5, NULL) == 0);
+
+  bloom_free(&bloom);
+  bloom_free(&bloom2);
+  assert(bloom_check_u64(&bloom, 1) == -1);
+  assert(bloom_add_u64_array(&bloom, keys, 1, NULL) == -1);
+  free(results);
+  free(keys);
+}
+
+
+/** ***************************************************************************
+ * Test BLOOM_ENHANCED filters.
+ *
+ */
+static void enhanced_test()
+{
+  char * filename = "/tmp/libbloom.enhanced.test";
+  struct bloom bloom;
+  struct bloom bloom2;
+  uint64_t n;
+  int fp = 0;
+
+  printf("----- BLOOM_ENHANCED tests -----\n");
+
+  assert(bloom_init3(&bloom, 100000, 0.0001, BLOOM_ENHANCED) == 0);
+  assert(bloom.flags == (BLOOM_ENHANCED | BLOOM_HASH64));
+  assert(bloom.hashes == 14);
+
+  for (n = 0; n < 100000; n++) {
+    assert(bloom_add(&bloom, &n, sizeof(n)) >= 0);
+  }
+  for (n = 100000; n < 1100000; n++) {
+    fp += bloom_check(&bloom, &n, sizeof(n));
+  }
+  printf("expected error %f, measured %f\n", bloom.error, fp / 1000000.0);
+  assert(fp < 150);
+
+  unlink(filename);
+  assert(bloom_save(&bloom, filename) == 0);
+  assert(bloom_load(&bloom2, filename) == 0);
+  assert(bloom2.flags == bloom.flags);
+  for (n = 0; n < 100000; n++) {
+    assert(bloom_check(&bloom2, &n, sizeof(n)) == 1);
+  }
+  bloom_free(&bloom2);
+
+  assert(bloom_init3(&bloom2, 100000, 0.0001, BLOOM_HASH64) == 0);
+  assert(bloom_merge(&bloom2, &bloom) == 1);
+  bloom_free(&bloom2);
+  bloom_free(&bloom);
+  unlink(filename);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_reset of a large filter (which doesn't clear it by writing,
+ * on Linux).
+ *
+ */
+static void reset_test()
+{
+  struct bloom bloom;
+  unsigned long int p;
+  uint64_t n;
+
+  printf("----- bloom_reset of large filter -----\n");
+
+  assert(bloom_init2(&bloom, 20000000, 0.01) == 0);
+  assert(bloom.bytes > (16 << 20));
+
+  for (n = 0; n < 1000000; n++) {
+    assert(bloom_add_u64(&bloom, n) >= 0);
+  }
+  bloom.bf[0] = 0xff;
+  bloom.bf[bloom.bytes - 1] = 0xff;
+
+  assert(bloom_reset(&bloom) == 0);
+  for (p = 0; p < bloom.bytes; p++) {
+    assert(bloom.bf[p] == 0);
+  }
+  for (n = 0; n < 1000000; n++) {
+    assert(bloom_check_u64(&bloom, n) == 0);
+  }
+
+  for (n = 0; n < 1000; n++) {
+    assert(bloom_add_u64(&bloom, n) == 0);
+  }
+  for (n = 0; n < 1000; n++) {
+    assert(bloom_check_u64(&bloom, n) == 1);
+  }
+
+  bloom_free(&bloom);
+}
+
+
+/** ***************************************************************************
+ * Test bloom_bank against individual filters.
+ *
+ */
+static void bank_test()
+{
+  char * filename = "/tmp/libbloom.bank.test";
+  struct bloom_bank bank;
+  struct bloom blooms[70];
+  unsigned int capacity = 70;
+  unsigned int slot;
+  uint64_t result[2];
+  uint64_t n;
+  int f, rv;
+
+  printf("----- bloom_bank tests -----\n");
+
+  assert(bloom_bank_init(&bank, 20000, 0.01, 0) == 1);
+  assert(bloom_bank_init(&bank, 10, 0.01, capacity) == 1);
+  assert(bloom_bank_load(&bank, filename, &slot) == -1);
+  assert(bloom_bank_check(&bank, "hello", 5, result) == -1);
+  assert(bloom_bank_remove(&bank, 0) == -1);
+
+  assert(bloom_bank_init(&bank, 20000, 0.01, capacity) == 0);
+  assert(bloom_bank_load(&bank, "/no-such-directory/foo", &slot) == 1);
+
+  // Filter n holds the keys k where k % capacity == n
+  for (f = 0; f < capacity; f++) {
+    assert(bloom_init2(&blooms[f], 20000, 0.01) == 0);
+  }
+  for (n = 0; n < 100000; n++) {
+    bloom_add(&blooms[n % capacity], &n, sizeof(uint64_t));
+  }
+  for (f = 0; f < capacity; f++) {
+    unlink(filename);
+    assert(bloom_save(&blooms[f], filename) == 0);
+    assert(bloom_bank_load(&bank, filename, &slot) == 0);
+    assert(slot == f);
+  }
+  assert(bank.count == capacity);
+  assert(bloom_bank_load(&bank, filename, &slot) == 3);
+
+  // Results must match checking each filter separately
+  for (n = 0; n < 200000; n++) {
+    rv = bloom_bank_check(&bank, &n, sizeof(uint64_t), result);
+    int count = 0;
+    for (f = 0; f < capacity; f++) {
+      int bit = (result[f / 64] >> (f % 64)) & 1;
+      assert(bit == bloom_check(&blooms[f], &n, sizeof(uint64_t)));
+      count += bit;
+    }
+    assert(rv == count);
+    if (n < 100000) {
+      assert(result[(n % capacity) / 64] & (1ull << ((n % capacity) % 64)));
+    }
+  }
+
+  // Removed filters no longer report, slots are reused
+  assert(bloom_bank_remove(&bank, 3) == 0);
+  assert(bloom_bank_remove(&bank, 3) == 1);
+  assert(bloom_bank_remove(&bank, capacity) == 1);
+  n = 3;
+  bloom_bank_check(&bank, &n, sizeof(uint64_t), result);
+  assert((result[0] & (1ull << 3)) == 0);
+  assert(bank.count == capacity - 1);
+
+  unlink(filename);
+  assert(bloom_save(&blooms[3], filename) == 0);
+  assert(bloom_bank_load(&bank, filename, &slot) == 0);
+  assert(slot == 3);
+  assert(bloom_bank_check(&bank, &n, sizeof(uint64_t), result) >= 1);
+  assert(result[0] & (1ull << 3));
+
+  // Filters of a different shape are refused
+  struct bloom other;
+  assert(bloom_bank_remove(&bank, 0) == 0);
+  assert(bloom_init2(&other, 20001, 0.01) == 0);
+  unlink(filename);
+  assert(bloom_save(&other, filename) == 0);
+  assert(bloom_bank_load(&bank, filename, &slot) == 2);
+  bloom_free(&other);
+
+  for (f = 0; f < capacity; f++) {
+    bloom_free(&blooms[f]);
+  }
+  bloom_bank_free(&bank);
+  unlink(filename);
+}
+
+
 /** ***************************************************************************
  * Testing bloom_load with various failure cases.
  *
@@ -198,6 +2098,41 @@ static void load_tests()
   assert(bloom_load(&bloom2, filename) == 9);
   bloom.major--;
 
+  // files of filters with flags have a major version 2.0 rejects
+  struct bloom flagged;
+  unsigned char major;
+  off_t at = 9 + sizeof(uint16_t) + offsetof(struct bloom, major);
+  bloom_save(&bloom, filename);
+  fd = open(filename, O_RDONLY);
+  assert(pread(fd, &major, 1, at) == 1 && major == 2);
+  // with 'entries' as 2.0 wrote it: 32 bits, then what was padding
+  uint32_t entries32[2];
+  assert(pread(fd, entries32, sizeof(entries32), 9 + sizeof(uint16_t)) ==
+         sizeof(entries32));
+  assert(entries32[0] == bloom.entries && entries32[1] == 0);
+  close(fd);
+  assert(bloom_init3(&flagged, 10000, 0.01, BLOOM_HASH64) == 0);
+  unlink(filename);
+  assert(bloom_save(&flagged, filename) == 0);
+  fd = open(filename, O_RDONLY);
+  assert(pread(fd, &major, 1, at) == 1 && major == 3);
+  close(fd);
+  bloom_free(&flagged);
+  assert(bloom_load(&flagged, filename) == 0);
+  assert(flagged.major == BLOOM_VERSION_MAJOR);
+  assert(flagged.flags == BLOOM_HASH64);
+  bloom_free(&flagged);
+  assert(bloom_init3(&flagged, 10000, 0.01, BLOOM_PAGED) == 0);
+  unlink(filename);
+  assert(bloom_save(&flagged, filename) == 0);
+  fd = open(filename, O_RDONLY);
+  assert(pread(fd, &major, 1, at) == 1 && major == 3);
+  close(fd);
+  bloom_free(&flagged);
+  assert(bloom_load(&flagged, filename) == 0);
+  assert(flagged.flags == BLOOM_PAGED);
+  bloom_free(&flagged);
+
   // data buffer too short
   bloom_save(&bloom, filename);
   truncate(filename, 75);
@@ -257,6 +2192,76 @@ static int basic()
 
   merge_test(100000, 0.001, 500);
 
+  merge_files_test();
+  save_background_test();
+
+  bank_test();
+
+  iov_test();
+
+  hash64_test();
+
+  enhanced_test();
+
+  struct bloom unready = NULL_BLOOM_FILTER;
+  assert(bloom_build_parallel(&unready, NULL, 0, 1) == -1);
+  build_parallel_test(1000, 0, 0, 2);
+  build_parallel_test(1000, 0, 1000, 1);
+  build_parallel_test(1000, 0, 1000, 7);
+  build_parallel_test(10000000, 0, 200000, 3);
+  build_parallel_test(10000000, BLOOM_HASH64, 200000, 0);
+  build_parallel_test(2500000, 0, 2500000, 3);
+  build_parallel_test(5000000, 0, 4200000, 0);
+  build_parallel_test(1000000, BLOOM_ENHANCED | BLOOM_POW2, 200000, 2);
+
+  budget_test();
+
+  fold_test(0);
+  fold_test(BLOOM_HASH64);
+  fold_test(BLOOM_ENHANCED);
+
+  handle_test();
+
+  u64_test(0);
+  u64_test(BLOOM_HASH64);
+  u64_test(BLOOM_POW2);
+  u64_test(BLOOM_ENHANCED);
+
+  kmer_test(0);
+  kmer_test(BLOOM_ENHANCED);
+  kmer_test(BLOOM_PAGED);
+
+  gather_test(0);
+  gather_test(BLOOM_POW2);
+  gather_test(BLOOM_HASH64 | BLOOM_POW2);
+
+  disk_test(0);
+  disk_test(BLOOM_HASH64);
+
+  sparse_test(0);
+  sparse_test(BLOOM_HASH64);
+  sparse_test(BLOOM_ENHANCED);
+  sparse_test(BLOOM_POW2);
+
+  cms_test(0);
+  cms_test(BLOOM_HASH64);
+  cms_test(BLOOM_POW2);
+
+  iblt_test(100000, 300, 200);
+  iblt_test(1000, 1, 0);
+  iblt_test(200000, 20000, 30000);
+
+  pool_test();
+
+  qf_test();
+
+  prefix_test(0);
+  prefix_test(BLOOM_PAGED);
+
+  trace_test();
+
+  reset_test();
+
   bits();
 
   struct bloom null_bloom = NULL_BLOOM_FILTER;
@@ -351,6 +2356,59 @@ static int add_random(unsigned int entries, double error, int count,
 }
 
 
+/** ***************************************************************************
+ * Like add_random() but for very large filters, which use BLOOM_HASH64.
+ *
+ * Elements are generated from a counter (plus a random salt) instead of
+ * read from /dev/urandom, so they can be regenerated for validation
+ * instead of being stored. After validating, 'samples' elements which
+ * were never added are checked to measure the false positive rate of the
+ * full filter, printed as an additional last column.
+ *
+ */
+static int add_sequence(unsigned long int entries, double error,
+                        unsigned long int samples)
+{
+  struct bloom bloom;
+  uint64_t key[2];
+  unsigned long int collisions = 0;
+  unsigned long int fp = 0;
+  unsigned long int n;
+
+  assert(bloom_init3(&bloom, entries, error, BLOOM_HASH64) == 0);
+
+  int fd = open("/dev/urandom", O_RDONLY);
+  assert(read(fd, &key[0], sizeof(uint64_t)) == sizeof(uint64_t));
+  close(fd);
+
+  for (n = 0; n < entries; n++) {
+    key[1] = n;
+    if (bloom_add(&bloom, key, sizeof(key))) { collisions++; }
+  }
+
+  for (n = 0; n < entries; n++) {
+    key[1] = n;
+    if (!bloom_check(&bloom, key, sizeof(key))) {
+      printf("error: data saved in filter is not there!\n");
+      exit(1);
+    }
+  }
+
+  for (n = entries; n < entries + samples; n++) {
+    key[1] = n;
+    fp += bloom_check(&bloom, key, sizeof(key));
+  }
+
+  printf("%lu %f %lu %lu %f %lu %f\n",
+         entries, error, entries, collisions,
+         (double)collisions / (double)entries, bloom.bytes,
+         (double)fp / (double)samples);
+
+  bloom_free(&bloom);
+  return 0;
+}
+
+
 /** ***************************************************************************
  * Simple loop to compare performance.
  *
@@ -443,6 +2501,10 @@ static int larger_tests()
  * This produces output that can be graphed with collisions/dograph
  * See also collision_test make target.
  *
+ * Same for very large (BLOOM_HASH64) filters: -H START END INCREMENT ERROR
+ * The output has one more column, the measured false positive rate of
+ * the full filter.
+ *
  * To test collisions, run with options: -c ENTRIES ERROR COUNT
  * Where 'ENTRIES' is the expected number of entries used to initialize the
  * bloom filter and 'ERROR' is the acceptable probability of collision
@@ -485,6 +2547,20 @@ int main(int argc, char **argv)
     return rv;
   }
 
+  if (!strncmp(argv[1], "-H", 2)) {
+    if (argc != 6) {
+      printf("-H START END INCREMENT ERROR\n");
+      return 1;
+    }
+    unsigned long int e;
+    unsigned long int end = strtoul(argv[3], NULL, 10);
+    unsigned long int inc = strtoul(argv[4], NULL, 10);
+    for (e = strtoul(argv[2], NULL, 10); e <= end; e += inc) {
+      rv += add_sequence(e, atof(argv[5]), 100000000);
+    }
+    return rv;
+  }
+
   if (!strncmp(argv[1], "-c", 2)) {
     if (argc != 5) {
       printf("-c ENTRIES ERROR COUNT\n");
@@ -8,10 +8,14 @@
 
 // And it has a few limitations -
 
-// 1. It will not work incrementally.
+// 1. It will not work incrementally. (But see murmurhash2_init() below.)
 // 2. It will not produce the same results on little-endian and big-endian
 //    machines.
 
+#include <string.h>
+
+#include "murmurhash2.h"
+
 unsigned int murmurhash2(const void * key, int len, const unsigned int seed)
 {
 	// 'm' and 'r' are mixing constants generated offline.
@@ -62,3 +66,233 @@ unsigned int murmurhash2(const void * key, int len, const unsigned int seed)
 
 	return h;
 }
+
+
+//-----------------------------------------------------------------------------
+// Incremental variant of the above, producing identical results. Since the
+// length is mixed into the initial hash, it must be given up front.
+
+void murmurhash2_init(struct murmurhash2_state * state,
+                      const unsigned int seed, size_t len)
+{
+	state->h = seed ^ (unsigned int)len;
+	state->tail_len = 0;
+}
+
+void murmurhash2_update(struct murmurhash2_state * state,
+                        const void * key, size_t len)
+{
+	const unsigned int m = 0x5bd1e995;
+	const int r = 24;
+
+	const unsigned char * data = (const unsigned char *)key;
+	unsigned int h = state->h;
+	unsigned int k;
+
+	// Complete a block left over from the previous call first
+
+	if(state->tail_len)
+	{
+		while(state->tail_len < 4 && len)
+		{
+			state->tail[state->tail_len++] = *data++;
+			len--;
+		}
+
+		if(state->tail_len < 4) return;
+
+		k = *(unsigned int *)state->tail;
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h *= m;
+		h ^= k;
+
+		state->tail_len = 0;
+	}
+
+	while(len >= 4)
+	{
+		k = *(unsigned int *)data;
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h *= m;
+		h ^= k;
+
+		data += 4;
+		len -= 4;
+	}
+
+	while(len--)
+	{
+		state->tail[state->tail_len++] = *data++;
+	}
+
+	state->h = h;
+}
+
+unsigned int murmurhash2_final(struct murmurhash2_state * state)
+{
+	const unsigned int m = 0x5bd1e995;
+
+	unsigned int h = state->h;
+	const unsigned char * data = state->tail;
+
+	switch(state->tail_len)
+	{
+	case 3: h ^= data[2] << 16;
+	case 2: h ^= data[1] << 8;
+	case 1: h ^= data[0];
+	        h *= m;
+	};
+
+	h ^= h >> 13;
+	h *= m;
+	h ^= h >> 15;
+
+	return h;
+}
+
+
+//-----------------------------------------------------------------------------
+// MurmurHash64A, 64-bit hash for 64-bit platforms, by Austin Appleby
+
+uint64_t murmurhash64a(const void * key, size_t len, const uint64_t seed)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const int r = 47;
+
+	uint64_t h = seed ^ (len * m);
+
+	const unsigned char * data = (const unsigned char *)key;
+	const unsigned char * end = data + (len & ~(size_t)7);
+
+	while(data != end)
+	{
+		uint64_t k;
+		memcpy(&k, data, 8);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+
+		data += 8;
+	}
+
+	switch(len & 7)
+	{
+	case 7: h ^= (uint64_t)data[6] << 48;
+	case 6: h ^= (uint64_t)data[5] << 40;
+	case 5: h ^= (uint64_t)data[4] << 32;
+	case 4: h ^= (uint64_t)data[3] << 24;
+	case 3: h ^= (uint64_t)data[2] << 16;
+	case 2: h ^= (uint64_t)data[1] << 8;
+	case 1: h ^= (uint64_t)data[0];
+	        h *= m;
+	};
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+void murmurhash64a_init(struct murmurhash64a_state * state,
+                        const uint64_t seed, size_t len)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+
+	state->h = seed ^ (len * m);
+	state->tail_len = 0;
+}
+
+void murmurhash64a_update(struct murmurhash64a_state * state,
+                          const void * key, size_t len)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const int r = 47;
+
+	const unsigned char * data = (const unsigned char *)key;
+	uint64_t h = state->h;
+	uint64_t k;
+
+	if(state->tail_len)
+	{
+		while(state->tail_len < 8 && len)
+		{
+			state->tail[state->tail_len++] = *data++;
+			len--;
+		}
+
+		if(state->tail_len < 8) return;
+
+		memcpy(&k, state->tail, 8);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+
+		state->tail_len = 0;
+	}
+
+	while(len >= 8)
+	{
+		memcpy(&k, data, 8);
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+
+		data += 8;
+		len -= 8;
+	}
+
+	while(len--)
+	{
+		state->tail[state->tail_len++] = *data++;
+	}
+
+	state->h = h;
+}
+
+uint64_t murmurhash64a_final(struct murmurhash64a_state * state)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const int r = 47;
+
+	uint64_t h = state->h;
+	const unsigned char * data = state->tail;
+
+	switch(state->tail_len)
+	{
+	case 7: h ^= (uint64_t)data[6] << 48;
+	case 6: h ^= (uint64_t)data[5] << 40;
+	case 5: h ^= (uint64_t)data[4] << 32;
+	case 4: h ^= (uint64_t)data[3] << 24;
+	case 3: h ^= (uint64_t)data[2] << 16;
+	case 2: h ^= (uint64_t)data[1] << 8;
+	case 1: h ^= (uint64_t)data[0];
+	        h *= m;
+	};
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
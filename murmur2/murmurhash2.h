@@ -1,7 +1,45 @@
-
 #ifndef _BLOOM_MURMURHASH2
 #define _BLOOM_MURMURHASH2
 
+#include <stddef.h>
+#include <stdint.h>
+
 unsigned int murmurhash2(const void * key, int len, const unsigned int seed);
 
+// Incremental form of murmurhash2(). The total length of the key must be
+// known up front, the result is then identical to murmurhash2() over the
+// concatenation of all the murmurhash2_update() calls.
+
+struct murmurhash2_state
+{
+  unsigned int h;
+  unsigned int tail_len;
+  unsigned char tail[4];
+};
+
+void murmurhash2_init(struct murmurhash2_state * state,
+                      const unsigned int seed, size_t len);
+void murmurhash2_update(struct murmurhash2_state * state,
+                        const void * key, size_t len);
+unsigned int murmurhash2_final(struct murmurhash2_state * state);
+
+// MurmurHash64A, the 64-bit variant of murmurhash2 (for 64-bit platforms).
+// The length is a size_t so keys of any size can be hashed, with the same
+// incremental interface as above.
+
+uint64_t murmurhash64a(const void * key, size_t len, const uint64_t seed);
+
+struct murmurhash64a_state
+{
+  uint64_t h;
+  unsigned int tail_len;
+  unsigned char tail[8];
+};
+
+void murmurhash64a_init(struct murmurhash64a_state * state,
+                        const uint64_t seed, size_t len);
+void murmurhash64a_update(struct murmurhash64a_state * state,
+                          const void * key, size_t len);
+uint64_t murmurhash64a_final(struct murmurhash64a_state * state);
+
 #endif
@@ -0,0 +1,1066 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+  bloomd - serve named bloom filters to local clients.
+
+  Several processes on one machine can share the same (large) filters by
+  talking to bloomd over a Unix domain socket instead of each keeping its
+  own copy. See bloomd.h for the protocol.
+
+  Usage: bloomd -s SOCKET [-d DATADIR] [-m MODE] [-t THREADS]
+
+  The socket is created with MODE (octal, default 0600), which is what
+  controls who may use the filters. SAVE and LOAD take paths relative to
+  DATADIR and are refused without one, so clients can't read or replace
+  files elsewhere. An existing SOCKET is only replaced if it is a socket.
+
+  The main thread runs a poll() event loop which accepts connections,
+  reads requests and writes responses. Complete requests are handed to a
+  pool of worker threads (by default one per online CPU) which execute
+  them. All requests of one connection go to the same worker, which keeps
+  responses in request order without any reordering logic; different
+  connections are served in parallel.
+
+  Each filter has a reader/writer lock: any number of workers may check
+  the same filter at once while adds to it are serialized, which is also
+  why ADD and CHECK take whole batches of elements.
+
+  SAVE writes a snapshot from a child process (bloom_save_background()).
+  The main thread reaps it when SIGCHLD wakes it up and only then sends
+  the response and dispatches the next requests of that connection, so a
+  LOAD following a SAVE sees the file. Other connections go on meanwhile.
+
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bloom.h"
+#include "bloomd.h"
+
+// Stop reading from a connection while this much output is pending.
+#define MAX_PENDING_OUTPUT (64 * 1024 * 1024)
+
+#define READ_SIZE (256 * 1024)
+
+
+struct buffer
+{
+  unsigned char * data;
+  size_t len;
+  size_t cap;
+  size_t off;                   // bytes already consumed from the front
+};
+
+struct filter
+{
+  struct filter * next;
+  char * name;
+  uint16_t name_len;
+  pthread_rwlock_t lock;
+  struct bloom bloom;
+  uint64_t adds;
+  uint64_t checks;
+};
+
+struct conn
+{
+  struct conn * next;
+  int fd;
+  int closed;
+  int eof;                      // peer is done writing, main thread only
+  int worker;
+  int refs;
+  int saving;                   // a SAVE was dispatched, main thread only
+  struct buffer in;             // only touched by the main thread
+  pthread_mutex_t lock;         // protects 'out' and the save below
+  struct buffer out;
+  struct bloom_snapshot save;   // started by the SAVE, if its 'pid' is set
+  struct bloomd_resp_header save_rh;
+};
+
+struct orphan
+{
+  struct orphan * next;
+  struct bloom_snapshot save;
+};
+
+struct job
+{
+  struct job * next;
+  struct conn * conn;
+  struct bloomd_req_header header;
+  unsigned char * body;
+};
+
+struct worker
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct job * head;
+  struct job * tail;
+};
+
+static struct filter * filters = NULL;
+static pthread_rwlock_t filters_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct worker * workers;
+static int nworkers;
+
+// Saves of connections closed before they completed, still to be reaped.
+static struct orphan * orphans = NULL;
+static pthread_mutex_t orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char * data_dir = NULL;
+
+static int wake_pipe[2];
+static volatile sig_atomic_t stop = 0;
+
+
+static void * xmalloc(size_t size)
+{
+  void * p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "bloomd: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+
+static void buffer_append(struct buffer * b, const void * data, size_t len)
+{
+  if (b->off > 0 && b->off == b->len) {
+    b->off = 0;
+    b->len = 0;
+  }
+
+  if (b->len + len > b->cap) {
+    if (b->off > 0) {
+      memmove(b->data, b->data + b->off, b->len - b->off);
+      b->len -= b->off;
+      b->off = 0;
+    }
+    while (b->len + len > b->cap) {
+      b->cap = b->cap ? b->cap * 2 : 64 * 1024;
+    }
+    b->data = realloc(b->data, b->cap);
+    if (b->data == NULL) {
+      fprintf(stderr, "bloomd: out of memory\n");
+      exit(1);
+    }
+  }
+
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+
+static void wake_main()
+{
+  char c = 0;
+  // A full pipe already guarantees a wakeup, so errors are ignored.
+  if (write(wake_pipe[1], &c, 1) < 0) { }
+}
+
+
+static void conn_release(struct conn * conn)
+{
+  if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_destroy(&conn->lock);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+  }
+}
+
+
+static void orphan_save(struct bloom_snapshot * save)
+{
+  struct orphan * o = (struct orphan *)xmalloc(sizeof(struct orphan));
+  o->save = *save;
+  memset(save, 0, sizeof(struct bloom_snapshot));
+  pthread_mutex_lock(&orphans_lock);
+  o->next = orphans;
+  orphans = o;
+  pthread_mutex_unlock(&orphans_lock);
+}
+
+
+static void reap_orphans(int block)
+{
+  pthread_mutex_lock(&orphans_lock);
+  struct orphan ** prev = &orphans;
+  while (*prev != NULL) {
+    struct orphan * o = *prev;
+    if (bloom_save_wait(&o->save, block) == 2) {
+      prev = &o->next;
+    } else {
+      *prev = o->next;
+      free(o);
+    }
+  }
+  pthread_mutex_unlock(&orphans_lock);
+}
+
+
+/*
+ * Find filter by name. Caller holds filters_lock.
+ *
+ */
+static struct filter * find_filter(const unsigned char * name, uint16_t len,
+                                   struct filter *** prevp)
+{
+  struct filter ** prev = &filters;
+  struct filter * f;
+
+  for (f = filters; f != NULL; f = f->next) {
+    if (f->name_len == len && !memcmp(f->name, name, len)) {
+      break;
+    }
+    prev = &f->next;
+  }
+
+  if (prevp) { *prevp = prev; }
+  return f;
+}
+
+
+static struct filter * new_filter(const unsigned char * name, uint16_t len)
+{
+  struct filter * f = (struct filter *)xmalloc(sizeof(struct filter));
+  memset(f, 0, sizeof(struct filter));
+  f->name = (char *)xmalloc(len + 1);
+  memcpy(f->name, name, len);
+  f->name[len] = 0;
+  f->name_len = len;
+  pthread_rwlock_init(&f->lock, NULL);
+  return f;
+}
+
+
+static void free_filter(struct filter * f)
+{
+  bloom_free(&f->bloom);
+  pthread_rwlock_destroy(&f->lock);
+  free(f->name);
+  free(f);
+}
+
+
+/*
+ * Path of the file named by a SAVE or LOAD payload, within data_dir.
+ * Returns NULL if it is empty, absolute or has a ".." component, or if
+ * there is no data_dir.
+ *
+ */
+static char * data_path(const unsigned char * p, size_t len)
+{
+  size_t n, start = 0;
+
+  if (data_dir == NULL || len == 0 || p[0] == '/' || memchr(p, 0, len)) {
+    return NULL;
+  }
+
+  for (n = 0; n <= len; n++) {
+    if (n == len || p[n] == '/') {
+      if (n - start == 2 && p[start] == '.' && p[start + 1] == '.') {
+        return NULL;
+      }
+      start = n + 1;
+    }
+  }
+
+  size_t dlen = strlen(data_dir);
+  char * path = (char *)xmalloc(dlen + 1 + len + 1);
+  memcpy(path, data_dir, dlen);
+  path[dlen] = '/';
+  memcpy(path + dlen + 1, p, len);
+  path[dlen + 1 + len] = 0;
+  return path;
+}
+
+
+/*
+ * Validate an ADD/CHECK payload. Returns number of elements or -1.
+ *
+ */
+static long batch_count(const unsigned char * p, size_t len)
+{
+  uint32_t count, elen, n;
+  size_t off = sizeof(uint32_t);
+
+  if (len < sizeof(uint32_t)) { return -1; }
+  memcpy(&count, p, sizeof(uint32_t));
+
+  for (n = 0; n < count; n++) {
+    if (len - off < sizeof(uint32_t)) { return -1; }
+    memcpy(&elen, p + off, sizeof(uint32_t));
+    off += sizeof(uint32_t);
+    if (len - off < elen || elen > INT32_MAX) { return -1; }
+    off += elen;
+  }
+
+  if (off != len) { return -1; }
+  return count;
+}
+
+
+static uint8_t do_batch(struct job * job, const unsigned char * name,
+                        const unsigned char * p, size_t len,
+                        struct buffer * resp)
+{
+  int add = job->header.op == BLOOMD_ADD;
+  long count = batch_count(p, len);
+  if (count < 0) { return BLOOMD_BAD_REQ; }
+
+  pthread_rwlock_rdlock(&filters_lock);
+
+  struct filter * f = find_filter(name, job->header.name_len, NULL);
+  if (f == NULL) {
+    pthread_rwlock_unlock(&filters_lock);
+    return BLOOMD_NO_FILTER;
+  }
+
+  unsigned char * results = (unsigned char *)xmalloc(count ? count : 1);
+  size_t off = sizeof(uint32_t);
+  uint32_t elen;
+  long n;
+
+  if (add) {
+    pthread_rwlock_wrlock(&f->lock);
+  } else {
+    pthread_rwlock_rdlock(&f->lock);
+  }
+
+  for (n = 0; n < count; n++) {
+    memcpy(&elen, p + off, sizeof(uint32_t));
+    off += sizeof(uint32_t);
+    if (add) {
+      results[n] = (unsigned char)bloom_add(&f->bloom, p + off, (int)elen);
+    } else {
+      results[n] = (unsigned char)bloom_check(&f->bloom, p + off, (int)elen);
+    }
+    off += elen;
+  }
+
+  pthread_rwlock_unlock(&f->lock);
+  __atomic_add_fetch(add ? &f->adds : &f->checks, count, __ATOMIC_RELAXED);
+  pthread_rwlock_unlock(&filters_lock);
+
+  uint32_t c = (uint32_t)count;
+  buffer_append(resp, &c, sizeof(uint32_t));
+  buffer_append(resp, results, count);
+  free(results);
+
+  return BLOOMD_OK;
+}
+
+
+static int filter_exists(const unsigned char * name, uint16_t len)
+{
+  pthread_rwlock_rdlock(&filters_lock);
+  int exists = find_filter(name, len, NULL) != NULL;
+  pthread_rwlock_unlock(&filters_lock);
+  return exists;
+}
+
+
+static uint8_t do_create(struct job * job, const unsigned char * name,
+                         const unsigned char * p, size_t len, int load)
+{
+  struct bloomd_create create;
+  struct bloom bloom;
+  char * path = NULL;
+  int rv;
+
+  if (load) {
+    path = data_path(p, len);
+    if (path == NULL) { return BLOOMD_DENIED; }
+  } else if (len != sizeof(struct bloomd_create)) {
+    return BLOOMD_BAD_REQ;
+  }
+
+  // Reading (or allocating) a large filter takes a while, so it is done
+  // without holding filters_lock, which would stop all other requests.
+  // The quick check up front only avoids doing it for nothing.
+  if (filter_exists(name, job->header.name_len)) {
+    free(path);
+    return BLOOMD_EXISTS;
+  }
+
+  if (load) {
+    rv = bloom_load(&bloom, path);
+    free(path);
+  } else {
+    memcpy(&create, p, sizeof(struct bloomd_create));
+    rv = bloom_init3(&bloom, create.entries, create.error, create.flags);
+  }
+
+  if (rv) {
+    return BLOOMD_FAILED;
+  }
+
+  pthread_rwlock_wrlock(&filters_lock);
+
+  if (find_filter(name, job->header.name_len, NULL)) {
+    pthread_rwlock_unlock(&filters_lock);
+    bloom_free(&bloom);
+    return BLOOMD_EXISTS;
+  }
+
+  struct filter * f = new_filter(name, job->header.name_len);
+  f->bloom = bloom;
+  f->next = filters;
+  filters = f;
+
+  pthread_rwlock_unlock(&filters_lock);
+  return BLOOMD_OK;
+}
+
+
+static uint8_t do_drop(struct job * job, const unsigned char * name)
+{
+  struct filter ** prev;
+  uint8_t status = BLOOMD_OK;
+
+  // Holding filters_lock for write means no other request is using any
+  // filter, so the filter can be freed right away.
+  pthread_rwlock_wrlock(&filters_lock);
+
+  struct filter * f = find_filter(name, job->header.name_len, &prev);
+  if (f == NULL) {
+    status = BLOOMD_NO_FILTER;
+  } else {
+    *prev = f->next;
+    free_filter(f);
+  }
+
+  pthread_rwlock_unlock(&filters_lock);
+  return status;
+}
+
+
+static uint8_t do_save(struct job * job, const unsigned char * name,
+                       const unsigned char * p, size_t len,
+                       struct bloom_snapshot * snapshot)
+{
+  uint8_t status = BLOOMD_OK;
+
+  char * path = data_path(p, len);
+  if (path == NULL) { return BLOOMD_DENIED; }
+
+  pthread_rwlock_rdlock(&filters_lock);
+
+  // The filter is only locked while the save starts, adds to it continue
+  // while the snapshot is written. The main thread waits for it.
+  struct filter * f = find_filter(name, job->header.name_len, NULL);
+  if (f == NULL) {
+    status = BLOOMD_NO_FILTER;
+  } else {
+    pthread_rwlock_rdlock(&f->lock);
+    if (bloom_save_background(&f->bloom, path, snapshot)) {
+      status = BLOOMD_FAILED;
+    }
+    pthread_rwlock_unlock(&f->lock);
+  }
+
+  pthread_rwlock_unlock(&filters_lock);
+  free(path);
+  return status;
+}
+
+
+static uint8_t do_merge(struct job * job, const unsigned char * name,
+                        const unsigned char * p, size_t len)
+{
+  uint8_t status = BLOOMD_OK;
+
+  if (len > UINT16_MAX) { return BLOOMD_BAD_REQ; }
+
+  pthread_rwlock_rdlock(&filters_lock);
+
+  struct filter * dest = find_filter(name, job->header.name_len, NULL);
+  struct filter * src = find_filter(p, (uint16_t)len, NULL);
+
+  if (dest == NULL || src == NULL) {
+    status = BLOOMD_NO_FILTER;
+  } else if (dest == src) {
+    status = BLOOMD_BAD_REQ;
+  } else {
+    // Always lock in the same (address) order to avoid deadlocking with
+    // a concurrent merge in the opposite direction.
+    if (dest < src) {
+      pthread_rwlock_wrlock(&dest->lock);
+      pthread_rwlock_rdlock(&src->lock);
+    } else {
+      pthread_rwlock_rdlock(&src->lock);
+      pthread_rwlock_wrlock(&dest->lock);
+    }
+    if (bloom_merge(&dest->bloom, &src->bloom)) {
+      status = BLOOMD_FAILED;
+    }
+    pthread_rwlock_unlock(&src->lock);
+    pthread_rwlock_unlock(&dest->lock);
+  }
+
+  pthread_rwlock_unlock(&filters_lock);
+  return status;
+}
+
+
+static uint8_t do_stats(struct job * job, const unsigned char * name,
+                        struct buffer * resp)
+{
+  struct bloomd_stats stats;
+  uint8_t status = BLOOMD_OK;
+
+  pthread_rwlock_rdlock(&filters_lock);
+
+  struct filter * f = find_filter(name, job->header.name_len, NULL);
+  if (f == NULL) {
+    status = BLOOMD_NO_FILTER;
+  } else {
+    memset(&stats, 0, sizeof(stats));
+    stats.entries = f->bloom.entries;
+    stats.bits = f->bloom.bits;
+    stats.bytes = f->bloom.bytes;
+    stats.error = f->bloom.error;
+    stats.hashes = f->bloom.hashes;
+    stats.flags = f->bloom.flags;
+    stats.adds = __atomic_load_n(&f->adds, __ATOMIC_RELAXED);
+    stats.checks = __atomic_load_n(&f->checks, __ATOMIC_RELAXED);
+    buffer_append(resp, &stats, sizeof(stats));
+  }
+
+  pthread_rwlock_unlock(&filters_lock);
+  return status;
+}
+
+
+static void run_job(struct job * job)
+{
+  struct buffer resp;
+  struct bloomd_resp_header rh;
+  struct bloom_snapshot save;
+  uint8_t status;
+
+  memset(&resp, 0, sizeof(resp));
+  memset(&rh, 0, sizeof(rh));
+  memset(&save, 0, sizeof(save));
+  buffer_append(&resp, &rh, sizeof(rh));
+
+  const unsigned char * name = job->body;
+  const unsigned char * p = job->body + job->header.name_len;
+  size_t len = job->header.length - job->header.name_len;
+
+  switch (job->header.op) {
+  case BLOOMD_CREATE: status = do_create(job, name, p, len, 0); break;
+  case BLOOMD_LOAD:   status = do_create(job, name, p, len, 1); break;
+  case BLOOMD_DROP:   status = do_drop(job, name); break;
+  case BLOOMD_ADD:
+  case BLOOMD_CHECK:  status = do_batch(job, name, p, len, &resp); break;
+  case BLOOMD_SAVE:   status = do_save(job, name, p, len, &save); break;
+  case BLOOMD_MERGE:  status = do_merge(job, name, p, len); break;
+  case BLOOMD_STATS:  status = do_stats(job, name, &resp); break;
+  default:            status = BLOOMD_BAD_REQ; break;
+  }
+
+  if (status != BLOOMD_OK) {
+    resp.len = sizeof(rh);
+  }
+
+  rh.length = (uint32_t)(resp.len - sizeof(rh));
+  rh.id = job->header.id;
+  rh.op = job->header.op;
+  rh.status = status;
+  memcpy(resp.data, &rh, sizeof(rh));
+
+  // A started save is answered by the main thread once it completes.
+  struct conn * conn = job->conn;
+  pthread_mutex_lock(&conn->lock);
+  if (__atomic_load_n(&conn->closed, __ATOMIC_ACQUIRE)) {
+    if (save.pid) { orphan_save(&save); }
+  } else if (save.pid) {
+    conn->save = save;
+    conn->save_rh = rh;
+  } else {
+    buffer_append(&conn->out, resp.data, resp.len);
+  }
+  pthread_mutex_unlock(&conn->lock);
+
+  free(resp.data);
+}
+
+
+static void * worker_main(void * arg)
+{
+  struct worker * w = (struct worker *)arg;
+  struct job * job;
+
+  while (1) {
+    pthread_mutex_lock(&w->lock);
+    while (w->head == NULL) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+    job = w->head;
+    w->head = job->next;
+    if (w->head == NULL) { w->tail = NULL; }
+    pthread_mutex_unlock(&w->lock);
+
+    run_job(job);
+
+    // Woken only after the release, so the main thread sees both the
+    // response and the job being done (see conn_done()).
+    conn_release(job->conn);
+    wake_main();
+    free(job->body);
+    free(job);
+  }
+
+  return NULL;
+}
+
+
+static void dispatch(struct conn * conn, struct bloomd_req_header * header,
+                     const unsigned char * body)
+{
+  struct job * job = (struct job *)xmalloc(sizeof(struct job));
+  job->next = NULL;
+  job->conn = conn;
+  job->header = *header;
+  job->body = (unsigned char *)xmalloc(header->length ? header->length : 1);
+  memcpy(job->body, body, header->length);
+
+  __atomic_add_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL);
+
+  struct worker * w = &workers[conn->worker];
+  pthread_mutex_lock(&w->lock);
+  if (w->tail) {
+    w->tail->next = job;
+  } else {
+    w->head = job;
+  }
+  w->tail = job;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+}
+
+
+/*
+ * Dispatch the complete requests read so far, up to and including the
+ * first SAVE. Returns 0 if the connection is to be closed.
+ *
+ */
+static int conn_dispatch(struct conn * conn)
+{
+  struct buffer * in = &conn->in;
+  struct bloomd_req_header header;
+
+  while (!conn->saving && in->len - in->off >= sizeof(header)) {
+    memcpy(&header, in->data + in->off, sizeof(header));
+    if (header.length > BLOOMD_MAX_REQUEST ||
+        header.name_len > header.length) {
+      return 0;
+    }
+    if (in->len - in->off - sizeof(header) < header.length) {
+      break;
+    }
+    dispatch(conn, &header, in->data + in->off + sizeof(header));
+    in->off += sizeof(header) + header.length;
+    conn->saving = header.op == BLOOMD_SAVE;
+  }
+
+  if (in->off == in->len) {
+    in->off = 0;
+    in->len = 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Read what is available from the connection and dispatch all complete
+ * requests. Returns 0 if the connection is to be closed. At end of file
+ * the connection is marked 'eof' instead, it is closed by conn_done() once
+ * the responses to its requests have been written.
+ *
+ */
+static int conn_read(struct conn * conn)
+{
+  struct buffer * in = &conn->in;
+
+  if (in->cap - in->len < READ_SIZE) {
+    if (in->off > 0) {
+      memmove(in->data, in->data + in->off, in->len - in->off);
+      in->len -= in->off;
+      in->off = 0;
+    }
+    while (in->cap - in->len < READ_SIZE) {
+      in->cap = in->cap ? in->cap * 2 : READ_SIZE * 2;
+    }
+    in->data = realloc(in->data, in->cap);
+    if (in->data == NULL) {
+      fprintf(stderr, "bloomd: out of memory\n");
+      exit(1);
+    }
+  }
+
+  ssize_t n = read(conn->fd, in->data + in->len, in->cap - in->len);
+  if (n == 0) {
+    conn->eof = 1;
+    return 1;
+  }
+  if (n < 0) { return errno == EAGAIN || errno == EINTR; }
+  in->len += n;
+
+  return conn_dispatch(conn);
+}
+
+
+/*
+ * If the connection's SAVE has run and its snapshot is written, queue the
+ * response and dispatch the requests which followed it. Returns 0 if the
+ * connection is to be closed.
+ *
+ */
+static int conn_save_done(struct conn * conn)
+{
+  // No other request is dispatched while saving, so once only the main
+  // thread's reference is left the worker is done with the SAVE.
+  if (!conn->saving || __atomic_load_n(&conn->refs, __ATOMIC_ACQUIRE) > 1) {
+    return 1;
+  }
+
+  pthread_mutex_lock(&conn->lock);
+  if (conn->save.pid) {
+    int rv = bloom_save_wait(&conn->save, 0);
+    if (rv == 2) {
+      pthread_mutex_unlock(&conn->lock);
+      return 1;
+    }
+    conn->save_rh.status = rv ? BLOOMD_FAILED : BLOOMD_OK;
+    buffer_append(&conn->out, &conn->save_rh, sizeof(conn->save_rh));
+  }
+  pthread_mutex_unlock(&conn->lock);
+
+  conn->saving = 0;
+  return conn_dispatch(conn);
+}
+
+
+/*
+ * Write as much pending output as the socket takes. Returns 0 if the
+ * connection is to be closed.
+ *
+ */
+static int conn_flush(struct conn * conn)
+{
+  int ok = 1;
+
+  pthread_mutex_lock(&conn->lock);
+  struct buffer * out = &conn->out;
+  while (out->len > out->off) {
+    ssize_t n = write(conn->fd, out->data + out->off, out->len - out->off);
+    if (n < 0) {
+      ok = errno == EAGAIN || errno == EINTR;
+      break;
+    }
+    out->off += n;
+  }
+  pthread_mutex_unlock(&conn->lock);
+
+  return ok;
+}
+
+
+static size_t conn_pending(struct conn * conn)
+{
+  pthread_mutex_lock(&conn->lock);
+  size_t pending = conn->out.len - conn->out.off;
+  pthread_mutex_unlock(&conn->lock);
+  return pending;
+}
+
+
+/*
+ * Whether the connection is at end of file with no requests in progress
+ * and all responses written, so it can be closed.
+ *
+ */
+static int conn_done(struct conn * conn)
+{
+  return conn->eof && !conn->saving &&
+    __atomic_load_n(&conn->refs, __ATOMIC_ACQUIRE) == 1 &&
+    conn_pending(conn) == 0;
+}
+
+
+static void on_signal(int sig)
+{
+  stop = 1;
+  wake_main();
+}
+
+
+static void on_child(int sig)
+{
+  int saved_errno = errno;
+  wake_main();
+  errno = saved_errno;
+}
+
+
+static void usage()
+{
+  printf("usage: bloomd -s SOCKET [-d DATADIR] [-m MODE] [-t THREADS]\n");
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  char * path = NULL;
+  long mode = 0600;
+  int threads = 0;
+  int opt, n;
+  char * end;
+  struct stat st;
+
+  while ((opt = getopt(argc, argv, "s:d:m:t:")) != -1) {
+    switch (opt) {
+    case 's': path = optarg; break;
+    case 'd': data_dir = optarg; break;
+    case 'm':
+      mode = strtol(optarg, &end, 8);
+      if (*optarg == 0 || *end != 0 || mode < 0 || mode > 0777) { usage(); }
+      break;
+    case 't': threads = atoi(optarg); break;
+    default: usage();
+    }
+  }
+
+  if (path == NULL) { usage(); }
+
+  if (data_dir != NULL && (stat(data_dir, &st) || !S_ISDIR(st.st_mode))) {
+    fprintf(stderr, "bloomd: %s is not a directory\n", data_dir);
+    exit(1);
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "bloomd: socket path too long\n");
+    exit(1);
+  }
+  strcpy(addr.sun_path, path);
+
+  if (threads <= 0) {
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) { threads = 1; }
+  }
+
+  if (pipe(wake_pipe)) {
+    perror("bloomd: pipe");
+    exit(1);
+  }
+  fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  // Completed saves are reaped by bloom_save_wait() in the event loop.
+  signal(SIGCHLD, on_child);
+
+  int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (lfd < 0) {
+    perror("bloomd: socket");
+    exit(1);
+  }
+  // Replace a socket left behind by a previous run, but nothing else.
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "bloomd: %s exists and is not a socket\n", path);
+      exit(1);
+    }
+    unlink(path);
+  }
+
+  // Created inaccessible to others, so nobody can connect before the
+  // requested mode is set.
+  mode_t old_umask = umask(0177);
+  int rv = bind(lfd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_umask);
+  if (rv || chmod(path, (mode_t)mode) || listen(lfd, 128)) {
+    perror("bloomd: bind");
+    exit(1);
+  }
+  fcntl(lfd, F_SETFL, O_NONBLOCK);
+
+  nworkers = threads;
+  workers = (struct worker *)xmalloc(nworkers * sizeof(struct worker));
+  memset(workers, 0, nworkers * sizeof(struct worker));
+  for (n = 0; n < nworkers; n++) {
+    pthread_mutex_init(&workers[n].lock, NULL);
+    pthread_cond_init(&workers[n].cond, NULL);
+    if (pthread_create(&workers[n].thread, NULL, worker_main, &workers[n])) {
+      perror("bloomd: pthread_create");
+      exit(1);
+    }
+  }
+
+  struct conn * conns = NULL;
+  struct pollfd * pfds = NULL;
+  struct conn ** pconns = NULL;
+  int npfds = 0;
+  int next_worker = 0;
+
+  while (!stop) {
+
+    int count = 2;
+    struct conn * c;
+    for (c = conns; c != NULL; c = c->next) { count++; }
+
+    if (count > npfds) {
+      npfds = count * 2;
+      pfds = realloc(pfds, npfds * sizeof(struct pollfd));
+      pconns = realloc(pconns, npfds * sizeof(struct conn *));
+      if (pfds == NULL || pconns == NULL) {
+        fprintf(stderr, "bloomd: out of memory\n");
+        exit(1);
+      }
+    }
+
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = wake_pipe[0];
+    pfds[1].events = POLLIN;
+    count = 2;
+    for (c = conns; c != NULL; c = c->next) {
+      size_t pending = conn_pending(c);
+      pfds[count].fd = c->fd;
+      pfds[count].events = 0;
+      if (pending < MAX_PENDING_OUTPUT && !c->eof && !c->saving) {
+        pfds[count].events |= POLLIN;
+      }
+      if (pending > 0) { pfds[count].events |= POLLOUT; }
+      if (pfds[count].events == 0) {
+        // Only waiting for workers, which wake the pipe. The hangup
+        // poll() would keep reporting must not wake it up meanwhile.
+        pfds[count].fd = -1;
+      }
+      pconns[count] = c;
+      count++;
+    }
+
+    if (poll(pfds, count, -1) < 0) {
+      if (errno == EINTR) { continue; }
+      perror("bloomd: poll");
+      break;
+    }
+
+    if (pfds[1].revents) {
+      char drain[256];
+      while (read(wake_pipe[0], drain, sizeof(drain)) > 0) { }
+      for (c = conns; c != NULL; c = c->next) {
+        if (!conn_save_done(c)) {
+          __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+        }
+      }
+      reap_orphans(0);
+    }
+
+    for (n = 2; n < count; n++) {
+      c = pconns[n];
+      int ok = 1;
+      if (c->closed) {
+        continue;
+      }
+      if (pfds[n].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ok = conn_read(c);
+      }
+      if (ok) {
+        ok = conn_flush(c);
+      }
+      if (!ok || conn_done(c)) {
+        __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+      }
+    }
+
+    // Responses may have been queued for connections which saw no events.
+    if (pfds[1].revents) {
+      for (c = conns; c != NULL; c = c->next) {
+        if (!c->closed && !conn_flush(c)) {
+          __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+        }
+      }
+    }
+
+    struct conn ** prev = &conns;
+    while (*prev != NULL) {
+      c = *prev;
+      if (c->closed) {
+        *prev = c->next;
+        // Take the lock so no worker is appending to it while closing.
+        pthread_mutex_lock(&c->lock);
+        close(c->fd);
+        if (c->save.pid) { orphan_save(&c->save); }
+        pthread_mutex_unlock(&c->lock);
+        conn_release(c);
+      } else {
+        prev = &c->next;
+      }
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      int fd;
+      while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        c = (struct conn *)xmalloc(sizeof(struct conn));
+        memset(c, 0, sizeof(struct conn));
+        c->fd = fd;
+        c->refs = 1;
+        c->worker = next_worker;
+        next_worker = (next_worker + 1) % nworkers;
+        pthread_mutex_init(&c->lock, NULL);
+        c->next = conns;
+        conns = c;
+      }
+    }
+  }
+
+  // Let snapshots being written complete, they replace the files whole.
+  struct conn * c;
+  for (c = conns; c != NULL; c = c->next) {
+    pthread_mutex_lock(&c->lock);
+    if (c->save.pid) { orphan_save(&c->save); }
+    pthread_mutex_unlock(&c->lock);
+  }
+  reap_orphans(1);
+
+  close(lfd);
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+ * Wire protocol of bloomd, the local bloom filter server.
+ *
+ * bloomd listens on a Unix domain socket, so both ends are always on the
+ * same machine and all integers are sent in native byte order.
+ *
+ * A client sends any number of requests without waiting for responses
+ * (pipelining). Each request gets exactly one response. Responses on one
+ * connection are sent in the same order as the requests were received,
+ * and each echoes the 'id' of its request.
+ *
+ * Request:  struct bloomd_req_header, followed by 'name_len' bytes of
+ *           filter name, followed by the op specific payload. 'length' is
+ *           the size of everything after the header.
+ *
+ * Response: struct bloomd_resp_header, followed by 'length' bytes of op
+ *           specific payload (only present if status is BLOOMD_OK).
+ *
+ * Ops and their payloads:
+ *
+ * BLOOMD_CREATE  req:  struct bloomd_create
+ *                resp: (none)
+ *                Creates a new empty filter (see bloom_init3()).
+ *
+ * BLOOMD_DROP    req:  (none)
+ *                resp: (none)
+ *                Deletes the filter.
+ *
+ * BLOOMD_ADD     req:  uint32_t count, then 'count' times:
+ * BLOOMD_CHECK         uint32_t len, then 'len' bytes of element
+ *                resp: uint32_t count, then 'count' bytes, each the
+ *                      return value of bloom_add() or bloom_check()
+ *                      for the corresponding element.
+ *
+ * BLOOMD_SAVE    req:  path of file to save to (rest of the request)
+ *                resp: (none)
+ *                The path is relative to the data directory of the
+ *                server (bloomd -d), see BLOOMD_DENIED.
+ *
+ * BLOOMD_LOAD    req:  path of file to load from (rest of the request)
+ *                resp: (none)
+ *                Creates the filter from a file saved with bloom_save(),
+ *                the path is as for BLOOMD_SAVE.
+ *
+ * BLOOMD_MERGE   req:  name of the source filter (rest of the request)
+ *                resp: (none)
+ *                Merges the source filter into the named filter.
+ *
+ * BLOOMD_STATS   req:  (none)
+ *                resp: struct bloomd_stats
+ *
+ */
+
+#ifndef _BLOOMD_H
+#define _BLOOMD_H
+
+#include <stdint.h>
+
+#define BLOOMD_CREATE 1
+#define BLOOMD_DROP   2
+#define BLOOMD_ADD    3
+#define BLOOMD_CHECK  4
+#define BLOOMD_SAVE   5
+#define BLOOMD_LOAD   6
+#define BLOOMD_MERGE  7
+#define BLOOMD_STATS  8
+
+#define BLOOMD_OK         0
+#define BLOOMD_NO_FILTER  1         // named filter does not exist
+#define BLOOMD_EXISTS     2         // CREATE or LOAD of existing filter
+#define BLOOMD_BAD_REQ    3         // malformed request or unknown op
+#define BLOOMD_FAILED     4         // the libbloom call failed
+#define BLOOMD_DENIED     5         // SAVE or LOAD path is absolute, has a
+                                    // ".." component or the server has no
+                                    // data directory
+
+// Largest request accepted. Connections sending larger ones are closed.
+#define BLOOMD_MAX_REQUEST (1024 * 1024 * 1024)
+
+struct bloomd_req_header
+{
+  uint32_t length;
+  uint32_t id;
+  uint8_t op;
+  uint8_t reserved;
+  uint16_t name_len;
+};
+
+struct bloomd_resp_header
+{
+  uint32_t length;
+  uint32_t id;
+  uint8_t op;
+  uint8_t status;
+  uint16_t reserved;
+};
+
+struct bloomd_create
+{
+  uint64_t entries;
+  double error;
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+struct bloomd_stats
+{
+  uint64_t entries;
+  uint64_t bits;
+  uint64_t bytes;
+  double error;
+  uint32_t hashes;
+  uint32_t flags;
+  uint64_t adds;            // elements added since created or loaded
+  uint64_t checks;          // elements checked since created or loaded
+};
+
+#endif
@@ -0,0 +1,686 @@
+/*
+ *  Copyright (c) 2026, Jyri J. Virkki
+ *  All rights reserved.
+ *
+ *  This file is under BSD license. See LICENSE file.
+ */
+
+/*
+  bloomtool - build, query and maintain saved bloom filters from the shell.
+
+  Run without any arguments for usage info.
+
+  Elements are read from a file or from standard input, either one per
+  line ('\n' terminated, the '\n' not being part of the element) or with
+  -l as length-delimited records (a 4 byte little-endian length followed
+  by that many bytes of element). Regular files are mmap'ed, anything
+  else is read in large blocks.
+
+  'build' collects elements in batches of a few million and adds each
+  batch with bloom_build_parallel(), using all online CPUs unless -t
+  says otherwise.
+
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bloom.h"
+
+#define CHUNK_SIZE (4 * 1024 * 1024)
+#define BUILD_BATCH (4 * 1024 * 1024)
+#define OUTBUF_SIZE (1024 * 1024)
+
+
+struct input
+{
+  int fd;
+  int lenmode;
+  int eof;
+  unsigned char * map;          // whole file, if mmap'ed
+  size_t size;
+  size_t pos;
+  unsigned char * buf;          // unconsumed input, if streaming
+  size_t len;
+  size_t cap;
+};
+
+struct chunk
+{
+  struct chunk * next;
+  unsigned char * data;
+  size_t len;
+  int owned;
+};
+
+
+static void fail(const char * msg, const char * arg)
+{
+  fprintf(stderr, "bloomtool: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+  exit(1);
+}
+
+
+static void * xmalloc(size_t size)
+{
+  void * p = malloc(size);
+  if (p == NULL) { fail("out of memory", NULL); }
+  return p;
+}
+
+
+static uint32_t get_le32(const unsigned char * p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void input_open(struct input * in, const char * path, int lenmode)
+{
+  struct stat st;
+
+  memset(in, 0, sizeof(struct input));
+  in->lenmode = lenmode;
+  in->fd = 0;
+
+  if (path != NULL && strcmp(path, "-")) {
+    in->fd = open(path, O_RDONLY);
+    if (in->fd < 0) { fail("unable to open", path); }
+  }
+
+  if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    in->size = st.st_size;
+    in->map = mmap(NULL, in->size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (in->map == MAP_FAILED) {
+      in->map = NULL;
+    } else {
+      madvise(in->map, in->size, MADV_SEQUENTIAL);
+    }
+  }
+}
+
+
+static void input_close(struct input * in)
+{
+  if (in->map) { munmap(in->map, in->size); }
+  if (in->fd > 0) { close(in->fd); }
+  free(in->buf);
+}
+
+
+/*
+ * Return the length of the longest prefix of 'p' which consists of whole
+ * records. At end of input, whatever remains must be whole records.
+ *
+ */
+static size_t whole_records(const unsigned char * p, size_t len,
+                            int lenmode, int eof)
+{
+  if (!lenmode) {
+    if (eof) { return len; }
+    size_t n = len;
+    while (n > 0 && p[n - 1] != '\n') { n--; }
+    return n;
+  }
+
+  size_t off = 0;
+  while (len - off >= 4 && len - off - 4 >= get_le32(p + off)) {
+    off += 4 + get_le32(p + off);
+  }
+  if (eof && off != len) { fail("truncated length-delimited input", NULL); }
+  return off;
+}
+
+
+/*
+ * Get the next chunk of whole records. Returns 0 at end of input.
+ *
+ */
+static int input_next(struct input * in, struct chunk * chunk)
+{
+  size_t n;
+
+  memset(chunk, 0, sizeof(struct chunk));
+
+  if (in->map) {
+    if (in->pos == in->size) { return 0; }
+    size_t want = CHUNK_SIZE;
+    do {
+      if (want >= in->size - in->pos) {
+        n = whole_records(in->map + in->pos, in->size - in->pos,
+                          in->lenmode, 1);
+      } else {
+        n = whole_records(in->map + in->pos, want, in->lenmode, 0);
+      }
+      want *= 2;
+    } while (n == 0);
+    chunk->data = in->map + in->pos;
+    chunk->len = n;
+    in->pos += n;
+    return 1;
+  }
+
+  while (1) {
+    if (in->eof || in->len >= CHUNK_SIZE) {
+      n = whole_records(in->buf, in->len, in->lenmode, in->eof);
+      if (n > 0 || in->eof) { break; }
+    }
+    if (in->cap - in->len < CHUNK_SIZE) {
+      in->cap = in->cap ? in->cap * 2 : 2 * CHUNK_SIZE;
+      in->buf = realloc(in->buf, in->cap);
+      if (in->buf == NULL) { fail("out of memory", NULL); }
+    }
+    ssize_t r = read(in->fd, in->buf + in->len, in->cap - in->len);
+    if (r < 0) {
+      if (errno == EINTR) { continue; }
+      fail("read error", strerror(errno));
+    }
+    if (r == 0) { in->eof = 1; }
+    in->len += r;
+  }
+
+  if (n == 0) { return 0; }
+
+  chunk->data = (unsigned char *)xmalloc(n);
+  chunk->len = n;
+  chunk->owned = 1;
+  memcpy(chunk->data, in->buf, n);
+  memmove(in->buf, in->buf + n, in->len - n);
+  in->len -= n;
+  return 1;
+}
+
+
+/*
+ * Iterate over the records of a chunk. Returns 0 when there are no more.
+ *
+ */
+static int next_record(const unsigned char ** p, const unsigned char * end,
+                       int lenmode, const unsigned char ** key, size_t * len)
+{
+  if (*p >= end) { return 0; }
+
+  if (lenmode) {
+    *len = get_le32(*p);
+    *key = *p + 4;
+    *p += 4 + *len;
+    return 1;
+  }
+
+  const unsigned char * nl = memchr(*p, '\n', end - *p);
+  *key = *p;
+  if (nl == NULL) {
+    *len = end - *p;
+    *p = end;
+  } else {
+    *len = nl - *p;
+    *p = nl + 1;
+  }
+  return 1;
+}
+
+
+static int check_add(struct bloom * bloom, const unsigned char * key,
+                     size_t len, int add)
+{
+  if (len <= INT_MAX) {
+    return add ? bloom_add(bloom, key, (int)len)
+      : bloom_check(bloom, key, (int)len);
+  }
+
+  struct iovec iov = { (void *)key, len };
+  return add ? bloom_add_iov(bloom, &iov, 1) : bloom_check_iov(bloom, &iov, 1);
+}
+
+
+static struct bloom * load(const char * filename)
+{
+  struct bloom * bloom = (struct bloom *)xmalloc(sizeof(struct bloom));
+  int rv = bloom_load(bloom, (char *)filename);
+  if (rv) {
+    fprintf(stderr, "bloomtool: unable to load %s (error %d)\n", filename, rv);
+    exit(1);
+  }
+  return bloom;
+}
+
+
+static void save(struct bloom * bloom, const char * filename)
+{
+  // bloom_save() does not truncate, don't leave stale data behind.
+  unlink(filename);
+  if (bloom_save(bloom, (char *)filename)) {
+    fail("unable to save", filename);
+  }
+}
+
+
+/** ***************************************************************************
+ * build
+ *
+ */
+static void free_chunks(struct chunk * c)
+{
+  while (c) {
+    struct chunk * next = c->next;
+    if (c->owned) { free(c->data); }
+    free(c);
+    c = next;
+  }
+}
+
+
+static void add_batch(struct bloom * bloom, struct iovec * iov,
+                      unsigned long int count, int threads)
+{
+  if (count > 0 && bloom_build_parallel(bloom, iov, count, threads)) {
+    fail("unable to add elements", NULL);
+  }
+}
+
+
+static int cmd_build(int argc, char **argv)
+{
+  unsigned long int entries = 0;
+  double error = 0;
+  unsigned int flags = 0;
+  int threads = 0;
+  int lenmode = 0;
+  char * output = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:e:HPElt:o:")) != -1) {
+    switch (opt) {
+    case 'n': entries = strtoul(optarg, NULL, 10); break;
+    case 'e': error = atof(optarg); break;
+    case 'H': flags |= BLOOM_HASH64; break;
+    case 'P': flags |= BLOOM_POW2; break;
+    case 'E': flags |= BLOOM_ENHANCED; break;
+    case 'l': lenmode = 1; break;
+    case 't': threads = atoi(optarg); break;
+    case 'o': output = optarg; break;
+    default: return 2;
+    }
+  }
+
+  if (output == NULL || entries == 0 || error == 0 || optind < argc - 1) {
+    return 2;
+  }
+
+  struct bloom bloom;
+  if (bloom_init3(&bloom, entries, error, flags)) {
+    fail("unable to create filter with the given parameters", NULL);
+  }
+
+  struct input in;
+  struct chunk chunk;
+  struct chunk * chunks = NULL;
+  struct iovec * iov = (struct iovec *)xmalloc(BUILD_BATCH * sizeof(*iov));
+  unsigned long int count = 0;
+  const unsigned char * key;
+  size_t len;
+
+  input_open(&in, optind < argc ? argv[optind] : NULL, lenmode);
+
+  while (input_next(&in, &chunk)) {
+    struct chunk * c = (struct chunk *)xmalloc(sizeof(struct chunk));
+    *c = chunk;
+    c->next = chunks;
+    chunks = c;
+
+    const unsigned char * p = c->data;
+    const unsigned char * end = c->data + c->len;
+    while (next_record(&p, end, lenmode, &key, &len)) {
+      iov[count].iov_base = (void *)key;
+      iov[count].iov_len = len;
+      if (++count == BUILD_BATCH) {
+        add_batch(&bloom, iov, count, threads);
+        count = 0;
+        // Only the current chunk may still have records to come.
+        free_chunks(c->next);
+        c->next = NULL;
+      }
+    }
+  }
+
+  add_batch(&bloom, iov, count, threads);
+  free_chunks(chunks);
+
+  input_close(&in);
+  free(iov);
+  save(&bloom, output);
+  bloom_free(&bloom);
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * query
+ *
+ */
+static int cmd_query(int argc, char **argv)
+{
+  int lenmode = 0;
+  int invert = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "lv")) != -1) {
+    switch (opt) {
+    case 'l': lenmode = 1; break;
+    case 'v': invert = 1; break;
+    default: return 2;
+    }
+  }
+
+  if (optind != argc - 1 && optind != argc - 2) {
+    return 2;
+  }
+
+  struct bloom * bloom = load(argv[optind]);
+
+  struct input in;
+  struct chunk chunk;
+  const unsigned char * key;
+  size_t len;
+
+  input_open(&in, optind + 1 < argc ? argv[optind + 1] : NULL, lenmode);
+  setvbuf(stdout, NULL, _IOFBF, OUTBUF_SIZE);
+
+  while (input_next(&in, &chunk)) {
+    const unsigned char * p = chunk.data;
+    const unsigned char * end = chunk.data + chunk.len;
+    while (next_record(&p, end, lenmode, &key, &len)) {
+      if (check_add(bloom, key, len, 0) != invert) {
+        if (lenmode) {
+          fwrite(key - 4, 1, len + 4, stdout);
+        } else {
+          fwrite(key, 1, len, stdout);
+          putchar('\n');
+        }
+      }
+    }
+    if (chunk.owned) { free(chunk.data); }
+  }
+
+  input_close(&in);
+  bloom_free(bloom);
+  free(bloom);
+
+  return fflush(stdout) ? 1 : 0;
+}
+
+
+/** ***************************************************************************
+ * merge
+ *
+ */
+static int cmd_merge(int argc, char **argv)
+{
+  char * output = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:")) != -1) {
+    switch (opt) {
+    case 'o': output = optarg; break;
+    default: return 2;
+    }
+  }
+
+  if (output == NULL || optind >= argc) {
+    return 2;
+  }
+
+  switch (bloom_merge_files(output, argv + optind, argc - optind)) {
+  case 0: return 0;
+  case 2: fail("unable to load filters", NULL);
+  case 3: fail("incompatible filters", NULL);
+  default: fail("unable to write", output);
+  }
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * stats
+ *
+ */
+static int cmd_stats(int argc, char **argv)
+{
+  int n;
+
+  if (argc < 2) {
+    return 2;
+  }
+
+  for (n = 1; n < argc; n++) {
+    struct bloom * bloom = load(argv[n]);
+    unsigned long int set = 0;
+    unsigned long int p;
+
+    for (p = 0; p < bloom->bytes; p++) {
+      set += __builtin_popcount(bloom->bf[p]);
+    }
+
+    double m = (double)bloom->bits;
+    double fill = (double)set / m;
+    double k = (double)bloom->hashes;
+
+    printf("%s:\n", argv[n]);
+    printf("  version         %d.%d\n", bloom->major, bloom->minor);
+    printf("  entries         %lu\n", bloom->entries);
+    printf("  error           %g\n", bloom->error);
+    printf("  bits            %lu\n", bloom->bits);
+    printf("  bytes           %lu\n", bloom->bytes);
+    printf("  hashes          %d\n", bloom->hashes);
+    printf("  flags           0x%02x\n", bloom->flags);
+    printf("  bits set        %lu (%.4f)\n", set, fill);
+    if (set < bloom->bits) {
+      printf("  est. elements   %.0f\n", -(m / k) * log(1.0 - fill));
+    }
+    printf("  est. error      %g\n", pow(fill, k));
+
+    bloom_free(bloom);
+    free(bloom);
+  }
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * convert
+ *
+ */
+static int cmd_convert(int argc, char **argv)
+{
+  unsigned long int entries = 0;
+  double error = 0;
+  unsigned int flags = 0;
+  int to_raw = 0;
+  int from_raw = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "rRn:e:HPE")) != -1) {
+    switch (opt) {
+    case 'r': to_raw = 1; break;
+    case 'R': from_raw = 1; break;
+    case 'n': entries = strtoul(optarg, NULL, 10); break;
+    case 'e': error = atof(optarg); break;
+    case 'H': flags |= BLOOM_HASH64; break;
+    case 'P': flags |= BLOOM_POW2; break;
+    case 'E': flags |= BLOOM_ENHANCED; break;
+    default: return 2;
+    }
+  }
+
+  if (optind != argc - 2 || to_raw == from_raw) {
+    return 2;
+  }
+
+  char * input = argv[optind];
+  char * output = argv[optind + 1];
+
+  if (to_raw) {
+    struct bloom * bloom = load(input);
+    unlink(output);
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { fail("unable to create", output); }
+    unsigned char * p = bloom->bf;
+    unsigned long int left = bloom->bytes;
+    while (left > 0) {
+      ssize_t w = write(fd, p, left);
+      if (w <= 0) { fail("write error", output); }
+      p += w;
+      left -= w;
+    }
+    if (close(fd)) { fail("write error", output); }
+    bloom_free(bloom);
+    free(bloom);
+    return 0;
+  }
+
+  struct bloom bloom;
+  if (bloom_init3(&bloom, entries, error, flags)) {
+    fail("unable to create filter with the given parameters", NULL);
+  }
+
+  struct stat st;
+  int fd = open(input, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st)) { fail("unable to open", input); }
+  if (st.st_size != bloom.bytes) {
+    fail("raw input size does not match the filter parameters", input);
+  }
+  unsigned char * p = bloom.bf;
+  unsigned long int left = bloom.bytes;
+  while (left > 0) {
+    ssize_t r = read(fd, p, left);
+    if (r <= 0) { fail("read error", input); }
+    p += r;
+    left -= r;
+  }
+  close(fd);
+
+  save(&bloom, output);
+  bloom_free(&bloom);
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * fold
+ *
+ */
+static int cmd_fold(int argc, char **argv)
+{
+  unsigned int times = 0;
+  unsigned long int max_bytes = 0;
+  char * output = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:s:o:")) != -1) {
+    switch (opt) {
+    case 'f': times = atoi(optarg); break;
+    case 's': max_bytes = strtoul(optarg, NULL, 10); break;
+    case 'o': output = optarg; break;
+    default: return 2;
+    }
+  }
+
+  if (output == NULL || optind != argc - 1 ||
+      (times == 0) == (max_bytes == 0)) {
+    return 2;
+  }
+
+  struct bloom * bloom = load(argv[optind]);
+
+  if (max_bytes) {
+    while ((bloom->bytes >> times) > max_bytes) {
+      times++;
+    }
+  }
+
+  if (times > 0 && bloom_fold(bloom, times)) {
+    fail("unable to fold (not built with -P, or too small)", argv[optind]);
+  }
+
+  save(bloom, output);
+  bloom_free(bloom);
+  free(bloom);
+
+  return 0;
+}
+
+
+static void usage()
+{
+  printf("usage: bloomtool COMMAND [OPTIONS] ...\n\n");
+  printf("bloomtool build -n ENTRIES -e ERROR [-H] [-P] [-E] [-l] "
+         "[-t THREADS] -o OUTPUT [INPUT]\n");
+  printf("    Create a filter containing the elements of INPUT (or stdin).\n");
+  printf("    -H uses BLOOM_HASH64, -P uses BLOOM_POW2 (see fold),\n");
+  printf("    -E uses BLOOM_ENHANCED, -l reads length-delimited elements.\n\n");
+  printf("bloomtool query [-l] [-v] FILTER [INPUT]\n");
+  printf("    Print the elements of INPUT (or stdin) present in FILTER\n");
+  printf("    (with -v, those not present).\n\n");
+  printf("bloomtool merge -o OUTPUT FILTER...\n");
+  printf("    Merge compatible filters into OUTPUT.\n\n");
+  printf("bloomtool stats FILTER...\n");
+  printf("    Show parameters and fill of saved filters.\n\n");
+  printf("bloomtool convert -r FILTER RAW\n");
+  printf("bloomtool convert -R -n ENTRIES -e ERROR [-H] [-P] [-E] RAW FILTER\n");
+  printf("    Export the bit array of FILTER to RAW, or create FILTER with\n");
+  printf("    the given parameters from the bit array in RAW.\n\n");
+  printf("bloomtool fold -f TIMES | -s MAXBYTES -o OUTPUT FILTER\n");
+  printf("    Shrink a filter built with -P to 1/2^TIMES of its size, or\n");
+  printf("    until it is at most MAXBYTES. The error rate goes up.\n");
+}
+
+
+int main(int argc, char **argv)
+{
+  int rv = 2;
+
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+
+  char * cmd = argv[1];
+  argc--;
+  argv++;
+
+  if (!strcmp(cmd, "build")) {
+    rv = cmd_build(argc, argv);
+  } else if (!strcmp(cmd, "query")) {
+    rv = cmd_query(argc, argv);
+  } else if (!strcmp(cmd, "merge")) {
+    rv = cmd_merge(argc, argv);
+  } else if (!strcmp(cmd, "stats")) {
+    rv = cmd_stats(argc, argv);
+  } else if (!strcmp(cmd, "convert")) {
+    rv = cmd_convert(argc, argv);
+  } else if (!strcmp(cmd, "fold")) {
+    rv = cmd_fold(argc, argv);
+  }
+
+  if (rv == 2) {
+    usage();
+  }
+
+  return rv;
+}